@@ -1,23 +1,40 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 
 #include "tree.h"
 
+#define AVL_SET_UNION			0
+#define AVL_SET_INTERSECTION		1
+#define AVL_SET_DIFFERENCE		2
+#define AVL_SET_GRAIN			8192
+
+/*
+ * Node layout (for relayout and batch lookups).
+ */
+static const struct tree_layout_t node_layout = {
+	.node_size		= sizeof(struct avl_node_t),
+	.val			= offsetof(struct avl_node_t, val),
+	.left			= offsetof(struct avl_node_t, left),
+	.right			= offsetof(struct avl_node_t, right),
+	.parent			= TREE_LAYOUT_NO_PARENT,
+};
+
 /*
  * Create a node.
  */
-static struct avl_node_t *node_create(int val)
+static struct avl_node_t *node_create(struct tree_t *tree, int val)
 {
 	struct avl_node_t *node;
 
 	/* allocate a node */
-	node = (struct avl_node_t *) malloc(sizeof(struct avl_node_t));
+	node = (struct avl_node_t *) node_pool_alloc(tree->pool);
 	if (!node)
 		return NULL;
 
 	/* set node */
 	node->val = val;
+	node->size = 1;
+	node->refs = 1;
 	node->height = 1;
 	node->left = NULL;
 	node->right = NULL;
@@ -26,37 +43,11 @@ static struct avl_node_t *node_create(int val)
 }
 
 /*
- * Free a node.
- */
-static void node_free(struct avl_node_t *node)
-{
-	if (!node)
-		return;
-
-	/* free children */
-	node_free(node->left);
-	node_free(node->right);
-
-	/* free node */
-	free(node);
-}
-
-/* 
- * Compute a node height.
+ * Get node size (number of values in subtree).
  */
-static int node_full_height(struct avl_node_t *node)
+static inline int node_size(struct avl_node_t *node)
 {
-	int height_l, height_r;
-
-	if (!node)
-		return 0;
-
-	/* compute left/right heights */
-	height_l = 1 + node_full_height(node->left);
-	height_r = 1 + node_full_height(node->right);
-
-	/* return max left/right height */
-	return max(height_l, height_r);
+	return node ? node->size : 0;
 }
 
 /*
@@ -100,21 +91,132 @@ static struct avl_node_t *node_min(struct avl_node_t *node)
 	return node_min(node->left);
 }
 
+/*
+ * Update node height and size from its children.
+ */
+static inline void node_update(struct avl_node_t *node)
+{
+	node->height = 1 + max(node_height(node->left), node_height(node->right));
+	node->size = 1 + node_size(node->left) + node_size(node->right);
+}
+
+/*
+ * Get a reference on a node (persistent trees share nodes between versions).
+ */
+static inline void node_get(struct avl_node_t *node)
+{
+	if (node)
+		__atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop a reference on a node : last reference releases children and frees node (from any thread).
+ */
+static void node_put(struct node_pool_t *pool, struct avl_node_t *node)
+{
+	struct avl_node_t *right;
+
+	while (node && __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		node_put(pool, node->left);
+		right = node->right;
+		node_pool_defer(pool, node);
+		node = right;
+	}
+}
+
+/*
+ * Release a retired node (called by writer once readers can't see it anymore).
+ */
+static void node_release(void *arg, void *node)
+{
+	node_pool_free(((struct tree_t *) arg)->pool, node);
+}
+
+/*
+ * Mark a node as created by current update of a concurrent tree (readers can't see it yet).
+ */
+static inline void node_fresh(struct tree_t *tree, struct avl_node_t *node)
+{
+	node->refs = 0;
+	tree->rcu->fresh[tree->rcu->nr_fresh++] = node;
+}
+
+/*
+ * Free a node owned by current update (concurrent trees : it is a fresh copy, which must not be
+ * published anymore).
+ */
+static void node_free(struct tree_t *tree, struct avl_node_t *node)
+{
+	int i;
+
+	if (tree->flags & TREE_FLAG_CONCURRENT) {
+		for (i = tree->rcu->nr_fresh - 1; i >= 0; i--) {
+			if (tree->rcu->fresh[i] == node) {
+				tree->rcu->fresh[i] = tree->rcu->fresh[--tree->rcu->nr_fresh];
+				break;
+			}
+		}
+	}
+
+	node_pool_free(tree->pool, node);
+}
+
+/*
+ * Get a private copy of a node before updating it (persistent trees copy shared nodes only,
+ * concurrent trees copy nodes readers may see).
+ */
+static struct avl_node_t *node_own(struct tree_t *tree, struct avl_node_t *node)
+{
+	struct avl_node_t *copy;
+
+	if (!node || !(tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT)))
+		return node;
+	if (tree->flags & TREE_FLAG_CONCURRENT ? node->refs == 0 : __atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) == 1)
+		return node;
+
+	/* copy node (pool has been reserved) */
+	copy = (struct avl_node_t *) node_pool_alloc(tree->pool);
+	copy->val = node->val;
+	copy->height = node->height;
+	copy->size = node->size;
+	copy->left = node->left;
+	copy->right = node->right;
+
+	/* concurrent trees : original node will be retired once new root is published */
+	if (tree->flags & TREE_FLAG_CONCURRENT) {
+		node_fresh(tree, copy);
+		tree->rcu->stale[tree->rcu->nr_stale++] = node;
+		return copy;
+	}
+
+	/* persistent trees : children get one more parent, and this version doesn't use original node anymore */
+	copy->refs = 1;
+	node_get(copy->left);
+	node_get(copy->right);
+	node_put(tree->pool, node);
+
+	return copy;
+}
+
 /*
  * Right rotate subtree rooted with y.
  */
-struct avl_node_t *right_rotate(struct avl_node_t *y)
+static struct avl_node_t *right_rotate(struct tree_t *tree, struct avl_node_t *y)
 {
-	struct avl_node_t *x = y->left;
-	struct avl_node_t *t2 = x->right;
+	struct avl_node_t *x, *t2;
+
+	/* rotated nodes must not be shared */
+	y = node_own(tree, y);
+	x = node_own(tree, y->left);
+	t2 = x->right;
 
 	/* rotate */
 	x->right = y;
 	y->left = t2;
 
-	/* update heights */
-	y->height = max(node_height(y->left), node_height(y->right)) + 1;
-	x->height = max(node_height(x->left), node_height(x->right)) + 1;
+	/* update heights and sizes */
+	node_update(y);
+	node_update(x);
 
 	return x;
 }
@@ -122,18 +224,22 @@ struct avl_node_t *right_rotate(struct avl_node_t *y)
 /*
  * Left rotate subtree rooted with x.
  */
-struct avl_node_t *left_rotate(struct avl_node_t *x)
+static struct avl_node_t *left_rotate(struct tree_t *tree, struct avl_node_t *x)
 {
-	struct avl_node_t *y = x->right;
-	struct avl_node_t *t2 = y->left;
+	struct avl_node_t *y, *t2;
+
+	/* rotated nodes must not be shared */
+	x = node_own(tree, x);
+	y = node_own(tree, x->right);
+	t2 = y->left;
 
 	/* rotate */
 	y->left = x;
 	x->right = t2;
 
-	/* update heights */
-	x->height = max(node_height(x->left), node_height(x->right)) + 1;
-	y->height = max(node_height(y->left), node_height(y->right)) + 1;
+	/* update heights and sizes */
+	node_update(x);
+	node_update(y);
 
 	return y;
 }
@@ -150,56 +256,201 @@ static int node_balance(struct avl_node_t *node)
 }
 
 /*
- * Insert a value in a node.
+ * Join two nodes with a middle node, left node being higher (all values of left < key < all values of right).
+ */
+static struct avl_node_t *node_join_right(struct tree_t *tree, struct avl_node_t *left, struct avl_node_t *key,
+					  struct avl_node_t *right)
+{
+	/* right spine is low enough : hang key and right node here */
+	if (node_height(left->right) <= node_height(right) + 1) {
+		key->left = left->right;
+		key->right = right;
+		node_update(key);
+
+		if (node_height(key) <= node_height(left->left) + 1) {
+			left->right = key;
+			node_update(left);
+			return left;
+		}
+
+		left->right = right_rotate(tree, key);
+		node_update(left);
+		return left_rotate(tree, left);
+	}
+
+	/* go down right spine */
+	left->right = node_join_right(tree, left->right, key, right);
+	node_update(left);
+
+	if (node_height(left->right) <= node_height(left->left) + 1)
+		return left;
+
+	return left_rotate(tree, left);
+}
+
+/*
+ * Join two nodes with a middle node, right node being higher (all values of left < key < all values of right).
+ */
+static struct avl_node_t *node_join_left(struct tree_t *tree, struct avl_node_t *left, struct avl_node_t *key,
+					 struct avl_node_t *right)
+{
+	/* left spine is low enough : hang key and left node here */
+	if (node_height(right->left) <= node_height(left) + 1) {
+		key->left = left;
+		key->right = right->left;
+		node_update(key);
+
+		if (node_height(key) <= node_height(right->right) + 1) {
+			right->left = key;
+			node_update(right);
+			return right;
+		}
+
+		right->left = left_rotate(tree, key);
+		node_update(right);
+		return right_rotate(tree, right);
+	}
+
+	/* go down left spine */
+	right->left = node_join_left(tree, left, key, right->left);
+	node_update(right);
+
+	if (node_height(right->left) <= node_height(right->right) + 1)
+		return right;
+
+	return right_rotate(tree, right);
+}
+
+/*
+ * Join two nodes with a middle node (all values of left < key < all values of right).
+ */
+static struct avl_node_t *node_join(struct tree_t *tree, struct avl_node_t *left, struct avl_node_t *key,
+				    struct avl_node_t *right)
+{
+	if (node_height(left) > node_height(right) + 1)
+		return node_join_right(tree, left, key, right);
+
+	if (node_height(right) > node_height(left) + 1)
+		return node_join_left(tree, left, key, right);
+
+	key->left = left;
+	key->right = right;
+	node_update(key);
+
+	return key;
+}
+
+/*
+ * Split a node in values lower than val and values greater than val (node holding val is returned).
+ */
+static struct avl_node_t *node_split(struct tree_t *tree, struct avl_node_t *node, int val, struct avl_node_t **left,
+				     struct avl_node_t **right)
+{
+	struct avl_node_t *found, *sub;
+
+	if (!node) {
+		*left = NULL;
+		*right = NULL;
+		return NULL;
+	}
+
+	if (val < node->val) {
+		found = node_split(tree, node->left, val, left, &sub);
+		*right = node_join(tree, sub, node, node->right);
+	} else if (val > node->val) {
+		found = node_split(tree, node->right, val, &sub, right);
+		*left = node_join(tree, node->left, node, sub);
+	} else {
+		*left = node->left;
+		*right = node->right;
+		found = node;
+	}
+
+	return found;
+}
+
+/*
+ * Remove maximum node of a node.
+ */
+static struct avl_node_t *node_split_last(struct tree_t *tree, struct avl_node_t *node,
+					  struct avl_node_t **last)
+{
+	if (!node->right) {
+		*last = node;
+		return node->left;
+	}
+
+	return node_join(tree, node->left, node, node_split_last(tree, node->right, last));
+}
+
+/*
+ * Join two nodes (all values of left < all values of right).
+ */
+static struct avl_node_t *node_join2(struct tree_t *tree, struct avl_node_t *left, struct avl_node_t *right)
+{
+	struct avl_node_t *last;
+
+	if (!left)
+		return right;
+
+	left = node_split_last(tree, left, &last);
+	return node_join(tree, left, last, right);
+}
+
+/*
+ * Insert a value in a node (recursive version : every node of the path is updated on the way back).
  */
-static struct avl_node_t *node_insert(struct tree_t *tree, struct avl_node_t *node, int val)
+static struct avl_node_t *node_insert_recursive(struct tree_t *tree, struct avl_node_t *node, int val)
 {
 	int balance;
 
 	/* leaf : insert node */
 	if (!node) {
 		/* create node */
-		node = node_create(val);
+		node = node_create(tree, val);
 		if (!node)
 			goto out;
+		if (tree->flags & TREE_FLAG_CONCURRENT)
+			node_fresh(tree, node);
 
 		/* update tree size */
 		tree->size++;
 		goto out;
 	}
 
-	/* find subtree */
+	/* find subtree (on a private copy of this node) */
+	node = node_own(tree, node);
 	if (val < node->val)
-		node->left = node_insert(tree, node->left, val);
+		node->left = node_insert_recursive(tree, node->left, val);
 	else if (val > node->val)
-		node->right = node_insert(tree, node->right, val);
+		node->right = node_insert_recursive(tree, node->right, val);
 	else
 		goto out;
 
-	/* update node height */
-	node->height = 1 + max(node_height(node->left), node_height(node->right));
+	/* update node height and size */
+	node_update(node);
 
 	/* compute node balance */
 	balance = node_balance(node);
 
 	/* left left case */
 	if (balance > 1 && val < node->left->val)
-		return right_rotate(node);
+		return right_rotate(tree, node);
 	
 	/* right right case */
 	if (balance < -1 && val > node->right->val)
-		return left_rotate(node);
+		return left_rotate(tree, node);
  
 	/* left right case */
 	if (balance > 1 && val > node->left->val) {
-        	node->left = left_rotate(node->left);
-        	return right_rotate(node);
+        	node->left = left_rotate(tree, node->left);
+        	return right_rotate(tree, node);
     	}
  
 	/* right left case */
 	if (balance < -1 && val < node->right->val) {
-		node->right = right_rotate(node->right);
-		return left_rotate(node);
+		node->right = right_rotate(tree, node->right);
+		return left_rotate(tree, node);
 	}
 
 out:
@@ -207,9 +458,9 @@ out:
 }
 
 /*
- * Delete a value in a node.
+ * Delete a value in a node (recursive version : every node of the path is updated on the way back).
  */
-static struct avl_node_t *node_delete(struct tree_t *tree, struct avl_node_t *node, int val)
+static struct avl_node_t *node_delete_recursive(struct tree_t *tree, struct avl_node_t *node, int val)
 {
 	struct avl_node_t *tmp;
 	int balance;
@@ -217,32 +468,23 @@ static struct avl_node_t *node_delete(struct tree_t *tree, struct avl_node_t *no
 	if (!node)
 		return NULL;
 
+	/* work on a private copy of this node */
+	node = node_own(tree, node);
+
 	/* delete in left child */
 	if (val < node->val) {
-		node->left = node_delete(tree, node->left, val);
+		node->left = node_delete_recursive(tree, node->left, val);
 	/* delete in right child */
 	} else if (val > node->val) {
-		node->right = node_delete(tree, node->right, val);
+		node->right = node_delete_recursive(tree, node->right, val);
 	/* this node must be deleted */
 	} else {
-		/* only one child or no child */
+		/* only one child or no child : replace this node with its child (already balanced) */
 		if (!node->left || !node->right) {
 			tmp = node->left ? node->left : node->right;
-
-			/* no child : just free this node */
-			if (!tmp) {
-				tmp = node;
-				node = NULL;
-				goto free_this_node;
-			}
-
-			/* one child : replace this node with it */
-			*node = *tmp;
-free_this_node:
-			/* free this node */
 			tree->size--;
-			free(tmp);
-			goto balance_this_node;
+			node_free(tree, node);
+			return tmp;
 		}
 
 		/* find minimum value in right child */
@@ -252,210 +494,1435 @@ free_this_node:
 		node->val = tmp->val;
 
 		/* delete minimum value in right child */
-		node->right = node_delete(tree, node->right, node->val);
+		node->right = node_delete_recursive(tree, node->right, node->val);
 	}
 
-balance_this_node:
-	if (!node)
-		return NULL;
-
-	/* update node height */
-	node->height = 1 + max(node_height(node->left), node_height(node->right));
+	/* update node height and size */
+	node_update(node);
 
 	/* compute node balance */
 	balance = node_balance(node);
 
 	/* left left case */
 	if (balance > 1 && node_balance(node->left) >= 0)
-		return right_rotate(node);
+		return right_rotate(tree, node);
 
 	/* left right case */
 	if (balance > 1 && node_balance(node->left) < 0) {
-		node->left = left_rotate(node->left);
-		return right_rotate(node);
+		node->left = left_rotate(tree, node->left);
+		return right_rotate(tree, node);
 	}
 
 	/* right right case */
 	if (balance < -1 && node_balance(node->right) <= 0)
-		return left_rotate(node);
+		return left_rotate(tree, node);
 
 	/* right left case */
 	if (balance < -1 && node_balance(node->right) > 0) {
-		node->right = right_rotate(node->right);
-		return left_rotate(node);
+		node->right = right_rotate(tree, node->right);
+		return left_rotate(tree, node);
 	}
 
 	return node;
 }
 
 /*
- * Init a tree.
+ * Restore balance of a node whose height and size are up to date (children are balanced).
  */
-static void tree_init(struct tree_t *tree)
+static struct avl_node_t *node_rebalance(struct tree_t *tree, struct avl_node_t *node)
 {
-	if (!tree)
-		return;
+	int balance = node_balance(node);
 
-	tree->size = 0;
-	tree->root.avl = NULL;
+	/* left left and left right cases */
+	if (balance > 1) {
+		if (node_balance(node->left) < 0)
+			node->left = left_rotate(tree, node->left);
+		return right_rotate(tree, node);
+	}
+
+	/* right right and right left cases */
+	if (balance < -1) {
+		if (node_balance(node->right) > 0)
+			node->right = right_rotate(tree, node->right);
+		return left_rotate(tree, node);
+	}
+
+	return node;
 }
 
 /*
- * Free a tree.
+ * Go down to val, storing links to nodes of the path (nodes are made private on the way). Returns
+ * link to node holding val, or to the empty leaf where it belongs.
  */
-static void tree_free(struct tree_t *tree)
+static struct avl_node_t **node_path(struct tree_t *tree, struct avl_node_t **link, int val,
+				     struct avl_node_t ***path, int *depth)
 {
-	if (!tree)
-		return;
+	struct avl_node_t *node;
 
-	node_free(tree->root.avl);
-	free(tree);
+	while (*link) {
+		node = node_own(tree, *link);
+		if (node != *link)
+			*link = node;
+		if (val == node->val)
+			break;
+
+		path[(*depth)++] = link;
+		link = val < node->val ? &node->left : &node->right;
+	}
+
+	return link;
 }
 
 /*
- * Compute a tree height.
+ * Retrace a path bottom up after its last subtree grew or shrank by one node : heights are fixed
+ * and nodes rebalanced until a subtree keeps its height, above it only sizes change.
  */
-static int tree_height(struct tree_t *tree)
+static void node_retrace(struct tree_t *tree, struct avl_node_t ***path, int depth, int delta)
 {
-	if (!tree)
-		return 0;
+	struct avl_node_t *node;
+	int height;
+
+	while (depth > 0) {
+		node = *path[--depth];
+		height = node->height;
+
+		node_update(node);
+		node = node_rebalance(tree, node);
+		*path[depth] = node;
 
-	return node_full_height(tree->root.avl);
+		if (node->height == height)
+			break;
+	}
+
+	/* height didn't change : update sizes only */
+	while (depth > 0)
+		(*path[--depth])->size += delta;
 }
 
 /*
- * Find a node in a tree.
+ * Insert a value in a node (iterative version : retracing stops once a subtree height is unchanged).
  */
-static int tree_find(struct tree_t *tree, int val)
+static struct avl_node_t *node_insert(struct tree_t *tree, struct avl_node_t *root, int val)
 {
-	if (!tree)
-		return 0;
+	struct avl_node_t **path[NODE_STACK_SIZE], **link, *node;
+	int depth = 0;
+
+	/* find leaf */
+	link = node_path(tree, &root, val, path, &depth);
+	if (*link)
+		return root;
+
+	/* create node */
+	node = node_create(tree, val);
+	if (!node)
+		return root;
+	if (tree->flags & TREE_FLAG_CONCURRENT)
+		node_fresh(tree, node);
+
+	/* insert node and update tree size */
+	*link = node;
+	tree->size++;
 
-	return node_find(tree->root.avl, val) != NULL;
+	node_retrace(tree, path, depth, 1);
+	return root;
 }
 
 /*
- * Insert a value in a tree.
+ * Delete a value in a node (iterative version : retracing stops once a subtree height is unchanged).
  */
-static void tree_insert(struct tree_t *tree, int val)
+static struct avl_node_t *node_delete(struct tree_t *tree, struct avl_node_t *root, int val)
 {
-	if (!tree)
-		return;
+	struct avl_node_t **path[NODE_STACK_SIZE], **link, *node, *tmp;
+	int depth = 0;
+
+	/* find node */
+	link = node_path(tree, &root, val, path, &depth);
+	node = *link;
+	if (!node)
+		return root;
+
+	/* two children : move minimum of right child in this node, and delete minimum node instead */
+	if (node->left && node->right) {
+		path[depth++] = link;
+		node_path(tree, &node->right, val, path, &depth);
+		link = path[--depth];
+		tmp = *link;
+
+		node->val = tmp->val;
+		node = tmp;
+	}
 
-	tree->root.avl = node_insert(tree, tree->root.avl, val);
+	/* replace node with its only child (already balanced) */
+	*link = node->left ? node->left : node->right;
+	tree->size--;
+	node_free(tree, node);
+
+	node_retrace(tree, path, depth, -1);
+	return root;
 }
 
 /*
- * Delete a value in a tree.
+ * Count values lower than val (or lower or equal if inclusive).
  */
-static void tree_delete(struct tree_t *tree, int val)
+static int node_rank(struct avl_node_t *node, int val, int inclusive)
 {
-	if (!tree)
-		return;
+	int rank = 0;
+
+	while (node) {
+		if (node->val < val || (inclusive && node->val == val)) {
+			rank += node_size(node->left) + 1;
+			node = node->right;
+		} else {
+			node = node->left;
+		}
+	}
 
-	tree->root.avl = node_delete(tree, tree->root.avl, val);
+	return rank;
 }
 
 /*
- * Balance a tree.
+ * Find k-th smallest value of a node (k starts at 0).
  */
-static void tree_balance(struct tree_t *tree)
+static struct avl_node_t *node_select(struct avl_node_t *node, int k)
 {
-	/* nothing to do : AVL trees are always balanced */
-	UNUSED(tree);
+	int size_l;
+
+	while (node) {
+		size_l = node_size(node->left);
+
+		if (k < size_l) {
+			node = node->left;
+		} else if (k > size_l) {
+			k -= size_l + 1;
+			node = node->right;
+		} else {
+			break;
+		}
+	}
+
+	return node;
 }
 
 /*
- * Draw a node value.
+ * Store values of a node in order, at most cap values (nodes are only read : they may be shared with
+ * other threads). Returns number of values stored.
  */
-static void node_draw_value(struct avl_node_t *node, cairo_t *cr, int x, gint y)
+static size_t node_keys(struct avl_node_t *node, int *keys, size_t cap)
 {
-	char val_string[64];
-	int len;
-
-	/* draw rectangle node */
-	cairo_set_line_width(cr, 2.0);
-	cairo_set_source_rgb(cr, 0, 0, 0);
-	cairo_rectangle(cr, x, y, NODE_SIZE_X, NODE_SIZE_Y);
-	cairo_stroke(cr);
+	struct avl_node_t *stack[NODE_STACK_SIZE];
+	size_t n = 0;
+	int top = 0;
+
+	while ((node || top > 0) && n < cap) {
+		/* go down left spine */
+		for (; node != NULL; node = node->left)
+			stack[top++] = node;
+
+		/* store value and go right */
+		node = stack[--top];
+		keys[n++] = node->val;
+		node = node->right;
+	}
 
-	/* draw value */
-	len = sprintf(val_string, "%d", node->val);
-	cairo_select_font_face(cr, NODE_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-	cairo_set_font_size(cr, 12);
-	cairo_move_to(cr, len == 1 ? x + 6 : x + 3, y + 15);
-	cairo_show_text(cr, val_string);
+	return n;
 }
 
 /*
- * Draw a node.
+ * Build a balanced node/tree from sorted values (nodes are allocated in pre order, values are left
+ * unset if keys is NULL).
  */
-static void node_draw(struct avl_node_t *node, cairo_t *cr, int x, int y, int space_sibling)
+static struct avl_node_t *node_build(struct tree_t *tree, const int *keys, int n)
 {
-	int x_child, y_child;
+	struct {
+		int			start;
+		int			end;
+		struct avl_node_t **	link;
+	} stack[NODE_STACK_SIZE];
+	struct avl_node_t *root = NULL, *node, **link;
+	int top = 0, start, end, mid;
+
+	/* push whole range */
+	stack[top].start = 0;
+	stack[top].end = n - 1;
+	stack[top++].link = &root;
+
+	while (top > 0) {
+		/* pop a range */
+		top--;
+		start = stack[top].start;
+		end = stack[top].end;
+		link = stack[top].link;
+
+		/* no more values */
+		if (start > end) {
+			*link = NULL;
+			continue;
+		}
 
-	if (!node)
-		return;
+		/* make middle value as root */
+		mid = (start + end) / 2;
+		node = node_create(tree, keys ? keys[mid] : 0);
+		if (!node)
+			return NULL;
+		node->height = tree_balanced_height(end - start + 1);
+		node->size = end - start + 1;
+		*link = node;
+
+		/* build right child */
+		stack[top].start = mid + 1;
+		stack[top].end = end;
+		stack[top++].link = &node->right;
+
+		/* build left child */
+		stack[top].start = start;
+		stack[top].end = mid - 1;
+		stack[top++].link = &node->left;
+	}
 
-	/* draw value */
-	node_draw_value(node, cr, x, y);
+	return root;
+}
 
-	/* draw left child */
-	if (node->left) {
-		/* compute x/y child */
-		x_child = x - NODE_SIZE_X * space_sibling;
-		y_child = y + NODE_SIZE_Y * 2;
+/*
+ * Read values of a node in order from a reader.
+ */
+static int node_fill(struct avl_node_t *node, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct avl_node_t *stack[NODE_STACK_SIZE];
+	int top = 0;
 
-		/* draw left arrow */
-		cairo_move_to(cr, x + NODE_SIZE_X / 2, y + NODE_SIZE_Y);
-		cairo_line_to(cr, x_child + NODE_SIZE_X / 2, y_child);
-		cairo_stroke(cr);
+	while (node || top > 0) {
+		for (; node != NULL; node = node->left)
+			stack[top++] = node;
 
-		/* draw left node */
-		node_draw(node->left, cr, x_child, y_child, space_sibling / 2);
+		node = stack[--top];
+		if (read(arg, &node->val, 1))
+			return -1;
+		node = node->right;
 	}
 
-	/* draw right child */
-	if (node->right) {
-		/* compute x/y child */
-		x_child = x + NODE_SIZE_X * space_sibling;
-		y_child = y + NODE_SIZE_Y * 2;
+	return 0;
+}
+
+/*
+ * Init a tree.
+ */
+static int tree_init(struct tree_t *tree)
+{
+	if (!tree)
+		return -1;
+
+	/* create node pool */
+	tree->pool = node_pool_create(sizeof(struct avl_node_t));
+	if (!tree->pool)
+		return -1;
+
+	tree->size = 0;
+	tree->root.avl = NULL;
+
+	return 0;
+}
+
+/*
+ * Free a tree.
+ */
+static void tree_free(struct tree_t *tree)
+{
+	if (!tree)
+		return;
 
-		/* draw right arrow */
-		cairo_move_to(cr, x + NODE_SIZE_X / 2, y + NODE_SIZE_Y);
-		cairo_line_to(cr, x_child + NODE_SIZE_X / 2, y_child);
-		cairo_stroke(cr);
+	/* persistent trees : release nodes still used by other versions one by one */
+	if ((tree->flags & TREE_FLAG_PERSISTENT) && __atomic_load_n(&tree->pool->refs, __ATOMIC_ACQUIRE) > 1)
+		node_put(tree->pool, tree->root.avl);
 
-		/* draw right node */
-		node_draw(node->right, cr, x_child, y_child, space_sibling / 2);
+	/* concurrent trees : readers must be gone, retired nodes are released with the pool */
+	if (tree->rcu) {
+		epoch_limbo_free(&tree->rcu->limbo);
+		free(tree->rcu);
 	}
+
+	/* release all nodes at once */
+	node_pool_destroy(tree->pool);
+	free(tree);
 }
 
 /*
- * Draw a tree.
+ * Start reading a tree : concurrent trees readers are protected by an epoch, and see a published root.
  */
-static void tree_draw(struct tree_t *tree, GtkWidget *drawing_area, cairo_t *cr)
+static inline struct avl_node_t *tree_read_begin(struct tree_t *tree)
 {
-	GtkAllocation *alloc;
-	int space_sibling;
-	int x, y;
-	
-	/* compute space between sibling */
-	space_sibling = pow(2, tree->ops->height(tree) - 1) / 2;
+	if (tree->flags & TREE_FLAG_CONCURRENT)
+		epoch_enter();
+
+	return __atomic_load_n(&tree->root.avl, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Stop reading a tree.
+ */
+static inline void tree_read_end(struct tree_t *tree)
+{
+	if (tree->flags & TREE_FLAG_CONCURRENT)
+		epoch_exit();
+}
+
+/*
+ * Publish a new root (concurrent trees readers may see nodes of this update from now on).
+ */
+static void tree_publish(struct tree_t *tree, struct avl_node_t *root)
+{
+	int i;
+
+	__atomic_store_n(&tree->root.avl, root, __ATOMIC_RELEASE);
 
-	/* get drawing area size */
-	alloc = g_new(GtkAllocation, 1);
-	gtk_widget_get_allocation(drawing_area, alloc);
+	if (tree->flags & TREE_FLAG_CONCURRENT) {
+		for (i = 0; i < tree->rcu->nr_fresh; i++)
+			((struct avl_node_t *) tree->rcu->fresh[i])->refs = 1;
 
-	/* start at middle x */
-	x = alloc->width / 2;
-	y = 100;
+		/* replaced nodes are freed once readers which may see them are gone */
+		for (i = 0; i < tree->rcu->nr_stale; i++)
+			epoch_retire(&tree->rcu->limbo, tree->rcu->stale[i], node_release, tree);
 
-	/* free drawing area size */
-	g_free(alloc);
+		tree->rcu->nr_fresh = 0;
+		tree->rcu->nr_stale = 0;
+		epoch_collect(&tree->rcu->limbo, node_release, tree);
+	}
+}
+
+/*
+ * Compute a tree height.
+ */
+static int tree_height(struct tree_t *tree)
+{
+	int height;
 
-	/* draw root node */
-	node_draw(tree->root.avl, cr, x, y, space_sibling);
+	if (!tree)
+		return 0;
+
+	height = node_height(tree_read_begin(tree));
+	tree_read_end(tree);
+
+	return height;
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	struct avl_node_t *node;
+
+	if (!tree)
+		return 0;
+
+	node = node_min(tree_read_begin(tree));
+	if (node)
+		*val = node->val;
+	tree_read_end(tree);
+
+	return node != NULL;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	struct avl_node_t *node;
+
+	if (!tree)
+		return 0;
+
+	node = tree_read_begin(tree);
+	for (; node && node->right;)
+		node = node->right;
+	if (node)
+		*val = node->val;
+	tree_read_end(tree);
+
+	return node != NULL;
+}
+
+/*
+ * Find a node in a tree.
+ */
+static int tree_find(struct tree_t *tree, int val)
+{
+	int found;
+
+	if (!tree)
+		return 0;
+
+	found = node_find(tree_read_begin(tree), val) != NULL;
+	tree_read_end(tree);
+
+	return found;
+}
+
+/*
+ * Find n values in a tree (searches are interleaved, see tree_layout_find_many()).
+ */
+static void tree_find_interleaved(struct tree_t *tree, const int *keys, size_t n, uint8_t *out)
+{
+	if (!tree)
+		return;
+
+	tree_layout_find_many(tree_read_begin(tree), &node_layout, keys, n, out);
+	tree_read_end(tree);
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void tree_insert(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return;
+
+	/* persistent/concurrent trees : path copy needs at most height + 1 nodes */
+	if (tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT)) {
+		node_pool_drain(tree->pool);
+		if (node_find(tree->root.avl, val) || node_pool_reserve(tree->pool, node_height(tree->root.avl) + 1))
+			return;
+	}
+
+	if (tree->flags & TREE_FLAG_RECURSIVE)
+		tree_publish(tree, node_insert_recursive(tree, tree->root.avl, val));
+	else
+		tree_publish(tree, node_insert(tree, tree->root.avl, val));
+	tree_relayout_update(tree);
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void tree_delete(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return;
+
+	/* persistent/concurrent trees : path copy and rotations of siblings need at most 3 nodes per level */
+	if (tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT)) {
+		node_pool_drain(tree->pool);
+		if (!node_find(tree->root.avl, val) || node_pool_reserve(tree->pool, 3 * node_height(tree->root.avl)))
+			return;
+	}
+
+	if (tree->flags & TREE_FLAG_RECURSIVE)
+		tree_publish(tree, node_delete_recursive(tree, tree->root.avl, val));
+	else
+		tree_publish(tree, node_delete(tree, tree->root.avl, val));
+	tree_relayout_update(tree);
+}
+
+/*
+ * Balance a tree.
+ */
+static void tree_balance(struct tree_t *tree)
+{
+	/* nothing to do : AVL trees are always balanced */
+	UNUSED(tree);
+}
+
+/*
+ * Load values in a tree : a balanced tree is built from scratch in O(n) once values are sorted.
+ */
+static int tree_bulk_load(struct tree_t *tree, const int *keys, size_t n)
+{
+	struct node_pool_t *pool, *old_pool;
+	int *sorted, *merged, *old_keys;
+	size_t nr_old;
+	struct avl_node_t *root, *old_root;
+
+	if (!tree)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* sort and deduplicate values */
+	sorted = tree_sort_keys(keys, &n);
+	if (!sorted)
+		return -1;
+
+	/* merge with values already in the tree */
+	if (tree->size > 0) {
+		old_keys = (int *) malloc(sizeof(int) * tree->size);
+		if (!old_keys)
+			goto err;
+
+		nr_old = node_keys(tree->root.avl, old_keys, tree->size);
+		merged = tree_merge_keys(sorted, n, old_keys, nr_old, &n);
+		free(old_keys);
+		if (!merged)
+			goto err;
+
+		free(sorted);
+		sorted = merged;
+	}
+
+	/* too many values */
+	if (n > INT_MAX)
+		goto err;
+
+	/* build tree in a fresh pool, so that nodes are packed */
+	pool = node_pool_create(sizeof(struct avl_node_t));
+	if (!pool)
+		goto err;
+	old_pool = tree->pool;
+	tree->pool = pool;
+	root = node_build(tree, sorted, n);
+	if (!root) {
+		tree->pool = old_pool;
+		node_pool_destroy(pool);
+		goto err;
+	}
+
+	/* set tree */
+	old_root = tree->root.avl;
+	__atomic_store_n(&tree->root.avl, root, __ATOMIC_RELEASE);
+	tree->size = n;
+
+	/* concurrent trees : wait for readers of old nodes, retired nodes go away with old pool */
+	if (tree->flags & TREE_FLAG_CONCURRENT) {
+		epoch_synchronize();
+		epoch_limbo_free(&tree->rcu->limbo);
+	}
+
+	/* release old nodes */
+	if (tree->flags & TREE_FLAG_PERSISTENT)
+		node_put(old_pool, old_root);
+	node_pool_destroy(old_pool);
+
+	free(sorted);
+	return 0;
+err:
+	free(sorted);
+	return -1;
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : a balanced shape is built first,
+ * then values are read in order into it.
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct avl_node_t *root;
+
+	if (!tree || tree->size > 0 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* nodes of a failed load stay in pool until tree is freed */
+	root = node_build(tree, NULL, n);
+	if (!root || node_fill(root, read, arg))
+		return -1;
+
+	/* set tree (readers of concurrent trees see it once filled) */
+	__atomic_store_n(&tree->root.avl, root, __ATOMIC_RELEASE);
+	tree->size = n;
+
+	return 0;
+}
+
+/*
+ * Store values of a tree in order (at most cap values). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	size_t n;
+
+	if (!tree)
+		return 0;
+
+	n = node_keys(tree_read_begin(tree), keys, cap);
+	tree_read_end(tree);
+
+	return n;
+}
+
+/*
+ * Count values lower than val in a tree.
+ */
+static int tree_rank(struct tree_t *tree, int val)
+{
+	int rank;
+
+	if (!tree)
+		return 0;
+
+	rank = node_rank(tree_read_begin(tree), val, 0);
+	tree_read_end(tree);
+
+	return rank;
+}
+
+/*
+ * Find k-th smallest value of a tree (k starts at 0).
+ */
+static int tree_select(struct tree_t *tree, int k, int *val)
+{
+	struct avl_node_t *node;
+
+	if (!tree || k < 0)
+		return 0;
+
+	node = node_select(tree_read_begin(tree), k);
+	if (node)
+		*val = node->val;
+	tree_read_end(tree);
+
+	return node != NULL;
+}
+
+/*
+ * Count values in [lo, hi] in a tree.
+ */
+static int tree_count_range(struct tree_t *tree, int lo, int hi)
+{
+	struct avl_node_t *root;
+	int count;
+
+	if (!tree || lo > hi)
+		return 0;
+
+	root = tree_read_begin(tree);
+	count = node_rank(root, hi, 1) - node_rank(root, lo, 0);
+	tree_read_end(tree);
+
+	return count;
+}
+
+/*
+ * Position an iterator on first value >= val (or last value <= val if backward is set).
+ */
+static int iter_find(struct tree_iter_t *iter, int val, int backward)
+{
+	struct avl_node_t *node, *found = NULL;
+	int depth = 0, found_depth = 0;
+
+	/* descend from root, remembering path and best candidate */
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	for (node = __atomic_load_n(&iter->tree->root.avl, __ATOMIC_ACQUIRE); node != NULL;) {
+		tree_iter_push(iter, node);
+		depth++;
+
+		if (node->val == val) {
+			found = node;
+			found_depth = depth;
+			break;
+		}
+
+		if (val < node->val) {
+			if (!backward) {
+				found = node;
+				found_depth = depth;
+			}
+			node = node->left;
+		} else {
+			if (backward) {
+				found = node;
+				found_depth = depth;
+			}
+			node = node->right;
+		}
+	}
+
+	/* no such value */
+	if (!found) {
+		tree_iter_reset(iter, backward ? TREE_ITER_BEGIN : TREE_ITER_END);
+		return 0;
+	}
+
+	/* climb back to candidate */
+	for (; depth > found_depth && iter->depth > 0; depth--)
+		tree_iter_pop(iter);
+
+	/* candidate dropped out of path : descend again straight to it */
+	if (tree_iter_peek(iter) != found) {
+		tree_iter_reset(iter, TREE_ITER_VALUE);
+		for (node = __atomic_load_n(&iter->tree->root.avl, __ATOMIC_ACQUIRE); node != found;) {
+			tree_iter_push(iter, node);
+			node = found->val < node->val ? node->left : node->right;
+		}
+
+		tree_iter_push(iter, found);
+	}
+
+	iter->val = found->val;
+	return 1;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	if (!iter || !tree)
+		return 0;
+
+	iter->tree = tree;
+	return iter_find(iter, val, 0);
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	struct avl_node_t *node, *child;
+
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+	if (iter->state == TREE_ITER_BEGIN)
+		return iter_find(iter, INT_MIN, 0);
+
+	/* leftmost node of right child */
+	node = (struct avl_node_t *) tree_iter_peek(iter);
+	if (node->right) {
+		for (node = node->right; node != NULL; node = node->left)
+			tree_iter_push(iter, node);
+
+		iter->val = ((struct avl_node_t *) tree_iter_peek(iter))->val;
+		return 1;
+	}
+
+	/* first ancestor reached from a left child */
+	for (;;) {
+		child = (struct avl_node_t *) tree_iter_pop(iter);
+		node = (struct avl_node_t *) tree_iter_peek(iter);
+		if (!node)
+			break;
+
+		if (node->left == child) {
+			iter->val = node->val;
+			return 1;
+		}
+	}
+
+	/* climbed past remembered ancestors : seek from root */
+	if (child != __atomic_load_n(&iter->tree->root.avl, __ATOMIC_ACQUIRE) && iter->val < INT_MAX)
+		return iter_find(iter, iter->val + 1, 0);
+
+	tree_iter_reset(iter, TREE_ITER_END);
+	return 0;
+}
+
+/*
+ * Move an iterator to previous value.
+ */
+static int tree_prev(struct tree_iter_t *iter)
+{
+	struct avl_node_t *node, *child;
+
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+	if (iter->state == TREE_ITER_END)
+		return iter_find(iter, INT_MAX, 1);
+
+	/* rightmost node of left child */
+	node = (struct avl_node_t *) tree_iter_peek(iter);
+	if (node->left) {
+		for (node = node->left; node != NULL; node = node->right)
+			tree_iter_push(iter, node);
+
+		iter->val = ((struct avl_node_t *) tree_iter_peek(iter))->val;
+		return 1;
+	}
+
+	/* first ancestor reached from a right child */
+	for (;;) {
+		child = (struct avl_node_t *) tree_iter_pop(iter);
+		node = (struct avl_node_t *) tree_iter_peek(iter);
+		if (!node)
+			break;
+
+		if (node->right == child) {
+			iter->val = node->val;
+			return 1;
+		}
+	}
+
+	/* climbed past remembered ancestors : seek from root */
+	if (child != __atomic_load_n(&iter->tree->root.avl, __ATOMIC_ACQUIRE) && iter->val > INT_MIN)
+		return iter_find(iter, iter->val - 1, 1);
+
+	tree_iter_reset(iter, TREE_ITER_BEGIN);
+	return 0;
+}
+
+/*
+ * Copy a tree into fresh nodes, in van Emde Boas order, if it is fragmented.
+ */
+static int tree_relayout_nodes(struct tree_t *tree, int threshold)
+{
+	void *root;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	/* nodes shared with other versions or readers can't move */
+	if (tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT))
+		return -1;
+
+	root = tree->root.avl;
+	ret = tree_layout_relayout(tree, &root, &node_layout, threshold);
+	tree->root.avl = (struct avl_node_t *) root;
+
+	return ret;
+}
+
+/*
+ * Set operation job : combine t1 with read only t2 (t2 values start at rank off in t2), or with sorted
+ * values keys[off, off + nr_keys) for batch updates.
+ */
+struct avl_set_job_t {
+	struct tree_t *			tree;
+	int				op;
+	struct avl_node_t *		t1;
+	const struct avl_node_t *	t2;
+	const int *			keys;
+	int				nr_keys;
+	int				off;
+	struct avl_node_t **		copies;
+	struct thread_pool_t *		tp;
+	struct avl_node_t *		garbage;
+	struct avl_node_t *		garbage_tail;
+	struct avl_node_t *		res;
+};
+
+/*
+ * Drop a node : it will be freed once set operation is done (pools are not thread safe).
+ */
+static void job_drop(struct avl_set_job_t *job, struct avl_node_t *node)
+{
+	node->left = job->garbage;
+	job->garbage = node;
+	if (!job->garbage_tail)
+		job->garbage_tail = node;
+}
+
+/*
+ * Drop all nodes of a node.
+ */
+static void job_drop_all(struct avl_set_job_t *job, struct avl_node_t *node)
+{
+	if (!node)
+		return;
+
+	job_drop_all(job, node->left);
+	job_drop_all(job, node->right);
+	job_drop(job, node);
+}
+
+/*
+ * Copy a read only node with preallocated nodes (indexed by rank).
+ */
+static struct avl_node_t *node_copy(struct avl_node_t **copies, const struct avl_node_t *node, int off)
+{
+	struct avl_node_t *copy;
+	int idx;
+
+	if (!node)
+		return NULL;
+
+	idx = off + node_size(node->left);
+	copy = copies[idx];
+	copies[idx] = NULL;
+
+	copy->val = node->val;
+	copy->height = node->height;
+	copy->size = node->size;
+	copy->refs = 1;
+	copy->left = node_copy(copies, node->left, off);
+	copy->right = node_copy(copies, node->right, idx + 1);
+
+	return copy;
+}
+
+/*
+ * Combine results of a job and of its sub job around a middle value (found is its node in t1, if any).
+ */
+static void job_combine(struct avl_set_job_t *job, struct avl_set_job_t *sub, struct avl_node_t *found, int idx,
+			int val)
+{
+	struct avl_node_t *left, *right;
+
+	/* gather dropped nodes */
+	if (sub->garbage) {
+		sub->garbage_tail->left = job->garbage;
+		job->garbage = sub->garbage;
+		if (!job->garbage_tail)
+			job->garbage_tail = sub->garbage_tail;
+	}
+
+	/* combine both halves */
+	left = job->res;
+	right = sub->res;
+	switch (job->op) {
+		case AVL_SET_UNION:
+			if (!found) {
+				found = job->copies[idx];
+				job->copies[idx] = NULL;
+				found->val = val;
+				found->refs = 1;
+			}
+
+			job->res = node_join(job->tree, left, found, right);
+			break;
+		case AVL_SET_INTERSECTION:
+			job->res = found ? node_join(job->tree, left, found, right) : node_join2(job->tree, left, right);
+			break;
+		default:
+			if (found)
+				job_drop(job, found);
+
+			job->res = node_join2(job->tree, left, right);
+			break;
+	}
+}
+
+/*
+ * Run a set operation job (split t1 around t2 root, combine both halves, in parallel if big enough).
+ */
+static void node_set(void *arg)
+{
+	struct avl_set_job_t *job = (struct avl_set_job_t *) arg, sub;
+	const struct avl_node_t *t2 = job->t2;
+	struct avl_node_t *found, *left, *right;
+	struct thread_task_t task;
+	int idx, fork;
+
+	/* nothing to combine with */
+	if (!t2) {
+		if (job->op == AVL_SET_INTERSECTION) {
+			job_drop_all(job, job->t1);
+			job->res = NULL;
+		} else {
+			job->res = job->t1;
+		}
+
+		return;
+	}
+
+	/* nothing to combine */
+	if (!job->t1) {
+		job->res = job->op == AVL_SET_UNION ? node_copy(job->copies, t2, job->off) : NULL;
+		return;
+	}
+
+	/* split around t2 root */
+	idx = job->off + node_size(t2->left);
+	found = node_split(job->tree, job->t1, t2->val, &left, &right);
+
+	/* right half as a sub job (maybe on another thread), left half here */
+	sub = *job;
+	sub.t1 = right;
+	sub.t2 = t2->right;
+	sub.off = idx + 1;
+	sub.garbage = NULL;
+	sub.garbage_tail = NULL;
+	job->t1 = left;
+	job->t2 = t2->left;
+
+	fork = job->tp && node_size(left) + node_size(right) + t2->size > AVL_SET_GRAIN;
+	if (fork) {
+		task.func = node_set;
+		task.arg = &sub;
+		thread_pool_submit(job->tp, &task);
+	} else {
+		node_set(&sub);
+	}
+
+	node_set(job);
+
+	if (fork)
+		thread_pool_wait(job->tp, &task);
+
+	job_combine(job, &sub, found, idx, t2->val);
+}
+
+/*
+ * Run a batch update job (split t1 around middle value, update both halves, in parallel if big enough).
+ */
+static void node_batch(void *arg)
+{
+	struct avl_set_job_t *job = (struct avl_set_job_t *) arg, sub;
+	struct avl_node_t *found, *left, *right;
+	struct thread_task_t task;
+	int mid, fork;
+
+	/* nothing to update */
+	if (job->nr_keys == 0) {
+		job->res = job->t1;
+		return;
+	}
+
+	/* nothing to delete from */
+	if (!job->t1 && job->op == AVL_SET_DIFFERENCE) {
+		job->res = NULL;
+		return;
+	}
+
+	/* split around middle value */
+	mid = job->off + job->nr_keys / 2;
+	found = node_split(job->tree, job->t1, job->keys[mid], &left, &right);
+
+	/* right half as a sub job (maybe on another thread), left half here */
+	sub = *job;
+	sub.t1 = right;
+	sub.off = mid + 1;
+	sub.nr_keys = job->off + job->nr_keys - mid - 1;
+	sub.garbage = NULL;
+	sub.garbage_tail = NULL;
+	job->t1 = left;
+	job->nr_keys = mid - job->off;
+
+	fork = job->tp && node_size(left) + node_size(right) + job->nr_keys + sub.nr_keys > AVL_SET_GRAIN;
+	if (fork) {
+		task.func = node_batch;
+		task.arg = &sub;
+		thread_pool_submit(job->tp, &task);
+	} else {
+		node_batch(&sub);
+	}
+
+	node_batch(job);
+
+	if (fork)
+		thread_pool_wait(job->tp, &task);
+
+	job_combine(job, &sub, found, mid, job->keys[mid]);
+}
+
+/*
+ * Free dropped nodes and unused preallocated nodes of a job.
+ */
+static void job_release(struct avl_set_job_t *job, size_t nr_copies)
+{
+	struct avl_node_t *node;
+	size_t i;
+
+	while (job->garbage) {
+		node = job->garbage;
+		job->garbage = node->left;
+		node_pool_free(job->tree->pool, node);
+	}
+
+	if (job->copies) {
+		for (i = 0; i < nr_copies; i++)
+			if (job->copies[i])
+				node_pool_free(job->tree->pool, job->copies[i]);
+
+		free(job->copies);
+	}
+}
+
+/*
+ * Combine a tree with another one (other tree is only read).
+ */
+static int tree_set(struct tree_t *tree, const struct tree_t *other, int op, struct thread_pool_t *tp)
+{
+	struct avl_set_job_t job;
+	int i, ret = -1;
+
+	if (!tree || !other || tree->type != TREE_TYPE_AVL || other->type != TREE_TYPE_AVL)
+		return -1;
+
+	/* nodes are updated in place */
+	if (tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT))
+		return -1;
+
+	/* a tree combined with itself : nothing to do, or drop all values */
+	if (tree == other) {
+		if (op != AVL_SET_DIFFERENCE)
+			return 0;
+
+		op = AVL_SET_INTERSECTION;
+		other = NULL;
+	}
+
+	/* set job */
+	job.tree = tree;
+	job.op = op;
+	job.t1 = tree->root.avl;
+	job.t2 = other ? other->root.avl : NULL;
+	job.keys = NULL;
+	job.nr_keys = 0;
+	job.off = 0;
+	job.copies = NULL;
+	job.tp = tp;
+	job.garbage = NULL;
+	job.garbage_tail = NULL;
+
+	/* union : preallocate a node for each value of other tree (pool can't be used from several threads) */
+	if (op == AVL_SET_UNION && other->size > 0) {
+		job.copies = (struct avl_node_t **) calloc(other->size, sizeof(struct avl_node_t *));
+		if (!job.copies)
+			return -1;
+
+		for (i = 0; i < other->size; i++) {
+			job.copies[i] = (struct avl_node_t *) node_pool_alloc(tree->pool);
+			if (!job.copies[i])
+				goto out;
+		}
+	}
+
+	/* run job */
+	node_set(&job);
+	tree->root.avl = job.res;
+	tree->size = node_size(job.res);
+
+	ret = 0;
+out:
+	job_release(&job, other ? other->size : 0);
+	return ret;
+}
+
+/*
+ * Combine a tree with n values (in parallel if a thread pool is given) : values are sorted, then
+ * tree is descended once, values being split between subtrees, and each touched subtree is joined
+ * back once. Returns 0 or -1 (tree is unchanged).
+ */
+static int tree_batch(struct tree_t *tree, const int *keys, size_t n, int op, struct thread_pool_t *tp)
+{
+	struct avl_set_job_t job;
+	int *sorted, ret = -1;
+	size_t i;
+
+	if (!tree || (n > 0 && !keys))
+		return -1;
+
+	/* nothing to do */
+	if (n == 0)
+		return 0;
+
+	/* persistent/concurrent trees : nodes can't be updated in place */
+	if (tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT)) {
+		for (i = 0; i < n; i++) {
+			if (op == AVL_SET_UNION)
+				tree_insert(tree, keys[i]);
+			else
+				tree_delete(tree, keys[i]);
+		}
+
+		return 0;
+	}
+
+	/* sort and deduplicate values */
+	sorted = tree_sort_keys(keys, &n);
+	if (!sorted)
+		return -1;
+	if (n > INT_MAX)
+		goto err;
+
+	/* set job */
+	job.tree = tree;
+	job.op = op;
+	job.t1 = tree->root.avl;
+	job.t2 = NULL;
+	job.keys = sorted;
+	job.nr_keys = n;
+	job.off = 0;
+	job.copies = NULL;
+	job.tp = tp;
+	job.garbage = NULL;
+	job.garbage_tail = NULL;
+
+	/* insertion : preallocate a node for each value (pool can't be used from several threads) */
+	if (op == AVL_SET_UNION) {
+		job.copies = (struct avl_node_t **) calloc(n, sizeof(struct avl_node_t *));
+		if (!job.copies)
+			goto err;
+
+		for (i = 0; i < n; i++) {
+			job.copies[i] = (struct avl_node_t *) node_pool_alloc(tree->pool);
+			if (!job.copies[i])
+				goto out;
+		}
+	}
+
+	/* run job */
+	node_batch(&job);
+	tree->root.avl = job.res;
+	tree->size = node_size(job.res);
+
+	ret = 0;
+out:
+	job_release(&job, n);
+	if (ret == 0)
+		tree_relayout_update_many(tree, n);
+err:
+	free(sorted);
+	return ret;
+}
+
+/*
+ * Insert n values in a tree (in parallel if a thread pool is given).
+ */
+static int tree_insert_sorted(struct tree_t *tree, const int *keys, size_t n, struct thread_pool_t *tp)
+{
+	return tree_batch(tree, keys, n, AVL_SET_UNION, tp);
+}
+
+/*
+ * Delete n values from a tree (in parallel if a thread pool is given).
+ */
+static int tree_delete_sorted(struct tree_t *tree, const int *keys, size_t n, struct thread_pool_t *tp)
+{
+	return tree_batch(tree, keys, n, AVL_SET_DIFFERENCE, tp);
+}
+
+/*
+ * Take a snapshot of a tree in O(1) : tree becomes persistent, and updates will copy shared nodes.
+ * Snapshot must be taken by the thread updating the tree, it can then be read and freed by any thread.
+ */
+struct tree_t *avl_tree_snapshot(struct tree_t *tree)
+{
+	struct tree_t *res;
+
+	if (!tree || tree->type != TREE_TYPE_AVL || (tree->flags & TREE_FLAG_CONCURRENT))
+		return NULL;
+
+	/* allocate a tree */
+	res = (struct tree_t *) malloc(sizeof(struct tree_t));
+	if (!res)
+		return NULL;
+
+	/* share root and pool */
+	tree->flags |= TREE_FLAG_PERSISTENT;
+	*res = *tree;
+	res->pool = node_pool_get(tree->pool);
+	node_get(tree->root.avl);
+
+	return res;
+}
+
+/*
+ * Make a tree concurrent : one writer thread (callers serialize updates) and lock free readers.
+ * Updates copy nodes on their path and publish a new root, replaced nodes are freed once readers
+ * are gone (epochs). find, min, max, height, rank, select and count_range may be called by any
+ * thread, iterators must be used between epoch_enter() and epoch_exit().
+ */
+int avl_tree_set_concurrent(struct tree_t *tree)
+{
+	if (!tree || tree->type != TREE_TYPE_AVL || (tree->flags & TREE_FLAG_PERSISTENT))
+		return -1;
+
+	/* already concurrent */
+	if (tree->rcu)
+		return 0;
+
+	tree->rcu = (struct tree_rcu_t *) calloc(1, sizeof(struct tree_rcu_t));
+	if (!tree->rcu)
+		return -1;
+
+	tree->flags |= TREE_FLAG_CONCURRENT;
+	return 0;
+}
+
+/*
+ * Split a tree : values >= key are moved to a new tree, which shares the node pool. Pools are not
+ * thread safe : both trees must be updated by the same thread.
+ */
+struct tree_t *avl_tree_split(struct tree_t *tree, int key)
+{
+	struct avl_node_t *left, *right, *found;
+	struct tree_t *res;
+
+	if (!tree || tree->type != TREE_TYPE_AVL || (tree->flags & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT)))
+		return NULL;
+
+	/* allocate a tree */
+	res = (struct tree_t *) malloc(sizeof(struct tree_t));
+	if (!res)
+		return NULL;
+
+	/* split nodes */
+	found = node_split(tree, tree->root.avl, key, &left, &right);
+	if (found)
+		right = node_join(tree, NULL, found, right);
+
+	/* set trees */
+	*res = *tree;
+	res->pool = node_pool_get(tree->pool);
+	res->root.avl = right;
+	res->size = node_size(right);
+	tree->root.avl = left;
+	tree->size = node_size(left);
+
+	return res;
+}
+
+/*
+ * Join two trees with a middle value (all values of left < key < all values of right) : right tree is freed.
+ */
+int avl_tree_join(struct tree_t *left, int key, struct tree_t *right)
+{
+	struct avl_node_t *node;
+
+	if (!left || !right || left == right || left->type != TREE_TYPE_AVL || right->type != TREE_TYPE_AVL)
+		return -1;
+	if ((left->flags | right->flags) & (TREE_FLAG_PERSISTENT | TREE_FLAG_CONCURRENT))
+		return -1;
+
+	/* check order */
+	for (node = left->root.avl; node && node->right;)
+		node = node->right;
+	if (node && node->val >= key)
+		return -1;
+
+	node = node_min(right->root.avl);
+	if (node && node->val <= key)
+		return -1;
+
+	/* right nodes must belong to left pool */
+	if (node_pool_merge(left->pool, right->pool))
+		return -1;
+
+	/* create middle node */
+	node = node_create(left, key);
+	if (!node)
+		return -1;
+
+	/* join nodes */
+	left->root.avl = node_join(left, left->root.avl, node, right->root.avl);
+	left->size = node_size(left->root.avl);
+
+	/* free right tree */
+	right->root.avl = NULL;
+	right->size = 0;
+	tree_free(right);
+
+	return 0;
+}
+
+/*
+ * Add values of another tree to a tree (in parallel if a thread pool is given).
+ */
+int avl_tree_union(struct tree_t *tree, const struct tree_t *other, struct thread_pool_t *tp)
+{
+	return tree_set(tree, other, AVL_SET_UNION, tp);
+}
+
+/*
+ * Keep values of a tree which are in another tree (in parallel if a thread pool is given).
+ */
+int avl_tree_intersection(struct tree_t *tree, const struct tree_t *other, struct thread_pool_t *tp)
+{
+	return tree_set(tree, other, AVL_SET_INTERSECTION, tp);
+}
+
+/*
+ * Remove values of a tree which are in another tree (in parallel if a thread pool is given).
+ */
+int avl_tree_difference(struct tree_t *tree, const struct tree_t *other, struct thread_pool_t *tp)
+{
+	return tree_set(tree, other, AVL_SET_DIFFERENCE, tp);
 }
 
 /*
@@ -464,10 +1931,24 @@ static void tree_draw(struct tree_t *tree, GtkWidget *drawing_area, cairo_t *cr)
 struct tree_operations_t avl_tree_ops = {
 	.init			= tree_init,
 	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
 	.find			= tree_find,
+	.find_many		= tree_find_interleaved,
 	.insert			= tree_insert,
 	.delete			= tree_delete,
 	.balance		= tree_balance,
+	.bulk_load		= tree_bulk_load,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.rank			= tree_rank,
+	.select			= tree_select,
+	.count_range		= tree_count_range,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.relayout		= tree_relayout_nodes,
+	.insert_batch		= tree_insert_sorted,
+	.delete_batch		= tree_delete_sorted,
 	.free			= tree_free,
-	.draw			= tree_draw,
 };
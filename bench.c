@@ -0,0 +1,1342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include "tree.h"
+#include "tree_map.h"
+
+#define BENCH_MIN_KEYS			1000
+#define BENCH_MAX_KEYS			100000000
+#define BENCH_LATENCY_SAMPLES		10000
+#define BENCH_READS_PER_WRITE		50
+#define BENCH_MAX_THREADS		64
+#define BENCH_MT_UPDATE_PCT		20
+#define BENCH_WAL_MAX_BATCH		4096
+#define BENCH_WAL_MAX_COMMITS		256
+
+/*
+ * Benchmarked backend.
+ */
+struct bench_backend_t {
+	const char *			name;
+	int				type;
+};
+
+static struct bench_backend_t backends[] = {
+	{ "binary",	TREE_TYPE_BINARY },
+	{ "avl",	TREE_TYPE_AVL },
+	{ "rb",		TREE_TYPE_RB },
+	{ "bplus",	TREE_TYPE_BPLUS },
+	{ "lockfree",	TREE_TYPE_LOCKFREE },
+	{ "mmap",	TREE_TYPE_MMAP },
+	{ "cbinary",	TREE_TYPE_COMPACT_BINARY },
+	{ "cavl",	TREE_TYPE_COMPACT_AVL },
+};
+
+/*
+ * Mixed workload (percentages of inserts and deletes, others are lookups).
+ */
+struct bench_mix_t {
+	const char *			name;
+	int				insert_pct;
+	int				delete_pct;
+};
+
+static struct bench_mix_t mixes[] = {
+	{ "ins-heavy",	80,	10 },
+	{ "del-heavy",	10,	80 },
+	{ "find-heavy",	5,	5 },
+};
+
+/*
+ * Benchmark result of one operation phase.
+ */
+struct bench_result_t {
+	double				seconds;
+	size_t				nr_ops;
+	uint64_t *			samples;
+	size_t				nr_samples;
+};
+
+/*
+ * Random generator (xorshift64).
+ */
+static uint64_t rand_state = 88172645463325252ULL;
+
+static uint64_t bench_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 7;
+	rand_state ^= rand_state << 17;
+	return rand_state;
+}
+
+/*
+ * Get monotonic time in nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Shuffle keys.
+ */
+static void shuffle(int *keys, size_t n)
+{
+	size_t i, j;
+	int tmp;
+
+	for (i = n - 1; i > 0; i--) {
+		j = bench_rand() % (i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+}
+
+/*
+ * Compare two samples.
+ */
+static int sample_cmp(const void *a, const void *b)
+{
+	uint64_t x = *((const uint64_t *) a), y = *((const uint64_t *) b);
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Run an operation on all keys : every stride-th operation is timed alone to sample latency.
+ */
+static void bench_phase(struct tree_t *tree, void (*op)(struct tree_t *, int), const int *keys, size_t n,
+			struct bench_result_t *res)
+{
+	size_t i, stride;
+	uint64_t start, t;
+
+	stride = n > BENCH_LATENCY_SAMPLES ? n / BENCH_LATENCY_SAMPLES : 1;
+	res->nr_samples = 0;
+	res->nr_ops = n;
+
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		if (i % stride == 0 && res->nr_samples < BENCH_LATENCY_SAMPLES) {
+			t = now_ns();
+			op(tree, keys[i]);
+			res->samples[res->nr_samples++] = now_ns() - t;
+		} else {
+			op(tree, keys[i]);
+		}
+	}
+
+	res->seconds = (now_ns() - start) / 1e9;
+}
+
+/*
+ * Find wrapper (result is accumulated so the lookup is not optimized out).
+ */
+static volatile int find_hits;
+
+static void bench_find(struct tree_t *tree, int val)
+{
+	find_hits += tree->ops->find(tree, val);
+}
+
+/*
+ * Snapshot find wrapper.
+ */
+static struct eytzinger_t *bench_snap;
+
+static void bench_eytzinger_find(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	find_hits += eytzinger_find(bench_snap, val);
+}
+
+/*
+ * Print a phase result.
+ */
+static void bench_print(const char *backend, size_t n, const char *op, struct bench_result_t *res)
+{
+	/* no latency samples */
+	if (res->nr_samples == 0) {
+		printf("%-8s %12zu %-10s %10.3f %10.1f %8s %8s %10s\n",
+		       backend, n, op,
+		       res->nr_ops / res->seconds / 1e6,
+		       res->seconds * 1e9 / res->nr_ops,
+		       "-", "-", "-");
+		fflush(stdout);
+		return;
+	}
+
+	qsort(res->samples, res->nr_samples, sizeof(uint64_t), sample_cmp);
+
+	printf("%-8s %12zu %-10s %10.3f %10.1f %8lu %8lu %10lu\n",
+	       backend, n, op,
+	       res->nr_ops / res->seconds / 1e6,
+	       res->seconds * 1e9 / res->nr_ops,
+	       (unsigned long) res->samples[res->nr_samples / 2],
+	       (unsigned long) res->samples[res->nr_samples * 99 / 100],
+	       (unsigned long) res->samples[res->nr_samples - 1]);
+	fflush(stdout);
+}
+
+/*
+ * Benchmark a backend with n keys.
+ */
+static int bench_backend(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct tree_t *tree;
+	int has_bulk_load;
+	uint64_t start;
+	size_t i;
+
+	/* create tree */
+	tree = tree_create(backend->type);
+	if (!tree)
+		return -1;
+
+	/* insert keys in random order */
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+	shuffle(keys, n);
+	bench_phase(tree, tree->ops->insert, keys, n, res);
+	bench_print(backend->name, n, "insert", res);
+
+	/* find keys in another random order */
+	shuffle(keys, n);
+	bench_phase(tree, bench_find, keys, n, res);
+	bench_print(backend->name, n, "find", res);
+
+	/* freeze tree in a snapshot and find keys in it */
+	start = now_ns();
+	bench_snap = eytzinger_create(tree);
+	if (!bench_snap) {
+		tree->ops->free(tree);
+		return -1;
+	}
+	res->seconds = (now_ns() - start) / 1e9;
+	res->nr_ops = n;
+	res->nr_samples = 0;
+	bench_print(backend->name, n, "snap-build", res);
+
+	bench_phase(tree, bench_eytzinger_find, keys, n, res);
+	bench_print(backend->name, n, "snap-find", res);
+	eytzinger_free(bench_snap);
+
+	/* delete keys in another random order */
+	shuffle(keys, n);
+	bench_phase(tree, tree->ops->delete, keys, n, res);
+	bench_print(backend->name, n, "delete", res);
+
+	has_bulk_load = tree->ops->bulk_load != NULL;
+	tree->ops->free(tree);
+
+	/* bulk load keys in random order */
+	if (has_bulk_load) {
+		tree = tree_create(backend->type);
+		if (!tree)
+			return -1;
+
+		shuffle(keys, n);
+		start = now_ns();
+		if (tree->ops->bulk_load(tree, keys, n)) {
+			tree->ops->free(tree);
+			return -1;
+		}
+		res->seconds = (now_ns() - start) / 1e9;
+		res->nr_ops = n;
+		res->nr_samples = 0;
+		bench_print(backend->name, n, "bulk", res);
+
+		tree->ops->free(tree);
+	}
+
+	return 0;
+}
+
+/*
+ * Benchmark a backend with a mixed workload on a tree prefilled with n keys out of 2n.
+ */
+static int bench_backend_mix(struct bench_backend_t *backend, struct bench_mix_t *mix, int *keys, size_t n,
+			     struct bench_result_t *res)
+{
+	struct tree_t *tree;
+	uint64_t start, r;
+	size_t i;
+	int key;
+
+	/* create tree */
+	tree = tree_create(backend->type);
+	if (!tree)
+		return -1;
+
+	/* prefill tree with one key out of two */
+	for (i = 0; i < n; i++)
+		keys[i] = (int) (2 * i);
+	shuffle(keys, n);
+	for (i = 0; i < n; i++)
+		tree->ops->insert(tree, keys[i]);
+
+	/* same operations sequence for every backend */
+	rand_state = 88172645463325252ULL;
+
+	/* run n operations */
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		r = bench_rand();
+		key = (int) ((r >> 8) % (2 * n));
+
+		if ((int) (r % 100) < mix->insert_pct)
+			tree->ops->insert(tree, key);
+		else if ((int) (r % 100) < mix->insert_pct + mix->delete_pct)
+			tree->ops->delete(tree, key);
+		else
+			find_hits += tree->ops->find(tree, key);
+	}
+
+	res->seconds = (now_ns() - start) / 1e9;
+	res->nr_ops = n;
+	res->nr_samples = 0;
+	bench_print(backend->name, n, mix->name, res);
+
+	tree->ops->free(tree);
+	return 0;
+}
+
+/*
+ * Set operation (AVL only).
+ */
+struct bench_set_t {
+	const char *			name;
+	int				(*op)(struct tree_t *, const struct tree_t *, struct thread_pool_t *);
+};
+
+static struct bench_set_t set_ops[] = {
+	{ "union",	avl_tree_union },
+	{ "inter",	avl_tree_intersection },
+	{ "diff",	avl_tree_difference },
+};
+
+/*
+ * Benchmark set operations of two trees holding n keys out of 2n, on one thread then on a thread pool.
+ */
+static int bench_backend_set(struct bench_backend_t *backend, struct thread_pool_t *tp, int *keys, size_t n,
+			     struct bench_result_t *res)
+{
+	struct tree_t *tree = NULL, *other;
+	char name[32];
+	uint64_t start;
+	size_t i, j;
+	int ret = -1;
+
+	/* set operations are only implemented by AVL trees */
+	if (backend->type != TREE_TYPE_AVL)
+		return 0;
+
+	/* build other tree */
+	other = tree_create(backend->type);
+	if (!other)
+		return -1;
+
+	rand_state = 2463534242ULL;
+	for (i = 0; i < n; i++)
+		keys[i] = (int) ((bench_rand() >> 8) % (2 * n));
+	if (other->ops->bulk_load(other, keys, n))
+		goto out;
+
+	for (j = 0; j < 2 * sizeof(set_ops) / sizeof(set_ops[0]); j++) {
+		/* build tree (same keys for each operation) */
+		tree = tree_create(backend->type);
+		if (!tree)
+			goto out;
+
+		rand_state = 88172645463325252ULL;
+		for (i = 0; i < n; i++)
+			keys[i] = (int) ((bench_rand() >> 8) % (2 * n));
+		if (tree->ops->bulk_load(tree, keys, n))
+			goto out;
+
+		/* run operation */
+		start = now_ns();
+		if (set_ops[j / 2].op(tree, other, j % 2 ? tp : NULL))
+			goto out;
+		res->seconds = (now_ns() - start) / 1e9;
+		res->nr_ops = n;
+		res->nr_samples = 0;
+
+		snprintf(name, sizeof(name), "%s%s", set_ops[j / 2].name, j % 2 ? "-mt" : "");
+		bench_print(backend->name, n, name, res);
+
+		tree->ops->free(tree);
+		tree = NULL;
+	}
+
+	ret = 0;
+out:
+	if (tree)
+		tree->ops->free(tree);
+	other->ops->free(other);
+	return ret;
+}
+
+/*
+ * Concurrent reader/writer thread.
+ */
+struct bench_thread_t {
+	pthread_t			thread;
+	struct tree_t *			tree;
+	struct shard_tree_t *		shards;
+	size_t				n;
+	size_t				max_ops;
+	size_t				nr_ops;
+	int				hits;
+	uint64_t			seed;
+};
+
+static volatile int bench_readers_done;
+
+/*
+ * Reader thread : find n random keys (half of them are in the tree).
+ */
+static void *bench_reader(void *arg)
+{
+	struct bench_thread_t *th = (struct bench_thread_t *) arg;
+	uint64_t x = th->seed;
+	size_t i;
+	int hits = 0;
+
+	for (i = 0; i < th->n; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		hits += th->tree->ops->find(th->tree, (int) ((x >> 8) % (2 * th->n)));
+	}
+
+	th->nr_ops = i;
+	th->hits = hits;
+	return NULL;
+}
+
+/*
+ * Writer thread : insert/delete odd keys, one update every BENCH_READS_PER_WRITE reads of one reader.
+ */
+static void *bench_writer(void *arg)
+{
+	struct bench_thread_t *th = (struct bench_thread_t *) arg;
+	uint64_t x = th->seed;
+	int key;
+
+	for (th->nr_ops = 0; !bench_readers_done && th->nr_ops < th->n / BENCH_READS_PER_WRITE; th->nr_ops++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		key = (int) ((x >> 8) % th->n) * 2 + 1;
+
+		if (x & 1)
+			th->tree->ops->insert(th->tree, key);
+		else
+			th->tree->ops->delete(th->tree, key);
+	}
+
+	return NULL;
+}
+
+/*
+ * Benchmark lock free readers of a concurrent tree holding n keys, with 1 to nr_cpus readers and one writer.
+ */
+static int bench_backend_rcu(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct bench_thread_t writer, *readers;
+	int nr_cpus, nr_readers, nr_started, i;
+	struct tree_t *tree;
+	char name[32];
+	uint64_t start;
+
+	/* concurrent mode is only implemented by AVL trees */
+	if (backend->type != TREE_TYPE_AVL)
+		return 0;
+
+	nr_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	readers = (struct bench_thread_t *) malloc(sizeof(struct bench_thread_t) * (nr_cpus > 0 ? nr_cpus : 1));
+	if (!readers)
+		return -1;
+
+	/* create a concurrent tree with even keys */
+	tree = tree_create(backend->type);
+	if (!tree || avl_tree_set_concurrent(tree)) {
+		free(readers);
+		return -1;
+	}
+
+	for (i = 0; i < (int) n; i++)
+		keys[i] = 2 * i;
+	if (tree->ops->bulk_load(tree, keys, n))
+		goto err;
+
+	for (nr_readers = 1; nr_readers <= nr_cpus; nr_readers *= 2) {
+		bench_readers_done = 0;
+		start = now_ns();
+
+		/* start writer and readers */
+		writer.tree = tree;
+		writer.n = n;
+		writer.seed = bench_rand() | 1;
+		if (pthread_create(&writer.thread, NULL, bench_writer, &writer))
+			goto err;
+
+		for (nr_started = 0; nr_started < nr_readers; nr_started++) {
+			readers[nr_started].tree = tree;
+			readers[nr_started].n = n;
+			readers[nr_started].seed = bench_rand() | 1;
+			if (pthread_create(&readers[nr_started].thread, NULL, bench_reader, &readers[nr_started]))
+				break;
+		}
+
+		/* wait for readers, then writer */
+		res->nr_ops = 0;
+		for (i = 0; i < nr_started; i++) {
+			pthread_join(readers[i].thread, NULL);
+			res->nr_ops += readers[i].nr_ops;
+			find_hits += readers[i].hits;
+		}
+
+		res->seconds = (now_ns() - start) / 1e9;
+		bench_readers_done = 1;
+		pthread_join(writer.thread, NULL);
+
+		if (nr_started < nr_readers)
+			goto err;
+
+		res->nr_samples = 0;
+		snprintf(name, sizeof(name), "rcu-r%d", nr_readers);
+		bench_print(backend->name, n, name, res);
+	}
+
+	tree->ops->free(tree);
+	free(readers);
+	return 0;
+err:
+	tree->ops->free(tree);
+	free(readers);
+	return -1;
+}
+
+/*
+ * Worker thread : random operations on keys in [0, 2n), BENCH_MT_UPDATE_PCT percent of them being updates.
+ */
+static void *bench_worker(void *arg)
+{
+	struct bench_thread_t *th = (struct bench_thread_t *) arg;
+	uint64_t x = th->seed;
+	int key, hits = 0;
+	size_t i;
+
+	for (i = 0; i < th->max_ops; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		key = (int) ((x >> 8) % (2 * th->n));
+
+		if ((int) (x % 100) < BENCH_MT_UPDATE_PCT / 2)
+			th->tree->ops->insert(th->tree, key);
+		else if ((int) (x % 100) < BENCH_MT_UPDATE_PCT)
+			th->tree->ops->delete(th->tree, key);
+		else
+			hits += th->tree->ops->find(th->tree, key);
+	}
+
+	th->nr_ops = i;
+	th->hits = hits;
+	return NULL;
+}
+
+/*
+ * Benchmark multiple writers on a tree prefilled with n keys out of 2n, with 1 to BENCH_MAX_THREADS threads.
+ */
+static int bench_backend_mt(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct bench_thread_t workers[BENCH_MAX_THREADS];
+	int nr_threads, nr_started, i;
+	struct tree_t *tree;
+	char name[32];
+	uint64_t start;
+
+	/* multiple writers are only supported by lock free trees */
+	if (backend->type != TREE_TYPE_LOCKFREE)
+		return 0;
+
+	for (nr_threads = 1; nr_threads <= BENCH_MAX_THREADS; nr_threads *= 2) {
+		/* prefill tree with one key out of two */
+		tree = tree_create(backend->type);
+		if (!tree)
+			return -1;
+
+		for (i = 0; i < (int) n; i++)
+			keys[i] = 2 * i;
+		shuffle(keys, n);
+		for (i = 0; i < (int) n; i++)
+			tree->ops->insert(tree, keys[i]);
+
+		/* each thread runs n / nr_threads operations */
+		start = now_ns();
+		for (nr_started = 0; nr_started < nr_threads; nr_started++) {
+			workers[nr_started].tree = tree;
+			workers[nr_started].n = n;
+			workers[nr_started].max_ops = n / nr_threads ? n / nr_threads : 1;
+			workers[nr_started].seed = bench_rand() | 1;
+			if (pthread_create(&workers[nr_started].thread, NULL, bench_worker, &workers[nr_started]))
+				break;
+		}
+
+		res->nr_ops = 0;
+		for (i = 0; i < nr_started; i++) {
+			pthread_join(workers[i].thread, NULL);
+			res->nr_ops += workers[i].nr_ops;
+			find_hits += workers[i].hits;
+		}
+
+		res->seconds = (now_ns() - start) / 1e9;
+		tree->ops->free(tree);
+
+		if (nr_started < nr_threads)
+			return -1;
+
+		res->nr_samples = 0;
+		snprintf(name, sizeof(name), "mt-t%d", nr_threads);
+		bench_print(backend->name, n, name, res);
+	}
+
+	return 0;
+}
+
+/*
+ * Shard producer thread : queue random inserts/deletes of keys in [0, 2n).
+ */
+static void *bench_producer(void *arg)
+{
+	struct bench_thread_t *th = (struct bench_thread_t *) arg;
+	uint64_t x = th->seed;
+	size_t i;
+	int key;
+
+	for (i = 0; i < th->max_ops; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		key = (int) ((x >> 8) % (2 * th->n));
+
+		if (x & 1)
+			shard_tree_insert(th->shards, key);
+		else
+			shard_tree_delete(th->shards, key);
+	}
+
+	th->nr_ops = i;
+	return NULL;
+}
+
+/*
+ * Benchmark updates of a sharded tree (one shard per CPU) holding n keys out of 2n, with 1 to
+ * BENCH_MAX_THREADS producers (time includes flush of all queued updates).
+ */
+static int bench_backend_shard(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct bench_thread_t producers[BENCH_MAX_THREADS];
+	int nr_threads, nr_started, i;
+	struct shard_tree_t *st;
+	char name[32];
+	uint64_t start;
+
+	/* shards are concurrent AVL trees */
+	if (backend->type != TREE_TYPE_AVL)
+		return 0;
+
+	for (nr_threads = 1; nr_threads <= BENCH_MAX_THREADS; nr_threads *= 2) {
+		/* prefill tree with one key out of two */
+		st = shard_tree_create(0, 0, (int) (2 * n - 1));
+		if (!st)
+			return -1;
+
+		for (i = 0; i < (int) n; i++)
+			keys[i] = 2 * i;
+		shuffle(keys, n);
+		for (i = 0; i < (int) n; i++)
+			shard_tree_insert(st, keys[i]);
+		shard_tree_flush(st);
+
+		/* each thread queues n / nr_threads updates */
+		start = now_ns();
+		for (nr_started = 0; nr_started < nr_threads; nr_started++) {
+			producers[nr_started].shards = st;
+			producers[nr_started].n = n;
+			producers[nr_started].max_ops = n / nr_threads ? n / nr_threads : 1;
+			producers[nr_started].seed = bench_rand() | 1;
+			if (pthread_create(&producers[nr_started].thread, NULL, bench_producer, &producers[nr_started]))
+				break;
+		}
+
+		res->nr_ops = 0;
+		for (i = 0; i < nr_started; i++) {
+			pthread_join(producers[i].thread, NULL);
+			res->nr_ops += producers[i].nr_ops;
+		}
+
+		shard_tree_flush(st);
+		res->seconds = (now_ns() - start) / 1e9;
+		shard_tree_free(st);
+
+		if (nr_started < nr_threads)
+			return -1;
+
+		res->nr_samples = 0;
+		snprintf(name, sizeof(name), "shard-t%d", nr_threads);
+		bench_print(backend->name, n, name, res);
+	}
+
+	return 0;
+}
+
+/*
+ * Benchmark saving a tree of n keys to a file and loading it back.
+ */
+static int bench_backend_file(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	const char *path = "tree_bench.tree";
+	struct tree_t *tree;
+	uint64_t start;
+	size_t i;
+	int ret;
+
+	/* create tree */
+	tree = tree_create(backend->type);
+	if (!tree)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+	shuffle(keys, n);
+	for (i = 0; i < n; i++)
+		tree->ops->insert(tree, keys[i]);
+
+	/* save tree */
+	start = now_ns();
+	ret = tree_save(tree, path);
+	res->seconds = (now_ns() - start) / 1e9;
+	tree->ops->free(tree);
+	if (ret)
+		return -1;
+
+	res->nr_ops = n;
+	res->nr_samples = 0;
+	bench_print(backend->name, n, "save", res);
+
+	/* load tree */
+	start = now_ns();
+	tree = tree_load(path);
+	res->seconds = (now_ns() - start) / 1e9;
+	remove(path);
+	if (!tree)
+		return -1;
+
+	bench_print(backend->name, n, "load", res);
+	tree->ops->free(tree);
+
+	return 0;
+}
+
+/*
+ * Benchmark durable updates of a logged tree against batch size (1 to BENCH_WAL_MAX_BATCH operations
+ * per fsync), then recovery of the log.
+ */
+static int bench_backend_wal(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	const char *log_path = "tree_bench.wal", *snapshot_path = "tree_bench.snap";
+	struct tree_wal_t *wal;
+	size_t batch_size, nr_ops, i;
+	char name[32];
+	uint64_t start;
+	int ret;
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+
+	for (batch_size = 1; batch_size <= BENCH_WAL_MAX_BATCH; batch_size *= 8) {
+		remove(log_path);
+		remove(snapshot_path);
+
+		wal = tree_wal_open(log_path, snapshot_path, backend->type, batch_size, 0);
+		if (!wal)
+			return -1;
+
+		/* bound number of fsyncs */
+		nr_ops = n < BENCH_WAL_MAX_COMMITS * batch_size ? n : BENCH_WAL_MAX_COMMITS * batch_size;
+		shuffle(keys, n);
+
+		/* durable inserts */
+		start = now_ns();
+		for (i = 0, ret = 0; i < nr_ops && !ret; i++)
+			ret = tree_wal_insert(wal, keys[i]);
+		if (!ret)
+			ret = tree_wal_commit(wal);
+		res->seconds = (now_ns() - start) / 1e9;
+		if (tree_wal_close(wal) || ret)
+			goto err;
+
+		res->nr_ops = nr_ops;
+		res->nr_samples = 0;
+		snprintf(name, sizeof(name), "wal-b%zu", batch_size);
+		bench_print(backend->name, n, name, res);
+
+		/* recovery */
+		start = now_ns();
+		wal = tree_wal_open(log_path, snapshot_path, backend->type, batch_size, 0);
+		res->seconds = (now_ns() - start) / 1e9;
+		if (!wal)
+			goto err;
+
+		ret = wal->tree->size == (int) nr_ops ? 0 : -1;
+		tree_wal_close(wal);
+		if (ret)
+			goto err;
+
+		snprintf(name, sizeof(name), "replay-b%zu", batch_size);
+		bench_print(backend->name, n, name, res);
+	}
+
+	remove(log_path);
+	remove(snapshot_path);
+	return 0;
+err:
+	remove(log_path);
+	remove(snapshot_path);
+	return -1;
+}
+
+/*
+ * Generic maps (int, u64 and string keys) : each operation wraps a map specialized at compile time.
+ */
+static struct int_map_t bench_int_map;
+static struct u64_map_t bench_u64_map;
+static struct str_map_t bench_str_map;
+static char **bench_strs;
+
+static int bench_int_map_init(void) { return int_map_init(&bench_int_map); }
+static void bench_int_map_destroy(void) { int_map_destroy(&bench_int_map); }
+static int bench_u64_map_init(void) { return u64_map_init(&bench_u64_map); }
+static void bench_u64_map_destroy(void) { u64_map_destroy(&bench_u64_map); }
+static int bench_str_map_init(void) { return str_map_init(&bench_str_map); }
+static void bench_str_map_destroy(void) { str_map_destroy(&bench_str_map); }
+
+static void bench_int_map_insert(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	int_map_insert(&bench_int_map, val, &bench_int_map);
+}
+
+static void bench_int_map_find(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	find_hits += int_map_find(&bench_int_map, val) != NULL;
+}
+
+static void bench_int_map_delete(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	int_map_delete(&bench_int_map, val, NULL);
+}
+
+static void bench_u64_map_insert(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	u64_map_insert(&bench_u64_map, (uint64_t) val << 32, &bench_u64_map);
+}
+
+static void bench_u64_map_find(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	find_hits += u64_map_find(&bench_u64_map, (uint64_t) val << 32) != NULL;
+}
+
+static void bench_u64_map_delete(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	u64_map_delete(&bench_u64_map, (uint64_t) val << 32, NULL);
+}
+
+static void bench_str_map_insert(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	str_map_insert(&bench_str_map, bench_strs[val], &bench_str_map);
+}
+
+static void bench_str_map_find(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	find_hits += str_map_find(&bench_str_map, bench_strs[val]) != NULL;
+}
+
+static void bench_str_map_delete(struct tree_t *tree, int val)
+{
+	UNUSED(tree);
+	str_map_delete(&bench_str_map, bench_strs[val], NULL);
+}
+
+/*
+ * Benchmarked generic map.
+ */
+struct bench_map_t {
+	const char *			name;
+	int				(*init)(void);
+	void				(*destroy)(void);
+	void				(*insert)(struct tree_t *, int);
+	void				(*find)(struct tree_t *, int);
+	void				(*delete)(struct tree_t *, int);
+};
+
+static struct bench_map_t maps[] = {
+	{ "int_map",	bench_int_map_init,	bench_int_map_destroy,	bench_int_map_insert,	bench_int_map_find,	bench_int_map_delete },
+	{ "u64_map",	bench_u64_map_init,	bench_u64_map_destroy,	bench_u64_map_insert,	bench_u64_map_find,	bench_u64_map_delete },
+	{ "str_map",	bench_str_map_init,	bench_str_map_destroy,	bench_str_map_insert,	bench_str_map_find,	bench_str_map_delete },
+};
+
+/*
+ * Benchmark generic maps with n keys (compare with AVL backend in ops workload).
+ */
+static int bench_backend_map(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	size_t i, j;
+	int ret = -1;
+
+	if (backend->type != TREE_TYPE_AVL)
+		return 0;
+
+	/* string keys */
+	bench_strs = (char **) calloc(n, sizeof(char *));
+	if (!bench_strs)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		bench_strs[i] = (char *) malloc(24);
+		if (!bench_strs[i])
+			goto out;
+
+		snprintf(bench_strs[i], 24, "key%010zu", i);
+	}
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+
+	for (j = 0; j < sizeof(maps) / sizeof(maps[0]); j++) {
+		if (maps[j].init())
+			goto out;
+
+		shuffle(keys, n);
+		bench_phase(NULL, maps[j].insert, keys, n, res);
+		bench_print(maps[j].name, n, "insert", res);
+
+		shuffle(keys, n);
+		bench_phase(NULL, maps[j].find, keys, n, res);
+		bench_print(maps[j].name, n, "find", res);
+
+		shuffle(keys, n);
+		bench_phase(NULL, maps[j].delete, keys, n, res);
+		bench_print(maps[j].name, n, "delete", res);
+
+		maps[j].destroy();
+	}
+
+	ret = 0;
+out:
+	for (i = 0; i < n; i++)
+		free(bench_strs[i]);
+	free(bench_strs);
+	return ret;
+}
+
+/*
+ * Benchmark memory used per key by a tree of n keys inserted in random order (heap usage, so file
+ * mappings of mmap backend are not seen).
+ */
+static int bench_backend_mem(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct mallinfo2 before, after;
+	struct tree_t *tree;
+	uint64_t start;
+	size_t i;
+
+	if (backend->type == TREE_TYPE_MMAP)
+		return 0;
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+	shuffle(keys, n);
+
+	before = mallinfo2();
+	start = now_ns();
+	tree = tree_create(backend->type);
+	if (!tree)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		tree->ops->insert(tree, keys[i]);
+	res->seconds = (now_ns() - start) / 1e9;
+	after = mallinfo2();
+
+	res->nr_ops = n;
+	res->nr_samples = 0;
+	bench_print(backend->name, n, "insert", res);
+	printf("%-8s %12zu %-10s %10.1f bytes/key\n", backend->name, n, "mem",
+	       ((double) (after.uordblks + after.hblkhd) - (double) (before.uordblks + before.hblkhd)) / n);
+	fflush(stdout);
+
+	tree->ops->free(tree);
+	return 0;
+}
+
+/*
+ * Benchmark lookups in a tree of n keys fragmented by n random updates, before and after relayout.
+ */
+static int bench_backend_layout(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct tree_t *tree;
+	uint64_t start;
+	size_t i;
+	int ret;
+
+	tree = tree_create(backend->type);
+	if (!tree)
+		return -1;
+
+	/* no relayout for this backend */
+	if (!tree->ops->relayout) {
+		tree->ops->free(tree);
+		return 0;
+	}
+
+	/* fill tree, then replace keys one by one so that nodes get scattered */
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+	shuffle(keys, n);
+	for (i = 0; i < n; i++)
+		tree->ops->insert(tree, 2 * keys[i]);
+	for (i = 0; i < n; i++) {
+		tree->ops->delete(tree, 2 * keys[i]);
+		tree->ops->insert(tree, 2 * keys[i] + 1);
+	}
+	for (i = 0; i < n; i++)
+		keys[i] = 2 * keys[i] + 1;
+
+	/* lookups in fragmented tree */
+	shuffle(keys, n);
+	bench_phase(tree, bench_find, keys, n, res);
+	bench_print(backend->name, n, "find", res);
+
+	/* relayout */
+	start = now_ns();
+	ret = tree_relayout(tree, 0);
+	res->seconds = (now_ns() - start) / 1e9;
+	res->nr_ops = n;
+	res->nr_samples = 0;
+	if (ret < 0) {
+		tree->ops->free(tree);
+		return -1;
+	}
+	bench_print(backend->name, n, "relayout", res);
+
+	/* lookups in laid out tree */
+	shuffle(keys, n);
+	bench_phase(tree, bench_find, keys, n, res);
+	bench_print(backend->name, n, "find-veb", res);
+
+	tree->ops->free(tree);
+	return 0;
+}
+
+/*
+ * Benchmark batch lookups of n keys (half of them missing) in a tree of n keys : one by one, then
+ * interleaved with tree_find_many().
+ */
+static int bench_backend_many(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	struct tree_t *tree;
+	uint8_t *found;
+	uint64_t start;
+	size_t i, hits;
+
+	tree = tree_create(backend->type);
+	found = (uint8_t *) malloc(n);
+	if (!tree || !found)
+		goto err;
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+	shuffle(keys, n);
+	for (i = 0; i < n; i++)
+		tree->ops->insert(tree, 2 * keys[i]);
+
+	/* one by one */
+	shuffle(keys, n);
+	start = now_ns();
+	for (i = 0; i < n; i++)
+		found[i] = tree->ops->find(tree, keys[i]);
+	res->seconds = (now_ns() - start) / 1e9;
+	res->nr_ops = n;
+	res->nr_samples = 0;
+	bench_print(backend->name, n, "find-loop", res);
+
+	for (i = 0, hits = 0; i < n; i++)
+		hits += found[i];
+
+	/* interleaved */
+	start = now_ns();
+	tree_find_many(tree, keys, n, found);
+	res->seconds = (now_ns() - start) / 1e9;
+	bench_print(backend->name, n, "find-many", res);
+
+	for (i = 0; i < n; i++)
+		hits -= found[i];
+	if (hits)
+		goto err;
+
+	free(found);
+	tree->ops->free(tree);
+	return 0;
+err:
+	free(found);
+	if (tree)
+		tree->ops->free(tree);
+	return -1;
+}
+
+/*
+ * Benchmark batch updates of a tree holding n / 2 keys : n / 2 other keys are inserted then deleted, one
+ * by one, as one batch, then as one batch on a thread pool.
+ */
+static int bench_backend_batch(struct bench_backend_t *backend, struct thread_pool_t *tp, int *keys, size_t n,
+			       struct bench_result_t *res)
+{
+	static const char *names[] = { "loop", "batch", "batch-mt" };
+	struct tree_t *tree = NULL;
+	char name[24];
+	uint64_t start;
+	size_t i, j, half = n / 2;
+
+	for (i = 0; i < n; i++)
+		keys[i] = (int) i;
+	shuffle(keys, n);
+
+	for (j = 0; j < 3; j++) {
+		/* build tree with first half of keys */
+		tree = tree_create(backend->type);
+		if (!tree)
+			return -1;
+		for (i = 0; i < half; i++)
+			tree->ops->insert(tree, keys[i]);
+
+		/* insert second half */
+		start = now_ns();
+		if (j == 0) {
+			for (i = half; i < n; i++)
+				tree->ops->insert(tree, keys[i]);
+		} else if (tree_insert_batch(tree, keys + half, n - half, j == 2 ? tp : NULL)) {
+			goto err;
+		}
+		res->seconds = (now_ns() - start) / 1e9;
+		res->nr_ops = n - half;
+		res->nr_samples = 0;
+
+		snprintf(name, sizeof(name), "ins-%s", names[j]);
+		bench_print(backend->name, n, name, res);
+		if ((size_t) tree->size != n)
+			goto err;
+
+		/* delete it again */
+		start = now_ns();
+		if (j == 0) {
+			for (i = half; i < n; i++)
+				tree->ops->delete(tree, keys[i]);
+		} else if (tree_delete_batch(tree, keys + half, n - half, j == 2 ? tp : NULL)) {
+			goto err;
+		}
+		res->seconds = (now_ns() - start) / 1e9;
+
+		snprintf(name, sizeof(name), "del-%s", names[j]);
+		bench_print(backend->name, n, name, res);
+		if ((size_t) tree->size != half)
+			goto err;
+
+		tree->ops->free(tree);
+		tree = NULL;
+	}
+
+	return 0;
+err:
+	if (tree)
+		tree->ops->free(tree);
+	return -1;
+}
+
+/*
+ * Benchmark AVL updates with recursive retracing (whole path), then with iterative retracing (stops
+ * once a subtree height is unchanged) : n keys are inserted, then deleted.
+ */
+static int bench_backend_retrace(struct bench_backend_t *backend, int *keys, size_t n, struct bench_result_t *res)
+{
+	static const char *names[] = { "rec", "iter" };
+	struct tree_t *tree;
+	char name[24];
+	size_t i, j;
+
+	/* only AVL trees have both versions */
+	if (backend->type != TREE_TYPE_AVL)
+		return 0;
+
+	for (j = 0; j < 2; j++) {
+		tree = tree_create(backend->type);
+		if (!tree)
+			return -1;
+		if (j == 0)
+			tree->flags |= TREE_FLAG_RECURSIVE;
+
+		/* same key order for both versions */
+		rand_state = 88172645463325252ULL;
+		for (i = 0; i < n; i++)
+			keys[i] = (int) i;
+		shuffle(keys, n);
+
+		snprintf(name, sizeof(name), "ins-%s", names[j]);
+		bench_phase(tree, tree->ops->insert, keys, n, res);
+		bench_print(backend->name, n, name, res);
+
+		shuffle(keys, n);
+		snprintf(name, sizeof(name), "del-%s", names[j]);
+		bench_phase(tree, tree->ops->delete, keys, n, res);
+		bench_print(backend->name, n, name, res);
+
+		if (tree->size != 0) {
+			tree->ops->free(tree);
+			return -1;
+		}
+
+		tree->ops->free(tree);
+	}
+
+	return 0;
+}
+
+/*
+ * Usage.
+ */
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n max_keys] [-b backend] [-w ops|mix|set|rcu|mt|shard|file|wal|map|mem|layout|many|batch|retrace]\n", name);
+}
+
+/*
+ * Main.
+ */
+int main(int argc, char **argv)
+{
+	size_t max_keys = BENCH_MAX_KEYS, n, i;
+	const char *backend_name = NULL, *workload = "ops";
+	struct thread_pool_t *tp = NULL;
+	struct bench_result_t res;
+	int *keys, c, ret;
+	size_t j;
+
+	/* parse options */
+	while ((c = getopt(argc, argv, "n:b:w:h")) != -1) {
+		switch (c) {
+			case 'n':
+				max_keys = strtoull(optarg, NULL, 10);
+				break;
+			case 'b':
+				backend_name = optarg;
+				break;
+			case 'w':
+				workload = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	/* allocate keys and latency samples */
+	keys = (int *) malloc(sizeof(int) * max_keys);
+	res.samples = (uint64_t *) malloc(sizeof(uint64_t) * BENCH_LATENCY_SAMPLES);
+	if (!keys || !res.samples) {
+		fprintf(stderr, "can't allocate %zu keys\n", max_keys);
+		return EXIT_FAILURE;
+	}
+
+	/* set operations and batch updates run on all CPUs */
+	if (strcmp(workload, "set") == 0 || strcmp(workload, "batch") == 0) {
+		tp = thread_pool_create(0);
+		if (!tp) {
+			fprintf(stderr, "can't create thread pool\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%-8s %12s %-10s %10s %10s %8s %8s %10s\n",
+	       "backend", "keys", "op", "Mops/s", "ns/op", "p50(ns)", "p99(ns)", "max(ns)");
+
+	/* run benchmarks, from 1e3 keys to max keys */
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (backend_name && strcmp(backend_name, backends[i].name) != 0)
+			continue;
+
+		for (n = BENCH_MIN_KEYS; n <= max_keys; n *= 10) {
+			if (strcmp(workload, "mix") == 0) {
+				for (j = 0, ret = 0; j < sizeof(mixes) / sizeof(mixes[0]) && !ret; j++)
+					ret = bench_backend_mix(&backends[i], &mixes[j], keys, n, &res);
+			} else if (strcmp(workload, "set") == 0) {
+				ret = bench_backend_set(&backends[i], tp, keys, n, &res);
+			} else if (strcmp(workload, "rcu") == 0) {
+				ret = bench_backend_rcu(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "mt") == 0) {
+				ret = bench_backend_mt(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "shard") == 0) {
+				ret = bench_backend_shard(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "file") == 0) {
+				ret = bench_backend_file(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "wal") == 0) {
+				ret = bench_backend_wal(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "map") == 0) {
+				ret = bench_backend_map(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "mem") == 0) {
+				ret = bench_backend_mem(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "layout") == 0) {
+				ret = bench_backend_layout(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "many") == 0) {
+				ret = bench_backend_many(&backends[i], keys, n, &res);
+			} else if (strcmp(workload, "batch") == 0) {
+				ret = bench_backend_batch(&backends[i], tp, keys, n, &res);
+			} else if (strcmp(workload, "retrace") == 0) {
+				ret = bench_backend_retrace(&backends[i], keys, n, &res);
+			} else {
+				ret = bench_backend(&backends[i], keys, n, &res);
+			}
+
+			if (ret) {
+				fprintf(stderr, "can't benchmark %s with %zu keys\n", backends[i].name, n);
+				break;
+			}
+		}
+	}
+
+	thread_pool_destroy(tp);
+	free(res.samples);
+	free(keys);
+
+	return 0;
+}
@@ -1,24 +1,34 @@
-#include <gtk/gtk.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 
 #include "tree.h"
 
+/*
+ * Node layout (for relayout and batch lookups).
+ */
+static const struct tree_layout_t node_layout = {
+	.node_size		= sizeof(struct binary_node_t),
+	.val			= offsetof(struct binary_node_t, val),
+	.left			= offsetof(struct binary_node_t, left),
+	.right			= offsetof(struct binary_node_t, right),
+	.parent			= TREE_LAYOUT_NO_PARENT,
+};
+
 /*
  * Create a node.
  */
-static struct binary_node_t *node_create(int val)
+static struct binary_node_t *node_create(struct tree_t *tree, int val)
 {
 	struct binary_node_t *node;
 
 	/* allocate a node */
-	node = (struct binary_node_t *) malloc(sizeof(struct binary_node_t));
+	node = (struct binary_node_t *) node_pool_alloc(tree->pool);
 	if (!node)
 		return NULL;
 
 	/* set node */
 	node->val = val;
+	node->size = 1;
 	node->left = NULL;
 	node->right = NULL;
 
@@ -26,37 +36,51 @@ static struct binary_node_t *node_create(int val)
 }
 
 /*
- * Free a node.
+ * Compute a node height (Morris traversal : threads are set and removed on the fly, no stack is used).
  */
-static void node_free(struct binary_node_t *node)
+static int node_height(struct binary_node_t *node)
 {
-	if (!node)
-		return;
-
-	/* free children */
-	node_free(node->left);
-	node_free(node->right);
+	struct binary_node_t *pre;
+	int depth = 0, height = 0, steps;
+
+	while (node) {
+		/* no left child : visit node and go right */
+		if (!node->left) {
+			height = max(height, depth + 1);
+			node = node->right;
+			depth++;
+			continue;
+		}
+
+		/* find in order predecessor */
+		for (pre = node->left, steps = 1; pre->right && pre->right != node; steps++)
+			pre = pre->right;
+
+		/* first visit : thread predecessor to this node and go left */
+		if (!pre->right) {
+			pre->right = node;
+			node = node->left;
+			depth++;
+			continue;
+		}
+
+		/* second visit (we came back through the thread) : fix depth, remove thread and go right */
+		depth -= steps + 1;
+		pre->right = NULL;
+		height = max(height, depth + 1);
+		node = node->right;
+		depth++;
+	}
 
-	/* free node */
-	free(node);
+	return height;
 }
 
 /*
- * Compute a node height.
+ * Get node size (number of values in subtree).
  */
-static int node_height(struct binary_node_t *node)
+static inline int node_size(struct binary_node_t *node)
 {
-	int height_l, height_r;
-
-	if (!node)
-		return 0;
-
-	/* compute left/right heights */
-	height_l = 1 + node_height(node->left);
-	height_r = 1 + node_height(node->right);
-
-	/* return max left/right height */
-	return max(height_l, height_r);
+	return node ? node->size : 0;
 }
 
 /*
@@ -64,153 +88,392 @@ static int node_height(struct binary_node_t *node)
  */
 static struct binary_node_t *node_find(struct binary_node_t *node, int val)
 {
-	if (!node)
-		return NULL;
-
-	if (val < node->val)
-		return node_find(node->left, val);
-	else if (val > node->val)
-		return node_find(node->right, val);
+	while (node) {
+		if (val < node->val)
+			node = node->left;
+		else if (val > node->val)
+			node = node->right;
+		else
+			break;
+	}
 
 	return node;
 }
 
 /*
- * Traverse a node in order and store values.
+ * Traverse a node in order and store values (Morris traversal).
  */
 static void node_traverse_in_order(struct binary_node_t *node, struct binary_node_t **nodes, int *i)
 {
-	if (!node)
-		return;
+	struct binary_node_t *pre;
+
+	while (node) {
+		/* no left child : store node and go right */
+		if (!node->left) {
+			nodes[(*i)++] = node;
+			node = node->right;
+			continue;
+		}
+
+		/* find in order predecessor */
+		for (pre = node->left; pre->right && pre->right != node;)
+			pre = pre->right;
+
+		/* first visit : thread predecessor to this node and go left */
+		if (!pre->right) {
+			pre->right = node;
+			node = node->left;
+			continue;
+		}
+
+		/* second visit : remove thread, store node and go right */
+		pre->right = NULL;
+		nodes[(*i)++] = node;
+		node = node->right;
+	}
+}
 
-	/* traverse left child */
-	node_traverse_in_order(node->left, nodes, i);
+/*
+ * Add delta to subtrees sizes along the search path of val (stops at val).
+ */
+static void node_path_resize(struct binary_node_t *node, int val, int delta)
+{
+	while (node && node->val != val) {
+		node->size += delta;
+		node = val < node->val ? node->left : node->right;
+	}
+}
 
-	/* store value */
-	nodes[*i] = node;
-	*i += 1;
+/*
+ * Insert a value in a tree.
+ */
+static void node_insert(struct tree_t *tree, int val)
+{
+	struct binary_node_t **link = &tree->root.binary;
+	int depth = 1;
+
+	/* find leaf link, counting new value in subtrees sizes */
+	while (*link) {
+		if (val < (*link)->val) {
+			(*link)->size++;
+			link = &(*link)->left;
+		} else if (val > (*link)->val) {
+			(*link)->size++;
+			link = &(*link)->right;
+		} else {
+			goto undo;
+		}
+
+		depth++;
+	}
 
-	/* traverse right child */
-	node_traverse_in_order(node->right, nodes, i);
+	/* create node */
+	*link = node_create(tree, val);
+	if (!*link)
+		goto undo;
+
+	/* update tree metadata */
+	if (tree->height != TREE_HEIGHT_UNKNOWN)
+		tree->height = max(tree->height, depth);
+	if (tree->size == 0 || val < tree->min)
+		tree->min = val;
+	if (tree->size == 0 || val > tree->max)
+		tree->max = val;
+
+	/* update tree size */
+	tree->size++;
+	return;
+undo:
+	/* value not inserted : restore subtrees sizes */
+	node_path_resize(tree->root.binary, val, -1);
 }
 
 /*
- * Insert a value in a node.
+ * Delete a value in a tree.
  */
-static struct binary_node_t *node_insert(struct tree_t *tree, struct binary_node_t *node, int val)
+static void node_delete(struct tree_t *tree, int val)
 {
-	/* leaf : insert node */
-	if (!node) {
-		/* create node */
-		node = node_create(val);
-		if (!node)
-			goto out;
+	struct binary_node_t **link = &tree->root.binary, **min_link, *node;
+
+	/* find node link, uncounting value from subtrees sizes */
+	for (;;) {
+		node = *link;
+
+		/* no such value : restore subtrees sizes */
+		if (!node) {
+			node_path_resize(tree->root.binary, val, 1);
+			return;
+		}
+
+		node->size--;
+		if (val < node->val)
+			link = &node->left;
+		else if (val > node->val)
+			link = &node->right;
+		else
+			break;
+	}
+
+	/* two children : move minimum value of right child here and delete minimum node instead */
+	if (node->left && node->right) {
+		for (min_link = &node->right; (*min_link)->left;) {
+			(*min_link)->size--;
+			min_link = &(*min_link)->left;
+		}
 
-		/* update tree size */
-		tree->size++;
-		goto out;
+		node->val = (*min_link)->val;
+		link = min_link;
+		node = *link;
 	}
 
-	/* find subtree */
-	if (val < node->val)
-		node->left = node_insert(tree, node->left, val);
-	else if (val > node->val)
-		node->right = node_insert(tree, node->right, val);
+	/* only one child or no child : replace this node with this child */
+	*link = node->left ? node->left : node->right;
+	node_pool_free(tree->pool, node);
+	tree->size--;
 
-out:
-	return node;
+	/* a subtree moved up : height may have shrunk, it will be recomputed on demand */
+	tree->height = TREE_HEIGHT_UNKNOWN;
+
+	/* update minimum/maximum */
+	if (tree->size == 0)
+		return;
+	if (val == tree->min) {
+		for (node = tree->root.binary; node->left;)
+			node = node->left;
+		tree->min = node->val;
+	} else if (val == tree->max) {
+		for (node = tree->root.binary; node->right;)
+			node = node->right;
+		tree->max = node->val;
+	}
 }
 
 /*
- * Find minimum value in a node.
+ * Make a balanced node/tree (explicit stack, depth is bounded by log2(size)).
  */
-static struct binary_node_t *node_min(struct binary_node_t *node)
+static struct binary_node_t *node_make_balanced(struct binary_node_t **nodes, int start, int end)
 {
-	if (!node)
-		return NULL;
-
-	if (!node->left)
-		return node;
+	struct {
+		int			start;
+		int			end;
+		struct binary_node_t **	link;
+	} stack[NODE_STACK_SIZE];
+	struct binary_node_t *root = NULL, *node, **link;
+	int top = 0, mid;
+
+	/* push whole range */
+	stack[top].start = start;
+	stack[top].end = end;
+	stack[top++].link = &root;
+
+	while (top > 0) {
+		/* pop a range */
+		top--;
+		start = stack[top].start;
+		end = stack[top].end;
+		link = stack[top].link;
+
+		/* no more nodes */
+		if (start > end) {
+			*link = NULL;
+			continue;
+		}
+
+		/* make middle node as root */
+		mid = (start + end) / 2;
+		node = nodes[mid];
+		node->size = end - start + 1;
+		*link = node;
+
+		/* insert nodes in right child */
+		stack[top].start = mid + 1;
+		stack[top].end = end;
+		stack[top++].link = &node->right;
+
+		/* insert nodes in left child */
+		stack[top].start = start;
+		stack[top].end = mid - 1;
+		stack[top++].link = &node->left;
+	}
 
-	return node_min(node->left);
+	return root;
 }
 
 /*
- * Delete a node.
+ * Count values lower than val (or lower or equal if inclusive).
  */
-static struct binary_node_t *node_delete(struct tree_t *tree, struct binary_node_t *node, int val)
+static int node_rank(struct binary_node_t *node, int val, int inclusive)
 {
-	struct binary_node_t *tmp;
-
-	if (!node)
-		return NULL;
-
-	/* delete in children */
-	if (val < node->val) {
-		node->left = node_delete(tree, node->left, val);
-		return node;
-	} else if (val > node->val) {
-		node->right = node_delete(tree, node->right, val);
-		return node;
+	int rank = 0;
+
+	while (node) {
+		if (node->val < val || (inclusive && node->val == val)) {
+			rank += node_size(node->left) + 1;
+			node = node->right;
+		} else {
+			node = node->left;
+		}
 	}
 
-	/* this node must be deleted */
+	return rank;
+}
 
-	/* only one child or no child : replace this node with this child */
-	if (!node->left || !node->right) {
-		tmp = node->left ? node->left : node->right;
-		free(node);
-		tree->size--;
-		return tmp;
+/*
+ * Find k-th smallest value of a node (k starts at 0).
+ */
+static struct binary_node_t *node_select(struct binary_node_t *node, int k)
+{
+	int size_l;
+
+	while (node) {
+		size_l = node_size(node->left);
+
+		if (k < size_l) {
+			node = node->left;
+		} else if (k > size_l) {
+			k -= size_l + 1;
+			node = node->right;
+		} else {
+			break;
+		}
 	}
 
-	/* find minimum value in right child */
-	tmp = node_min(node->right);
-
-	/* set this node with minimum value */
-	node->val = tmp->val;
+	return node;
+}
 
-	/* delete minimum value in right child */
-	node->right = node_delete(tree, node->right, node->val);
+/*
+ * Store values of a node in order, at most cap values (Morris traversal : the walk always ends, so
+ * that threads are removed). Returns number of values stored.
+ */
+static size_t node_keys(struct binary_node_t *node, int *keys, size_t cap)
+{
+	struct binary_node_t *pre;
+	size_t n = 0;
+
+	while (node) {
+		/* no left child : store value and go right */
+		if (!node->left) {
+			if (n < cap)
+				keys[n++] = node->val;
+			node = node->right;
+			continue;
+		}
+
+		/* find in order predecessor */
+		for (pre = node->left; pre->right && pre->right != node;)
+			pre = pre->right;
+
+		/* first visit : thread predecessor to this node and go left */
+		if (!pre->right) {
+			pre->right = node;
+			node = node->left;
+			continue;
+		}
+
+		/* second visit : remove thread, store value and go right */
+		pre->right = NULL;
+		if (n < cap)
+			keys[n++] = node->val;
+		node = node->right;
+	}
 
-	return node;
+	return n;
 }
 
 /*
- * Make a balanced node/tree.
+ * Build a balanced node/tree from sorted values (nodes are allocated in pre order, values are left
+ * unset if keys is NULL).
  */
-static struct binary_node_t *node_make_balanced(struct tree_t *tree, struct binary_node_t **nodes, int start, int end)
+static struct binary_node_t *node_build(struct tree_t *tree, const int *keys, int n)
 {
-	struct binary_node_t *root;
-	int mid;
+	struct {
+		int			start;
+		int			end;
+		struct binary_node_t **	link;
+	} stack[NODE_STACK_SIZE];
+	struct binary_node_t *root = NULL, *node, **link;
+	int top = 0, start, end, mid;
+
+	/* push whole range */
+	stack[top].start = 0;
+	stack[top].end = n - 1;
+	stack[top++].link = &root;
+
+	while (top > 0) {
+		/* pop a range */
+		top--;
+		start = stack[top].start;
+		end = stack[top].end;
+		link = stack[top].link;
+
+		/* no more values */
+		if (start > end) {
+			*link = NULL;
+			continue;
+		}
+
+		/* make middle value as root */
+		mid = (start + end) / 2;
+		node = node_create(tree, keys ? keys[mid] : 0);
+		if (!node)
+			return NULL;
+		node->size = end - start + 1;
+		*link = node;
+
+		/* build right child */
+		stack[top].start = mid + 1;
+		stack[top].end = end;
+		stack[top++].link = &node->right;
+
+		/* build left child */
+		stack[top].start = start;
+		stack[top].end = mid - 1;
+		stack[top++].link = &node->left;
+	}
 
-	/* no more nodes */
-	if (start > end)
-		return NULL;
+	return root;
+}
 
-	/* make middle node as root */
-	mid = (start + end) / 2;
-	root = nodes[mid];
+/*
+ * Read values of a node in order from a reader.
+ */
+static int node_fill(struct binary_node_t *node, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct binary_node_t *stack[NODE_STACK_SIZE];
+	int top = 0;
 
-	/* insert nodes in left child */
-	root->left = node_make_balanced(tree, nodes, start, mid - 1);
+	while (node || top > 0) {
+		for (; node != NULL; node = node->left)
+			stack[top++] = node;
 
-	/* insert nodes in right child */
-	root->right = node_make_balanced(tree, nodes, mid + 1, end);
+		node = stack[--top];
+		if (read(arg, &node->val, 1))
+			return -1;
+		node = node->right;
+	}
 
-	return root;
+	return 0;
 }
 
 /*
  * Init a tree.
  */
-static void tree_init(struct tree_t *tree)
+static int tree_init(struct tree_t *tree)
 {
 	if (!tree)
-		return;
+		return -1;
+
+	/* create node pool */
+	tree->pool = node_pool_create(sizeof(struct binary_node_t));
+	if (!tree->pool)
+		return -1;
 
 	tree->size = 0;
+	tree->height = 0;
+	tree->balance_mode = TREE_BALANCE_ARRAY;
 	tree->root.binary = NULL;
+
+	return 0;
 }
 /*
  * Free a tree.
@@ -220,7 +483,8 @@ static void tree_free(struct tree_t *tree)
 	if (!tree)
 		return;
 
-	node_free(tree->root.binary);
+	/* release all nodes at once */
+	node_pool_destroy(tree->pool);
 	free(tree);
 }
 
@@ -232,7 +496,35 @@ static int tree_height(struct tree_t *tree)
 	if (!tree)
 		return 0;
 
-	return node_height(tree->root.binary);
+	/* recompute height if needed */
+	if (tree->height == TREE_HEIGHT_UNKNOWN)
+		tree->height = node_height(tree->root.binary);
+
+	return tree->height;
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	if (!tree || tree->size == 0)
+		return 0;
+
+	*val = tree->min;
+	return 1;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	if (!tree || tree->size == 0)
+		return 0;
+
+	*val = tree->max;
+	return 1;
 }
 
 /*
@@ -246,6 +538,17 @@ static int tree_find(struct tree_t *tree, int val)
 	return node_find(tree->root.binary, val) != NULL;
 }
 
+/*
+ * Find n values in a tree (searches are interleaved, see tree_layout_find_many()).
+ */
+static void tree_find_interleaved(struct tree_t *tree, const int *keys, size_t n, uint8_t *out)
+{
+	if (!tree)
+		return;
+
+	tree_layout_find_many(tree->root.binary, &node_layout, keys, n, out);
+}
+
 /*
  * Insert a value in a tree.
  */
@@ -254,7 +557,8 @@ static void tree_insert(struct tree_t *tree, int val)
 	if (!tree)
 		return;
 
-	tree->root.binary = node_insert(tree, tree->root.binary, val);
+	node_insert(tree, val);
+	tree_relayout_update(tree);
 }
 
 /*
@@ -265,131 +569,454 @@ static void tree_delete(struct tree_t *tree, int val)
 	if (!tree)
 		return;
 
-	tree->root.binary = node_delete(tree, tree->root.binary, val);
+	node_delete(tree, val);
+	tree_relayout_update(tree);
 }
 
 /*
- * Balance a tree.
+ * Turn a tree into a vine (right linked list) with right rotations.
  */
-static void tree_balance(struct tree_t *tree)
+static void node_tree_to_vine(struct binary_node_t *root)
 {
-	struct binary_node_t **nodes;
-	int i = 0;
+	struct binary_node_t *tail = root, *rest = root->right, *tmp;
+
+	while (rest) {
+		/* no left child : move down */
+		if (!rest->left) {
+			tail = rest;
+			rest = rest->right;
+			continue;
+		}
+
+		/* rotate right */
+		tmp = rest->left;
+		rest->left = tmp->right;
+		tmp->right = rest;
+		tmp->size = rest->size;
+		rest->size = 1 + node_size(rest->left) + node_size(rest->right);
+		rest = tmp;
+		tail->right = tmp;
+	}
+}
 
-	/* emptry tree */
-	if (!tree)
-		return;
+/*
+ * Left rotate count nodes along the vine.
+ */
+static void node_vine_compress(struct binary_node_t *root, int count)
+{
+	struct binary_node_t *scanner = root, *child;
+
+	while (count-- > 0) {
+		child = scanner->right;
+		scanner->right = child->right;
+		scanner = scanner->right;
+		child->right = scanner->left;
+		scanner->left = child;
+		scanner->size = child->size;
+		child->size = 1 + node_size(child->left) + node_size(child->right);
+	}
+}
 
-	/* no need to balance */
-	if (tree->size <= 2)
-		return;
+/*
+ * Balance a tree in place (Day-Stout-Warren) : O(n) time, O(1) memory.
+ */
+static void tree_balance_dsw(struct tree_t *tree)
+{
+	struct binary_node_t pseudo_root = { 0 };
+	int leaves, size;
+
+	/* turn tree into a vine */
+	pseudo_root.right = tree->root.binary;
+	node_tree_to_vine(&pseudo_root);
+
+	/* compress extra leaves so that remaining nodes form a perfect tree */
+	size = tree->size;
+	leaves = size + 1 - (1 << (tree_balanced_height(size + 1) - 1));
+	node_vine_compress(&pseudo_root, leaves);
+
+	/* compress vine into a tree */
+	for (size -= leaves; size > 1; size /= 2)
+		node_vine_compress(&pseudo_root, size / 2);
+
+	tree->root.binary = pseudo_root.right;
+}
+
+/*
+ * Balance a tree by rebuilding it from an array of nodes : O(n) time, O(n) memory.
+ */
+static int tree_balance_array(struct tree_t *tree)
+{
+	struct binary_node_t **nodes;
+	int i = 0;
 
 	/* create an array to store all nodes */
 	nodes = (struct binary_node_t **) malloc(sizeof(struct binary_node_t *) * tree->size);
 	if (!nodes)
-		return;
+		return -1;
 
 	/* store nodes, in order */
 	node_traverse_in_order(tree->root.binary, nodes, &i);
 
 	/* insert nodes one by one, in a balanced tree */
-	tree->root.binary = node_make_balanced(tree, nodes, 0, tree->size - 1);
+	tree->root.binary = node_make_balanced(nodes, 0, tree->size - 1);
 
 	/* free nodes array */
 	free(nodes);
+
+	return 0;
 }
 
 /*
- * Draw a node value.
+ * Balance a tree.
  */
-static void node_draw_value(struct binary_node_t *node, cairo_t *cr, int x, gint y)
+static void tree_balance(struct tree_t *tree)
 {
-	char val_string[64];
-	int len;
+	/* emptry tree */
+	if (!tree)
+		return;
+
+	/* no need to balance */
+	if (tree->size <= 2)
+		return;
 
-	/* draw rectangle node */
-	cairo_set_line_width(cr, 2.0);
-	cairo_set_source_rgb(cr, 0, 0, 0);
-	cairo_rectangle(cr, x, y, NODE_SIZE_X, NODE_SIZE_Y);
-	cairo_stroke(cr);
+	/* rebuild from an array, or in place if array can't be allocated */
+	if (tree->balance_mode != TREE_BALANCE_ARRAY || tree_balance_array(tree))
+		tree_balance_dsw(tree);
 
-	/* draw value */
-	len = sprintf(val_string, "%d", node->val);
-	cairo_select_font_face(cr, NODE_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-	cairo_set_font_size(cr, 12);
-	cairo_move_to(cr, len == 1 ? x + 6 : x + 3, y + 15);
-	cairo_show_text(cr, val_string);
+	tree->height = tree_balanced_height(tree->size);
 }
 
 /*
- * Draw a node.
+ * Load values in a tree : a balanced tree is built from scratch in O(n) once values are sorted.
  */
-static void node_draw(struct binary_node_t *node, cairo_t *cr, int x, int y, int space_sibling)
+static int tree_bulk_load(struct tree_t *tree, const int *keys, size_t n)
 {
-	int x_child, y_child;
+	struct node_pool_t *pool, *old_pool;
+	int *sorted, *merged, *old_keys;
+	size_t nr_old;
+	struct binary_node_t *root;
+
+	if (!tree)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* sort and deduplicate values */
+	sorted = tree_sort_keys(keys, &n);
+	if (!sorted)
+		return -1;
+
+	/* merge with values already in the tree */
+	if (tree->size > 0) {
+		old_keys = (int *) malloc(sizeof(int) * tree->size);
+		if (!old_keys)
+			goto err;
+
+		nr_old = node_keys(tree->root.binary, old_keys, tree->size);
+		merged = tree_merge_keys(sorted, n, old_keys, nr_old, &n);
+		free(old_keys);
+		if (!merged)
+			goto err;
+
+		free(sorted);
+		sorted = merged;
+	}
+
+	/* too many values */
+	if (n > INT_MAX)
+		goto err;
+
+	/* build tree in a fresh pool, so that nodes are packed */
+	pool = node_pool_create(sizeof(struct binary_node_t));
+	if (!pool)
+		goto err;
+	old_pool = tree->pool;
+	tree->pool = pool;
+	root = node_build(tree, sorted, n);
+	if (!root) {
+		tree->pool = old_pool;
+		node_pool_destroy(pool);
+		goto err;
+	}
 
+	/* release old nodes */
+	node_pool_destroy(old_pool);
+
+	/* set tree */
+	tree->root.binary = root;
+	tree->size = n;
+	tree->height = tree_balanced_height(tree->size);
+	tree->min = sorted[0];
+	tree->max = sorted[n - 1];
+
+	free(sorted);
+	return 0;
+err:
+	free(sorted);
+	return -1;
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : a balanced shape is built first,
+ * then values are read in order into it.
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct binary_node_t *root, *node;
+
+	if (!tree || tree->size > 0 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* nodes of a failed load stay in pool until tree is freed */
+	root = node_build(tree, NULL, n);
+	if (!root || node_fill(root, read, arg))
+		return -1;
+
+	/* set tree */
+	tree->root.binary = root;
+	tree->size = n;
+	tree->height = tree_balanced_height(tree->size);
+	for (node = root; node->left != NULL;)
+		node = node->left;
+	tree->min = node->val;
+	for (node = root; node->right != NULL;)
+		node = node->right;
+	tree->max = node->val;
+
+	return 0;
+}
+
+/*
+ * Store values of a tree in order (at most cap values). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	if (!tree)
+		return 0;
+
+	return node_keys(tree->root.binary, keys, cap);
+}
+
+/*
+ * Count values lower than val in a tree.
+ */
+static int tree_rank(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return 0;
+
+	return node_rank(tree->root.binary, val, 0);
+}
+
+/*
+ * Find k-th smallest value of a tree (k starts at 0).
+ */
+static int tree_select(struct tree_t *tree, int k, int *val)
+{
+	struct binary_node_t *node;
+
+	if (!tree || k < 0 || k >= tree->size)
+		return 0;
+
+	node = node_select(tree->root.binary, k);
 	if (!node)
-		return;
+		return 0;
 
-	/* draw value */
-	node_draw_value(node, cr, x, y);
+	*val = node->val;
+	return 1;
+}
 
-	/* draw left child */
-	if (node->left) {
-		/* compute x/y child */
-		x_child = x - NODE_SIZE_X * space_sibling;
-		y_child = y + NODE_SIZE_Y * 2;
+/*
+ * Count values in [lo, hi] in a tree.
+ */
+static int tree_count_range(struct tree_t *tree, int lo, int hi)
+{
+	if (!tree || lo > hi)
+		return 0;
+
+	return node_rank(tree->root.binary, hi, 1) - node_rank(tree->root.binary, lo, 0);
+}
+
+/*
+ * Position an iterator on first value >= val (or last value <= val if backward is set).
+ */
+static int iter_find(struct tree_iter_t *iter, int val, int backward)
+{
+	struct binary_node_t *node, *found = NULL;
+	int depth = 0, found_depth = 0;
+
+	/* descend from root, remembering path and best candidate */
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	for (node = iter->tree->root.binary; node != NULL;) {
+		tree_iter_push(iter, node);
+		depth++;
+
+		if (node->val == val) {
+			found = node;
+			found_depth = depth;
+			break;
+		}
+
+		if (val < node->val) {
+			if (!backward) {
+				found = node;
+				found_depth = depth;
+			}
+			node = node->left;
+		} else {
+			if (backward) {
+				found = node;
+				found_depth = depth;
+			}
+			node = node->right;
+		}
+	}
+
+	/* no such value */
+	if (!found) {
+		tree_iter_reset(iter, backward ? TREE_ITER_BEGIN : TREE_ITER_END);
+		return 0;
+	}
+
+	/* climb back to candidate */
+	for (; depth > found_depth && iter->depth > 0; depth--)
+		tree_iter_pop(iter);
 
-		/* draw left arrow */
-		cairo_move_to(cr, x + NODE_SIZE_X / 2, y + NODE_SIZE_Y);
-		cairo_line_to(cr, x_child + NODE_SIZE_X / 2, y_child);
-		cairo_stroke(cr);
+	/* candidate dropped out of path : descend again straight to it */
+	if (tree_iter_peek(iter) != found) {
+		tree_iter_reset(iter, TREE_ITER_VALUE);
+		for (node = iter->tree->root.binary; node != found;) {
+			tree_iter_push(iter, node);
+			node = found->val < node->val ? node->left : node->right;
+		}
 
-		/* draw left node */
-		node_draw(node->left, cr, x_child, y_child, space_sibling / 2);
+		tree_iter_push(iter, found);
 	}
 
-	/* draw right child */
+	iter->val = found->val;
+	return 1;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	if (!iter || !tree)
+		return 0;
+
+	iter->tree = tree;
+	return iter_find(iter, val, 0);
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	struct binary_node_t *node, *child;
+
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+	if (iter->state == TREE_ITER_BEGIN)
+		return iter_find(iter, INT_MIN, 0);
+
+	/* leftmost node of right child */
+	node = (struct binary_node_t *) tree_iter_peek(iter);
 	if (node->right) {
-		/* compute x/y child */
-		x_child = x + NODE_SIZE_X * space_sibling;
-		y_child = y + NODE_SIZE_Y * 2;
+		for (node = node->right; node != NULL; node = node->left)
+			tree_iter_push(iter, node);
 
-		/* draw right arrow */
-		cairo_move_to(cr, x + NODE_SIZE_X / 2, y + NODE_SIZE_Y);
-		cairo_line_to(cr, x_child + NODE_SIZE_X / 2, y_child);
-		cairo_stroke(cr);
+		iter->val = ((struct binary_node_t *) tree_iter_peek(iter))->val;
+		return 1;
+	}
+
+	/* first ancestor reached from a left child */
+	for (;;) {
+		child = (struct binary_node_t *) tree_iter_pop(iter);
+		node = (struct binary_node_t *) tree_iter_peek(iter);
+		if (!node)
+			break;
 
-		/* draw right node */
-		node_draw(node->right, cr, x_child, y_child, space_sibling / 2);
+		if (node->left == child) {
+			iter->val = node->val;
+			return 1;
+		}
 	}
+
+	/* climbed past remembered ancestors : seek from root */
+	if (child != iter->tree->root.binary && iter->val < INT_MAX)
+		return iter_find(iter, iter->val + 1, 0);
+
+	tree_iter_reset(iter, TREE_ITER_END);
+	return 0;
 }
 
 /*
- * Draw a tree.
+ * Move an iterator to previous value.
  */
-static void tree_draw(struct tree_t *tree, GtkWidget *drawing_area, cairo_t *cr)
+static int tree_prev(struct tree_iter_t *iter)
 {
-	GtkAllocation *alloc;
-	int space_sibling;
-	int x, y;
-	
-	/* compute space between sibling */
-	space_sibling = pow(2, tree->ops->height(tree) - 1) / 2;
+	struct binary_node_t *node, *child;
+
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+	if (iter->state == TREE_ITER_END)
+		return iter_find(iter, INT_MAX, 1);
 
-	/* get drawing area size */
-	alloc = g_new(GtkAllocation, 1);
-	gtk_widget_get_allocation(drawing_area, alloc);
+	/* rightmost node of left child */
+	node = (struct binary_node_t *) tree_iter_peek(iter);
+	if (node->left) {
+		for (node = node->left; node != NULL; node = node->right)
+			tree_iter_push(iter, node);
+
+		iter->val = ((struct binary_node_t *) tree_iter_peek(iter))->val;
+		return 1;
+	}
+
+	/* first ancestor reached from a right child */
+	for (;;) {
+		child = (struct binary_node_t *) tree_iter_pop(iter);
+		node = (struct binary_node_t *) tree_iter_peek(iter);
+		if (!node)
+			break;
+
+		if (node->right == child) {
+			iter->val = node->val;
+			return 1;
+		}
+	}
+
+	/* climbed past remembered ancestors : seek from root */
+	if (child != iter->tree->root.binary && iter->val > INT_MIN)
+		return iter_find(iter, iter->val - 1, 1);
 
-	/* start at middle x */
-	x = alloc->width / 2;
-	y = 100;
+	tree_iter_reset(iter, TREE_ITER_BEGIN);
+	return 0;
+}
+
+/*
+ * Copy a tree into fresh nodes, in van Emde Boas order, if it is fragmented.
+ */
+static int tree_relayout_nodes(struct tree_t *tree, int threshold)
+{
+	void *root;
+	int ret;
+
+	if (!tree)
+		return -1;
 
-	/* free drawing area size */
-	g_free(alloc);
+	root = tree->root.binary;
+	ret = tree_layout_relayout(tree, &root, &node_layout, threshold);
+	tree->root.binary = (struct binary_node_t *) root;
 
-	/* draw root node */
-	node_draw(tree->root.binary, cr, x, y, space_sibling);
+	return ret;
 }
 
 /*
@@ -398,10 +1025,22 @@ static void tree_draw(struct tree_t *tree, GtkWidget *drawing_area, cairo_t *cr)
 struct tree_operations_t binary_tree_ops = {
 	.init			= tree_init,
 	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
 	.find			= tree_find,
+	.find_many		= tree_find_interleaved,
 	.insert			= tree_insert,
 	.delete			= tree_delete,
 	.balance		= tree_balance,
+	.bulk_load		= tree_bulk_load,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.rank			= tree_rank,
+	.select			= tree_select,
+	.count_range		= tree_count_range,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.relayout		= tree_relayout_nodes,
 	.free			= tree_free,
-	.draw			= tree_draw,
 };
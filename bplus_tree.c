@@ -0,0 +1,906 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "tree.h"
+
+#define BPLUS_INNER_MIN			(BPLUS_INNER_KEYS / 2)
+#define BPLUS_LEAF_MIN			(BPLUS_LEAF_KEYS / 2)
+
+/*
+ * Count keys strictly lower than val (unused slots hold INT_MAX, so all slots can be compared).
+ */
+static inline int keys_count_lower(const int *keys, int nr_slots, int val)
+{
+	int i, count = 0;
+#if defined(__AVX2__)
+	__m256i v = _mm256_set1_epi32(val), k;
+
+	for (i = 0; i < nr_slots; i += 8) {
+		k = _mm256_loadu_si256((const __m256i *) (keys + i));
+		count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v, k))));
+	}
+#elif defined(__SSE2__)
+	__m128i v = _mm_set1_epi32(val), k;
+
+	for (i = 0; i < nr_slots; i += 4) {
+		k = _mm_loadu_si128((const __m128i *) (keys + i));
+		count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v, k))));
+	}
+#else
+	for (i = 0; i < nr_slots; i++)
+		count += keys[i] < val;
+#endif
+
+	return count;
+}
+
+/*
+ * Create a node.
+ */
+static struct bplus_node_t *node_create(struct tree_t *tree, int leaf)
+{
+	struct bplus_node_t *node;
+	int i;
+
+	/* allocate a node */
+	node = (struct bplus_node_t *) node_pool_alloc(tree->pool);
+	if (!node)
+		return NULL;
+
+	/* set node */
+	node->nr_keys = 0;
+	node->leaf = leaf;
+	if (leaf) {
+		node->leaf_node.prev = NULL;
+		node->leaf_node.next = NULL;
+		for (i = 0; i < BPLUS_LEAF_KEYS; i++)
+			node->leaf_node.keys[i] = INT_MAX;
+	} else {
+		for (i = 0; i < BPLUS_INNER_KEYS; i++)
+			node->inner_node.keys[i] = INT_MAX;
+	}
+
+	return node;
+}
+
+/*
+ * Find leaf that may hold a value.
+ */
+static inline struct bplus_node_t *node_find_leaf(struct bplus_node_t *node, int val)
+{
+	while (node && !node->leaf)
+		node = node->inner_node.children[keys_count_lower(node->inner_node.keys, BPLUS_INNER_KEYS, val)];
+
+	return node;
+}
+
+/*
+ * Find leftmost leaf.
+ */
+static struct bplus_node_t *node_first_leaf(struct bplus_node_t *node)
+{
+	while (node && !node->leaf)
+		node = node->inner_node.children[0];
+
+	return node;
+}
+
+/*
+ * Find rightmost leaf.
+ */
+static struct bplus_node_t *node_last_leaf(struct bplus_node_t *node)
+{
+	while (node && !node->leaf)
+		node = node->inner_node.children[node->nr_keys];
+
+	return node;
+}
+
+/*
+ * Store values of a node in order, at most cap values (walk linked leaves). Returns number of values stored.
+ */
+static size_t node_keys(struct bplus_node_t *node, int *keys, size_t cap)
+{
+	size_t n = 0, len;
+
+	for (node = node_first_leaf(node); node != NULL && n < cap; node = node->leaf_node.next) {
+		len = cap - n < (size_t) node->nr_keys ? cap - n : (size_t) node->nr_keys;
+		memcpy(keys + n, node->leaf_node.keys, sizeof(int) * len);
+		n += len;
+	}
+
+	return n;
+}
+
+/*
+ * Insert a key at position pos of a keys array (last key is lost if array is full).
+ */
+static inline void keys_insert(int *keys, int nr_keys, int nr_slots, int pos, int val)
+{
+	memmove(&keys[pos + 1], &keys[pos], sizeof(int) * (min(nr_keys + 1, nr_slots) - pos - 1));
+	keys[pos] = val;
+}
+
+/*
+ * Remove key at position pos of a keys array.
+ */
+static inline void keys_remove(int *keys, int nr_keys, int pos)
+{
+	memmove(&keys[pos], &keys[pos + 1], sizeof(int) * (nr_keys - pos - 1));
+	keys[nr_keys - 1] = INT_MAX;
+}
+
+/*
+ * Insert a separator and a right child in an inner node (node must not be full).
+ */
+static void inner_insert(struct bplus_node_t *node, int pos, int sep, struct bplus_node_t *right)
+{
+	struct bplus_node_t **children = node->inner_node.children;
+
+	keys_insert(node->inner_node.keys, node->nr_keys, BPLUS_INNER_KEYS, pos, sep);
+	memmove(&children[pos + 2], &children[pos + 1], sizeof(struct bplus_node_t *) * (node->nr_keys - pos));
+	children[pos + 1] = right;
+	node->nr_keys++;
+}
+
+/*
+ * Split a full leaf while inserting a value : returns new right leaf.
+ */
+static struct bplus_node_t *leaf_split(struct tree_t *tree, struct bplus_node_t *leaf, int pos, int val)
+{
+	int keys[BPLUS_LEAF_KEYS + 1], i, half;
+	struct bplus_node_t *right;
+
+	/* create right leaf */
+	right = node_create(tree, 1);
+	if (!right)
+		return NULL;
+
+	/* merge all keys */
+	memcpy(keys, leaf->leaf_node.keys, sizeof(int) * pos);
+	keys[pos] = val;
+	memcpy(&keys[pos + 1], &leaf->leaf_node.keys[pos], sizeof(int) * (BPLUS_LEAF_KEYS - pos));
+
+	/* split keys */
+	half = (BPLUS_LEAF_KEYS + 1) / 2;
+	for (i = 0; i < BPLUS_LEAF_KEYS; i++)
+		leaf->leaf_node.keys[i] = i < half ? keys[i] : INT_MAX;
+	memcpy(right->leaf_node.keys, &keys[half], sizeof(int) * (BPLUS_LEAF_KEYS + 1 - half));
+	leaf->nr_keys = half;
+	right->nr_keys = BPLUS_LEAF_KEYS + 1 - half;
+
+	/* link leaves */
+	right->leaf_node.prev = leaf;
+	right->leaf_node.next = leaf->leaf_node.next;
+	if (leaf->leaf_node.next)
+		leaf->leaf_node.next->leaf_node.prev = right;
+	leaf->leaf_node.next = right;
+
+	return right;
+}
+
+/*
+ * Split a full inner node while inserting a separator and a right child : returns new right node and pushed up separator.
+ */
+static struct bplus_node_t *inner_split(struct tree_t *tree, struct bplus_node_t *node, int pos, int sep,
+					struct bplus_node_t *child, int *up_sep)
+{
+	struct bplus_node_t *children[BPLUS_INNER_KEYS + 2], *right;
+	int keys[BPLUS_INNER_KEYS + 1], i, half;
+
+	/* create right node */
+	right = node_create(tree, 0);
+	if (!right)
+		return NULL;
+
+	/* merge all keys and children */
+	memcpy(keys, node->inner_node.keys, sizeof(int) * pos);
+	keys[pos] = sep;
+	memcpy(&keys[pos + 1], &node->inner_node.keys[pos], sizeof(int) * (BPLUS_INNER_KEYS - pos));
+	memcpy(children, node->inner_node.children, sizeof(struct bplus_node_t *) * (pos + 1));
+	children[pos + 1] = child;
+	memcpy(&children[pos + 2], &node->inner_node.children[pos + 1],
+	       sizeof(struct bplus_node_t *) * (BPLUS_INNER_KEYS - pos));
+
+	/* left node keeps half keys, middle key goes up, right node gets the rest */
+	half = BPLUS_INNER_KEYS / 2;
+	for (i = 0; i < BPLUS_INNER_KEYS; i++)
+		node->inner_node.keys[i] = i < half ? keys[i] : INT_MAX;
+	memcpy(node->inner_node.children, children, sizeof(struct bplus_node_t *) * (half + 1));
+	node->nr_keys = half;
+
+	*up_sep = keys[half];
+
+	memcpy(right->inner_node.keys, &keys[half + 1], sizeof(int) * (BPLUS_INNER_KEYS - half));
+	memcpy(right->inner_node.children, &children[half + 1], sizeof(struct bplus_node_t *) * (BPLUS_INNER_KEYS - half + 1));
+	right->nr_keys = BPLUS_INNER_KEYS - half;
+
+	return right;
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void node_insert(struct tree_t *tree, int val)
+{
+	struct {
+		struct bplus_node_t *	node;
+		int			pos;
+	} path[BPLUS_MAX_DEPTH];
+	struct bplus_node_t *node, *right, *root;
+	int depth = 0, pos, sep;
+
+	/* empty tree : create a root leaf */
+	if (!tree->root.bplus) {
+		node = node_create(tree, 1);
+		if (!node)
+			return;
+
+		node->leaf_node.keys[0] = val;
+		node->nr_keys = 1;
+		tree->root.bplus = node;
+		tree->size++;
+		return;
+	}
+
+	/* find leaf */
+	for (node = tree->root.bplus; !node->leaf; node = node->inner_node.children[pos]) {
+		pos = keys_count_lower(node->inner_node.keys, BPLUS_INNER_KEYS, val);
+		path[depth].node = node;
+		path[depth++].pos = pos;
+	}
+
+	/* value already in tree */
+	pos = keys_count_lower(node->leaf_node.keys, BPLUS_LEAF_KEYS, val);
+	if (pos < node->nr_keys && node->leaf_node.keys[pos] == val)
+		return;
+
+	/* leaf not full : just insert value */
+	if (node->nr_keys < BPLUS_LEAF_KEYS) {
+		keys_insert(node->leaf_node.keys, node->nr_keys, BPLUS_LEAF_KEYS, pos, val);
+		node->nr_keys++;
+		tree->size++;
+		return;
+	}
+
+	/* split leaf */
+	right = leaf_split(tree, node, pos, val);
+	if (!right)
+		return;
+	sep = node->leaf_node.keys[node->nr_keys - 1];
+	tree->size++;
+
+	/* insert separator in parents, splitting them if needed */
+	while (depth > 0) {
+		node = path[--depth].node;
+		pos = path[depth].pos;
+
+		/* parent not full : done */
+		if (node->nr_keys < BPLUS_INNER_KEYS) {
+			inner_insert(node, pos, sep, right);
+			return;
+		}
+
+		/* split parent */
+		right = inner_split(tree, node, pos, sep, right, &sep);
+		if (!right)
+			return;
+	}
+
+	/* root has been split : create a new root */
+	root = node_create(tree, 0);
+	if (!root)
+		return;
+
+	root->inner_node.keys[0] = sep;
+	root->inner_node.children[0] = tree->root.bplus;
+	root->inner_node.children[1] = right;
+	root->nr_keys = 1;
+	tree->root.bplus = root;
+}
+
+/*
+ * Rebalance an underflowing leaf, which is child pos of parent : returns 1 if parent lost a key.
+ */
+static int leaf_rebalance(struct tree_t *tree, struct bplus_node_t *parent, int pos)
+{
+	struct bplus_node_t *node = parent->inner_node.children[pos], *left, *right;
+
+	/* borrow from left sibling */
+	if (pos > 0) {
+		left = parent->inner_node.children[pos - 1];
+		if (left->nr_keys > BPLUS_LEAF_MIN) {
+			keys_insert(node->leaf_node.keys, node->nr_keys, BPLUS_LEAF_KEYS, 0, left->leaf_node.keys[left->nr_keys - 1]);
+			node->nr_keys++;
+			left->leaf_node.keys[--left->nr_keys] = INT_MAX;
+			parent->inner_node.keys[pos - 1] = left->leaf_node.keys[left->nr_keys - 1];
+			return 0;
+		}
+	}
+
+	/* borrow from right sibling */
+	if (pos < parent->nr_keys) {
+		right = parent->inner_node.children[pos + 1];
+		if (right->nr_keys > BPLUS_LEAF_MIN) {
+			node->leaf_node.keys[node->nr_keys++] = right->leaf_node.keys[0];
+			keys_remove(right->leaf_node.keys, right->nr_keys--, 0);
+			parent->inner_node.keys[pos] = node->leaf_node.keys[node->nr_keys - 1];
+			return 0;
+		}
+	}
+
+	/* merge with a sibling : right leaf always goes into left leaf */
+	if (pos > 0) {
+		left = parent->inner_node.children[pos - 1];
+		right = node;
+		pos--;
+	} else {
+		left = node;
+		right = parent->inner_node.children[pos + 1];
+	}
+
+	memcpy(&left->leaf_node.keys[left->nr_keys], right->leaf_node.keys, sizeof(int) * right->nr_keys);
+	left->nr_keys += right->nr_keys;
+
+	/* unlink right leaf */
+	left->leaf_node.next = right->leaf_node.next;
+	if (right->leaf_node.next)
+		right->leaf_node.next->leaf_node.prev = left;
+
+	/* remove separator and right leaf from parent */
+	keys_remove(parent->inner_node.keys, parent->nr_keys, pos);
+	memmove(&parent->inner_node.children[pos + 1], &parent->inner_node.children[pos + 2],
+		sizeof(struct bplus_node_t *) * (parent->nr_keys - pos - 1));
+	parent->nr_keys--;
+
+	node_pool_free(tree->pool, right);
+	return 1;
+}
+
+/*
+ * Rebalance an underflowing inner node, which is child pos of parent : returns 1 if parent lost a key.
+ */
+static int inner_rebalance(struct tree_t *tree, struct bplus_node_t *parent, int pos)
+{
+	struct bplus_node_t *node = parent->inner_node.children[pos], *left, *right;
+	struct bplus_node_t **children = node->inner_node.children;
+
+	/* borrow from left sibling : rotate through parent separator */
+	if (pos > 0) {
+		left = parent->inner_node.children[pos - 1];
+		if (left->nr_keys > BPLUS_INNER_MIN) {
+			keys_insert(node->inner_node.keys, node->nr_keys, BPLUS_INNER_KEYS, 0, parent->inner_node.keys[pos - 1]);
+			memmove(&children[1], &children[0], sizeof(struct bplus_node_t *) * (node->nr_keys + 1));
+			children[0] = left->inner_node.children[left->nr_keys];
+			node->nr_keys++;
+
+			parent->inner_node.keys[pos - 1] = left->inner_node.keys[left->nr_keys - 1];
+			left->inner_node.keys[--left->nr_keys] = INT_MAX;
+			return 0;
+		}
+	}
+
+	/* borrow from right sibling : rotate through parent separator */
+	if (pos < parent->nr_keys) {
+		right = parent->inner_node.children[pos + 1];
+		if (right->nr_keys > BPLUS_INNER_MIN) {
+			node->inner_node.keys[node->nr_keys] = parent->inner_node.keys[pos];
+			children[node->nr_keys + 1] = right->inner_node.children[0];
+			node->nr_keys++;
+
+			parent->inner_node.keys[pos] = right->inner_node.keys[0];
+			keys_remove(right->inner_node.keys, right->nr_keys, 0);
+			memmove(&right->inner_node.children[0], &right->inner_node.children[1],
+				sizeof(struct bplus_node_t *) * right->nr_keys);
+			right->nr_keys--;
+			return 0;
+		}
+	}
+
+	/* merge with a sibling : left keys + separator + right keys */
+	if (pos > 0) {
+		left = parent->inner_node.children[pos - 1];
+		right = node;
+		pos--;
+	} else {
+		left = node;
+		right = parent->inner_node.children[pos + 1];
+	}
+
+	left->inner_node.keys[left->nr_keys] = parent->inner_node.keys[pos];
+	memcpy(&left->inner_node.keys[left->nr_keys + 1], right->inner_node.keys, sizeof(int) * right->nr_keys);
+	memcpy(&left->inner_node.children[left->nr_keys + 1], right->inner_node.children,
+	       sizeof(struct bplus_node_t *) * (right->nr_keys + 1));
+	left->nr_keys += right->nr_keys + 1;
+
+	/* remove separator and right node from parent */
+	keys_remove(parent->inner_node.keys, parent->nr_keys, pos);
+	memmove(&parent->inner_node.children[pos + 1], &parent->inner_node.children[pos + 2],
+		sizeof(struct bplus_node_t *) * (parent->nr_keys - pos - 1));
+	parent->nr_keys--;
+
+	node_pool_free(tree->pool, right);
+	return 1;
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void node_delete(struct tree_t *tree, int val)
+{
+	struct {
+		struct bplus_node_t *	node;
+		int			pos;
+	} path[BPLUS_MAX_DEPTH];
+	struct bplus_node_t *node, *root;
+	int depth = 0, pos;
+
+	if (!tree->root.bplus)
+		return;
+
+	/* find leaf */
+	for (node = tree->root.bplus; !node->leaf; node = node->inner_node.children[pos]) {
+		pos = keys_count_lower(node->inner_node.keys, BPLUS_INNER_KEYS, val);
+		path[depth].node = node;
+		path[depth++].pos = pos;
+	}
+
+	/* value not in tree */
+	pos = keys_count_lower(node->leaf_node.keys, BPLUS_LEAF_KEYS, val);
+	if (pos >= node->nr_keys || node->leaf_node.keys[pos] != val)
+		return;
+
+	/* remove value */
+	keys_remove(node->leaf_node.keys, node->nr_keys--, pos);
+	tree->size--;
+
+	/* root leaf : free it once empty */
+	if (depth == 0) {
+		if (node->nr_keys == 0) {
+			node_pool_free(tree->pool, node);
+			tree->root.bplus = NULL;
+		}
+
+		return;
+	}
+
+	/* rebalance leaf */
+	if (node->nr_keys >= BPLUS_LEAF_MIN)
+		return;
+	depth--;
+	if (!leaf_rebalance(tree, path[depth].node, path[depth].pos))
+		return;
+
+	/* rebalance inner nodes */
+	while (depth > 0 && path[depth].node->nr_keys < BPLUS_INNER_MIN) {
+		depth--;
+		if (!inner_rebalance(tree, path[depth].node, path[depth].pos))
+			return;
+	}
+
+	/* root lost its last key : its only child becomes the root */
+	root = tree->root.bplus;
+	if (root->nr_keys == 0) {
+		tree->root.bplus = root->inner_node.children[0];
+		node_pool_free(tree->pool, root);
+	}
+}
+
+/*
+ * Read values from an array (argument is the array cursor).
+ */
+static int keys_read(void *arg, int *keys, size_t n)
+{
+	const int **cursor = (const int **) arg;
+
+	memcpy(keys, *cursor, sizeof(int) * n);
+	*cursor += n;
+	return 0;
+}
+
+/*
+ * Build a tree from n sorted values pulled from a reader, level by level.
+ */
+static struct bplus_node_t *node_build(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct bplus_node_t **nodes, *node, *prev = NULL;
+	size_t nr_nodes, nr_parents, i, j, k, count;
+	int *max_keys;
+
+	/* allocate a node array and a maximum keys array for each level */
+	nr_nodes = (n + BPLUS_LEAF_KEYS - 1) / BPLUS_LEAF_KEYS;
+	nodes = (struct bplus_node_t **) malloc(sizeof(struct bplus_node_t *) * nr_nodes);
+	max_keys = (int *) malloc(sizeof(int) * nr_nodes);
+	if (!nodes || !max_keys) {
+		node = NULL;
+		goto out;
+	}
+
+	/* build leaves : spread values evenly so that every leaf is at least half full */
+	for (i = 0; i < nr_nodes; i++) {
+		node = node_create(tree, 1);
+		if (!node)
+			goto out;
+
+		count = n / nr_nodes + (i < n % nr_nodes);
+		if (read(arg, node->leaf_node.keys, count)) {
+			node = NULL;
+			goto out;
+		}
+		node->nr_keys = count;
+
+		/* link leaves */
+		node->leaf_node.prev = prev;
+		if (prev)
+			prev->leaf_node.next = node;
+		prev = node;
+
+		nodes[i] = node;
+		max_keys[i] = node->leaf_node.keys[count - 1];
+	}
+
+	/* build inner levels */
+	while (nr_nodes > 1) {
+		nr_parents = (nr_nodes + BPLUS_INNER_KEYS) / (BPLUS_INNER_KEYS + 1);
+
+		for (i = 0, k = 0; i < nr_parents; i++) {
+			node = node_create(tree, 0);
+			if (!node)
+				goto out;
+
+			/* add children : separators are maximum keys of children, except last one */
+			count = nr_nodes / nr_parents + (i < nr_nodes % nr_parents);
+			for (j = 0; j < count; j++) {
+				node->inner_node.children[j] = nodes[k + j];
+				if (j + 1 < count)
+					node->inner_node.keys[j] = max_keys[k + j];
+			}
+			node->nr_keys = count - 1;
+			k += count;
+
+			nodes[i] = node;
+			max_keys[i] = max_keys[k - 1];
+		}
+
+		nr_nodes = nr_parents;
+	}
+
+	node = nodes[0];
+out:
+	free(max_keys);
+	free(nodes);
+	return node;
+}
+
+/*
+ * Init a tree.
+ */
+static int tree_init(struct tree_t *tree)
+{
+	if (!tree)
+		return -1;
+
+	/* create node pool */
+	tree->pool = node_pool_create(sizeof(struct bplus_node_t));
+	if (!tree->pool)
+		return -1;
+
+	tree->size = 0;
+	tree->root.bplus = NULL;
+
+	return 0;
+}
+
+/*
+ * Free a tree.
+ */
+static void tree_free(struct tree_t *tree)
+{
+	if (!tree)
+		return;
+
+	/* release all nodes at once */
+	node_pool_destroy(tree->pool);
+	free(tree);
+}
+
+/*
+ * Compute a tree height (number of levels).
+ */
+static int tree_height(struct tree_t *tree)
+{
+	struct bplus_node_t *node;
+	int height = 0;
+
+	if (!tree)
+		return 0;
+
+	for (node = tree->root.bplus; node != NULL; node = node->leaf ? NULL : node->inner_node.children[0])
+		height++;
+
+	return height;
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	struct bplus_node_t *leaf = tree ? node_first_leaf(tree->root.bplus) : NULL;
+
+	if (!leaf)
+		return 0;
+
+	*val = leaf->leaf_node.keys[0];
+	return 1;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	struct bplus_node_t *leaf = tree ? node_last_leaf(tree->root.bplus) : NULL;
+
+	if (!leaf)
+		return 0;
+
+	*val = leaf->leaf_node.keys[leaf->nr_keys - 1];
+	return 1;
+}
+
+/*
+ * Find a node in a tree.
+ */
+static int tree_find(struct tree_t *tree, int val)
+{
+	struct bplus_node_t *leaf;
+	int pos;
+
+	if (!tree)
+		return 0;
+
+	leaf = node_find_leaf(tree->root.bplus, val);
+	if (!leaf)
+		return 0;
+
+	pos = keys_count_lower(leaf->leaf_node.keys, BPLUS_LEAF_KEYS, val);
+	return pos < leaf->nr_keys && leaf->leaf_node.keys[pos] == val;
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void tree_insert(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return;
+
+	node_insert(tree, val);
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void tree_delete(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return;
+
+	node_delete(tree, val);
+}
+
+/*
+ * Balance a tree.
+ */
+static void tree_balance(struct tree_t *tree)
+{
+	/* nothing to do : B+ trees are always balanced */
+	UNUSED(tree);
+}
+
+/*
+ * Load values in a tree : leaves are filled from sorted values, then inner levels are built on top of them.
+ */
+static int tree_bulk_load(struct tree_t *tree, const int *keys, size_t n)
+{
+	struct node_pool_t *pool, *old_pool;
+	int *sorted, *merged, *old_keys;
+	size_t nr_old;
+	struct bplus_node_t *root;
+	const int *cursor;
+
+	if (!tree)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* sort and deduplicate values */
+	sorted = tree_sort_keys(keys, &n);
+	if (!sorted)
+		return -1;
+
+	/* merge with values already in the tree */
+	if (tree->size > 0) {
+		old_keys = (int *) malloc(sizeof(int) * tree->size);
+		if (!old_keys)
+			goto err;
+
+		nr_old = node_keys(tree->root.bplus, old_keys, tree->size);
+		merged = tree_merge_keys(sorted, n, old_keys, nr_old, &n);
+		free(old_keys);
+		if (!merged)
+			goto err;
+
+		free(sorted);
+		sorted = merged;
+	}
+
+	/* too many values */
+	if (n > INT_MAX)
+		goto err;
+
+	/* build tree in a fresh pool, so that nodes are packed */
+	pool = node_pool_create(sizeof(struct bplus_node_t));
+	if (!pool)
+		goto err;
+	old_pool = tree->pool;
+	tree->pool = pool;
+	cursor = sorted;
+	root = node_build(tree, n, keys_read, &cursor);
+	if (!root) {
+		tree->pool = old_pool;
+		node_pool_destroy(pool);
+		goto err;
+	}
+
+	/* release old nodes */
+	node_pool_destroy(old_pool);
+
+	/* set tree */
+	tree->root.bplus = root;
+	tree->size = n;
+
+	free(sorted);
+	return 0;
+err:
+	free(sorted);
+	return -1;
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : leaves are filled as values come.
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct bplus_node_t *root;
+
+	if (!tree || tree->size > 0 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* nodes of a failed load stay in pool until tree is freed */
+	root = node_build(tree, n, read, arg);
+	if (!root)
+		return -1;
+
+	/* set tree */
+	tree->root.bplus = root;
+	tree->size = n;
+
+	return 0;
+}
+
+/*
+ * Store values of a tree in order (at most cap values). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	if (!tree)
+		return 0;
+
+	return node_keys(tree->root.bplus, keys, cap);
+}
+
+/*
+ * Set iterator current leaf and position (linked leaves replace the path).
+ */
+static int iter_set(struct tree_iter_t *iter, struct bplus_node_t *leaf, int pos, int state)
+{
+	/* step over leaf boundaries */
+	if (leaf && pos >= leaf->nr_keys) {
+		leaf = leaf->leaf_node.next;
+		pos = 0;
+	} else if (leaf && pos < 0) {
+		leaf = leaf->leaf_node.prev;
+		pos = leaf ? leaf->nr_keys - 1 : 0;
+	}
+
+	if (!leaf || leaf->nr_keys == 0) {
+		tree_iter_reset(iter, state);
+		return 0;
+	}
+
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	tree_iter_push(iter, leaf);
+	iter->pos = pos;
+	iter->val = leaf->leaf_node.keys[pos];
+	return 1;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	struct bplus_node_t *leaf;
+
+	if (!iter || !tree)
+		return 0;
+
+	leaf = node_find_leaf(tree->root.bplus, val);
+	iter->tree = tree;
+	return iter_set(iter, leaf, leaf ? keys_count_lower(leaf->leaf_node.keys, BPLUS_LEAF_KEYS, val) : 0,
+			TREE_ITER_END);
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+	if (iter->state == TREE_ITER_BEGIN)
+		return iter_set(iter, node_first_leaf(iter->tree->root.bplus), 0, TREE_ITER_END);
+
+	return iter_set(iter, (struct bplus_node_t *) tree_iter_peek(iter), iter->pos + 1, TREE_ITER_END);
+}
+
+/*
+ * Move an iterator to previous value.
+ */
+static int tree_prev(struct tree_iter_t *iter)
+{
+	struct bplus_node_t *leaf;
+
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+	if (iter->state == TREE_ITER_END) {
+		leaf = node_last_leaf(iter->tree->root.bplus);
+		return iter_set(iter, leaf, leaf ? leaf->nr_keys - 1 : 0, TREE_ITER_BEGIN);
+	}
+
+	return iter_set(iter, (struct bplus_node_t *) tree_iter_peek(iter), iter->pos - 1, TREE_ITER_BEGIN);
+}
+
+/*
+ * B+ tree operations.
+ */
+struct tree_operations_t bplus_tree_ops = {
+	.init			= tree_init,
+	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
+	.find			= tree_find,
+	.insert			= tree_insert,
+	.delete			= tree_delete,
+	.balance		= tree_balance,
+	.bulk_load		= tree_bulk_load,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.free			= tree_free,
+};
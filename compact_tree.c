@@ -0,0 +1,1103 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tree.h"
+
+/*
+ * Array reader (bulk loads).
+ */
+struct compact_keys_t {
+	const int *			keys;
+	size_t				pos;
+};
+
+/*
+ * Get a node from its index.
+ */
+static inline struct compact_node_t *node_at(struct compact_tree_t *ct, uint32_t off)
+{
+	return &ct->nodes[off];
+}
+
+/*
+ * Get left child index.
+ */
+static inline uint32_t node_left(struct compact_node_t *node)
+{
+	return node->left & COMPACT_TREE_INDEX_MASK;
+}
+
+/*
+ * Get right child index.
+ */
+static inline uint32_t node_right(struct compact_node_t *node)
+{
+	return node->right & COMPACT_TREE_INDEX_MASK;
+}
+
+/*
+ * Set left child index (balance is kept).
+ */
+static inline void node_set_left(struct compact_node_t *node, uint32_t off)
+{
+	node->left = (node->left & COMPACT_TREE_HEAVY) | off;
+}
+
+/*
+ * Set right child index (balance is kept).
+ */
+static inline void node_set_right(struct compact_node_t *node, uint32_t off)
+{
+	node->right = (node->right & COMPACT_TREE_HEAVY) | off;
+}
+
+/*
+ * Get node balance (height of right child - height of left child, from -1 to 1).
+ */
+static inline int node_balance(struct compact_node_t *node)
+{
+	return (int) (node->right >> 31) - (int) (node->left >> 31);
+}
+
+/*
+ * Set node balance.
+ */
+static inline void node_set_balance(struct compact_node_t *node, int balance)
+{
+	node->left = node_left(node) | (balance < 0 ? COMPACT_TREE_HEAVY : 0);
+	node->right = node_right(node) | (balance > 0 ? COMPACT_TREE_HEAVY : 0);
+}
+
+/*
+ * Grow node array so that n more nodes can be carved out of it (nodes may move, indexes don't).
+ */
+static int ct_reserve(struct compact_tree_t *ct, size_t n)
+{
+	struct compact_node_t *nodes;
+	size_t capacity;
+
+	if (ct->nr_nodes + n <= ct->capacity)
+		return 0;
+
+	/* grow by half, so that at most a third of the array is unused */
+	capacity = ct->capacity + ct->capacity / 2;
+	if (capacity < ct->nr_nodes + n)
+		capacity = ct->nr_nodes + n;
+	if (capacity < COMPACT_TREE_MIN_NODES)
+		capacity = COMPACT_TREE_MIN_NODES;
+	if (capacity > COMPACT_TREE_MAX_NODES)
+		capacity = COMPACT_TREE_MAX_NODES;
+	if (ct->nr_nodes + n > capacity)
+		return -1;
+
+	nodes = (struct compact_node_t *) realloc(ct->nodes, capacity * sizeof(struct compact_node_t));
+	if (!nodes)
+		return -1;
+
+	ct->nodes = nodes;
+	ct->capacity = capacity;
+	return 0;
+}
+
+/*
+ * Drop all nodes (node array is kept).
+ */
+static void ct_reset(struct compact_tree_t *ct)
+{
+	ct->root = 0;
+	ct->free_list = 0;
+	ct->nr_nodes = 1;
+}
+
+/*
+ * Create a node (a node must have been reserved).
+ */
+static uint32_t node_create(struct compact_tree_t *ct, int val)
+{
+	struct compact_node_t *node;
+	uint32_t off;
+
+	/* reuse a freed node or carve a new one */
+	if (ct->free_list) {
+		off = ct->free_list;
+		ct->free_list = node_at(ct, off)->left;
+	} else {
+		off = ct->nr_nodes++;
+	}
+
+	/* set node */
+	node = node_at(ct, off);
+	node->val = val;
+	node->left = 0;
+	node->right = 0;
+
+	return off;
+}
+
+/*
+ * Free a node (it is chained in free list through its left link).
+ */
+static void node_free(struct compact_tree_t *ct, uint32_t off)
+{
+	node_at(ct, off)->left = ct->free_list;
+	ct->free_list = off;
+}
+
+/*
+ * Find a node.
+ */
+static uint32_t node_find(struct compact_tree_t *ct, int val)
+{
+	struct compact_node_t *node;
+	uint32_t off = ct->root;
+
+	while (off) {
+		node = node_at(ct, off);
+		if (val < node->val)
+			off = node_left(node);
+		else if (val > node->val)
+			off = node_right(node);
+		else
+			break;
+	}
+
+	return off;
+}
+
+/*
+ * Compute a node height (Morris traversal : threads are set and removed on the fly, no stack is used).
+ */
+static int node_height(struct compact_tree_t *ct, uint32_t off)
+{
+	struct compact_node_t *node, *pre;
+	int depth = 0, height = 0, steps;
+
+	while (off) {
+		node = node_at(ct, off);
+
+		/* no left child : visit node and go right */
+		if (!node_left(node)) {
+			height = max(height, depth + 1);
+			off = node_right(node);
+			depth++;
+			continue;
+		}
+
+		/* find in order predecessor */
+		for (pre = node_at(ct, node_left(node)), steps = 1; node_right(pre) && node_right(pre) != off; steps++)
+			pre = node_at(ct, node_right(pre));
+
+		/* first visit : thread predecessor to this node and go left */
+		if (!node_right(pre)) {
+			node_set_right(pre, off);
+			off = node_left(node);
+			depth++;
+			continue;
+		}
+
+		/* second visit (we came back through the thread) : fix depth, remove thread and go right */
+		depth -= steps + 1;
+		node_set_right(pre, 0);
+		height = max(height, depth + 1);
+		off = node_right(node);
+		depth++;
+	}
+
+	return height;
+}
+
+/*
+ * Store values of a node in order, at most cap values (Morris traversal : the walk always ends, so
+ * that threads are removed). Returns number of values stored.
+ */
+static size_t node_keys(struct compact_tree_t *ct, uint32_t off, int *keys, size_t cap)
+{
+	struct compact_node_t *node, *pre;
+	size_t n = 0;
+
+	while (off) {
+		node = node_at(ct, off);
+
+		/* no left child : store value and go right */
+		if (!node_left(node)) {
+			if (n < cap)
+				keys[n++] = node->val;
+			off = node_right(node);
+			continue;
+		}
+
+		/* find in order predecessor */
+		for (pre = node_at(ct, node_left(node)); node_right(pre) && node_right(pre) != off;)
+			pre = node_at(ct, node_right(pre));
+
+		/* first visit : thread predecessor to this node and go left */
+		if (!node_right(pre)) {
+			node_set_right(pre, off);
+			off = node_left(node);
+			continue;
+		}
+
+		/* second visit : remove thread, store value and go right */
+		node_set_right(pre, 0);
+		if (n < cap)
+			keys[n++] = node->val;
+		off = node_right(node);
+	}
+
+	return n;
+}
+
+/*
+ * Right rotate subtree rooted with y (balances are set by caller).
+ */
+static uint32_t right_rotate(struct compact_tree_t *ct, uint32_t y)
+{
+	uint32_t x = node_left(node_at(ct, y));
+
+	node_set_left(node_at(ct, y), node_right(node_at(ct, x)));
+	node_set_right(node_at(ct, x), y);
+
+	return x;
+}
+
+/*
+ * Left rotate subtree rooted with x (balances are set by caller).
+ */
+static uint32_t left_rotate(struct compact_tree_t *ct, uint32_t x)
+{
+	uint32_t y = node_right(node_at(ct, x));
+
+	node_set_right(node_at(ct, x), node_left(node_at(ct, y)));
+	node_set_left(node_at(ct, y), x);
+
+	return y;
+}
+
+/*
+ * Restore balance of a node whose balance reached -2 or 2 (it can't be stored, so it is passed).
+ * Shrunk is set if subtree height decreased (always, except on a single rotation over a balanced child).
+ */
+static uint32_t node_fix(struct compact_tree_t *ct, uint32_t off, int balance, int *shrunk)
+{
+	struct compact_node_t *node = node_at(ct, off), *child, *grandchild;
+	int child_balance, grandchild_balance;
+	uint32_t root;
+
+	*shrunk = 1;
+
+	/* left heavy */
+	if (balance < 0) {
+		child = node_at(ct, node_left(node));
+		child_balance = node_balance(child);
+
+		/* left left case */
+		if (child_balance <= 0) {
+			root = right_rotate(ct, off);
+			if (child_balance == 0) {
+				node_set_balance(node, -1);
+				node_set_balance(child, 1);
+				*shrunk = 0;
+			} else {
+				node_set_balance(node, 0);
+				node_set_balance(child, 0);
+			}
+
+			return root;
+		}
+
+		/* left right case */
+		grandchild = node_at(ct, node_right(child));
+		grandchild_balance = node_balance(grandchild);
+		node_set_left(node, left_rotate(ct, node_left(node)));
+		root = right_rotate(ct, off);
+		node_set_balance(node, grandchild_balance < 0 ? 1 : 0);
+		node_set_balance(child, grandchild_balance > 0 ? -1 : 0);
+		node_set_balance(grandchild, 0);
+
+		return root;
+	}
+
+	/* right heavy */
+	child = node_at(ct, node_right(node));
+	child_balance = node_balance(child);
+
+	/* right right case */
+	if (child_balance >= 0) {
+		root = left_rotate(ct, off);
+		if (child_balance == 0) {
+			node_set_balance(node, 1);
+			node_set_balance(child, -1);
+			*shrunk = 0;
+		} else {
+			node_set_balance(node, 0);
+			node_set_balance(child, 0);
+		}
+
+		return root;
+	}
+
+	/* right left case */
+	grandchild = node_at(ct, node_left(child));
+	grandchild_balance = node_balance(grandchild);
+	node_set_right(node, right_rotate(ct, node_right(node)));
+	root = left_rotate(ct, off);
+	node_set_balance(node, grandchild_balance > 0 ? -1 : 0);
+	node_set_balance(child, grandchild_balance < 0 ? 1 : 0);
+	node_set_balance(grandchild, 0);
+
+	return root;
+}
+
+/*
+ * Insert a value in an AVL node (a node must have been reserved). Grown is set if subtree height increased.
+ */
+static uint32_t node_avl_insert(struct tree_t *tree, uint32_t off, int val, int *grown)
+{
+	struct compact_tree_t *ct = tree->root.compact;
+	struct compact_node_t *node;
+	int balance, shrunk;
+
+	/* leaf : insert node */
+	if (!off) {
+		tree->size++;
+		*grown = 1;
+		return node_create(ct, val);
+	}
+
+	/* find subtree */
+	node = node_at(ct, off);
+	if (val < node->val) {
+		node_set_left(node, node_avl_insert(tree, node_left(node), val, grown));
+		balance = node_balance(node) - 1;
+	} else if (val > node->val) {
+		node_set_right(node, node_avl_insert(tree, node_right(node), val, grown));
+		balance = node_balance(node) + 1;
+	} else {
+		*grown = 0;
+		return off;
+	}
+
+	/* child height didn't change */
+	if (!*grown)
+		return off;
+
+	/* a rotation after an insertion restores subtree height */
+	if (balance < -1 || balance > 1) {
+		*grown = 0;
+		return node_fix(ct, off, balance, &shrunk);
+	}
+
+	/* subtree grew only if it was balanced */
+	node_set_balance(node, balance);
+	*grown = balance != 0;
+
+	return off;
+}
+
+/*
+ * Delete a value in an AVL node. Shrunk is set if subtree height decreased.
+ */
+static uint32_t node_avl_delete(struct tree_t *tree, uint32_t off, int val, int *shrunk)
+{
+	struct compact_tree_t *ct = tree->root.compact;
+	struct compact_node_t *node, *min;
+	uint32_t child;
+	int balance;
+
+	if (!off) {
+		*shrunk = 0;
+		return 0;
+	}
+
+	node = node_at(ct, off);
+
+	/* delete in left child */
+	if (val < node->val) {
+		node_set_left(node, node_avl_delete(tree, node_left(node), val, shrunk));
+		balance = node_balance(node) + 1;
+	/* delete in right child */
+	} else if (val > node->val) {
+		node_set_right(node, node_avl_delete(tree, node_right(node), val, shrunk));
+		balance = node_balance(node) - 1;
+	/* only one child or no child : replace this node with it */
+	} else if (!node_left(node) || !node_right(node)) {
+		child = node_left(node) ? node_left(node) : node_right(node);
+		node_free(ct, off);
+		tree->size--;
+		*shrunk = 1;
+		return child;
+	/* set this node with minimum value of right child, and delete it there */
+	} else {
+		for (min = node_at(ct, node_right(node)); node_left(min);)
+			min = node_at(ct, node_left(min));
+
+		node->val = min->val;
+		node_set_right(node, node_avl_delete(tree, node_right(node), node->val, shrunk));
+		balance = node_balance(node) - 1;
+	}
+
+	/* child height didn't change */
+	if (!*shrunk)
+		return off;
+
+	/* too unbalanced : rotate */
+	if (balance < -1 || balance > 1)
+		return node_fix(ct, off, balance, shrunk);
+
+	/* subtree shrunk only if it is balanced now */
+	node_set_balance(node, balance);
+	*shrunk = balance == 0;
+
+	return off;
+}
+
+/*
+ * Insert a value in a binary tree (a node must have been reserved).
+ */
+static void node_binary_insert(struct tree_t *tree, int val)
+{
+	struct compact_tree_t *ct = tree->root.compact;
+	struct compact_node_t *node;
+	uint32_t *link = &ct->root;
+	int depth = 1;
+
+	/* find leaf link */
+	while (*link) {
+		node = node_at(ct, *link);
+		if (val < node->val)
+			link = &node->left;
+		else if (val > node->val)
+			link = &node->right;
+		else
+			return;
+
+		depth++;
+	}
+
+	*link = node_create(ct, val);
+	tree->size++;
+	if (tree->height != TREE_HEIGHT_UNKNOWN)
+		tree->height = max(tree->height, depth);
+}
+
+/*
+ * Delete a value in a binary tree.
+ */
+static void node_binary_delete(struct tree_t *tree, int val)
+{
+	struct compact_tree_t *ct = tree->root.compact;
+	struct compact_node_t *node;
+	uint32_t *link = &ct->root, *min_link, off;
+
+	/* find node link */
+	for (;;) {
+		if (!*link)
+			return;
+
+		node = node_at(ct, *link);
+		if (val < node->val)
+			link = &node->left;
+		else if (val > node->val)
+			link = &node->right;
+		else
+			break;
+	}
+
+	/* two children : move minimum value of right child here and delete minimum node instead */
+	if (node->left && node->right) {
+		for (min_link = &node->right; node_at(ct, *min_link)->left;)
+			min_link = &node_at(ct, *min_link)->left;
+
+		node->val = node_at(ct, *min_link)->val;
+		link = min_link;
+		node = node_at(ct, *link);
+	}
+
+	/* only one child or no child : replace this node with this child */
+	off = *link;
+	*link = node->left ? node->left : node->right;
+	node_free(ct, off);
+	tree->size--;
+
+	/* a subtree moved up : height may have shrunk, it will be recomputed on demand */
+	tree->height = TREE_HEIGHT_UNKNOWN;
+}
+
+/*
+ * Build a balanced node from n sorted values pulled from a reader (nodes are allocated in pre order,
+ * n nodes must have been reserved). Right subtree is never lower than left subtree.
+ */
+static uint32_t node_build(struct compact_tree_t *ct, size_t n, int avl, int (*read)(void *, int *, size_t),
+			   void *arg, int *err)
+{
+	uint32_t off, left, right;
+	size_t nr_left;
+	int val = 0;
+
+	if (n == 0 || *err)
+		return 0;
+
+	nr_left = (n - 1) / 2;
+	off = node_create(ct, 0);
+	left = node_build(ct, nr_left, avl, read, arg, err);
+	if (!*err && read(arg, &val, 1))
+		*err = 1;
+	right = node_build(ct, n - 1 - nr_left, avl, read, arg, err);
+
+	node_at(ct, off)->val = val;
+	node_at(ct, off)->left = left;
+	node_at(ct, off)->right = right;
+	if (avl)
+		node_set_balance(node_at(ct, off), tree_balanced_height(n - 1 - nr_left) - tree_balanced_height(nr_left));
+
+	return off;
+}
+
+/*
+ * Rebuild a tree from n sorted distinct values pulled from a reader (nodes are packed at the start of
+ * the array, in pre order).
+ */
+static int ct_build(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct compact_tree_t *ct = tree->root.compact;
+	uint32_t root;
+	int err = 0;
+
+	ct_reset(ct);
+	tree->size = 0;
+	tree->height = 0;
+	if (ct_reserve(ct, n))
+		return -1;
+
+	root = node_build(ct, n, tree->type == TREE_TYPE_COMPACT_AVL, read, arg, &err);
+	if (err) {
+		ct_reset(ct);
+		return -1;
+	}
+
+	ct->root = root;
+	tree->size = n;
+	tree->height = tree_balanced_height(n);
+
+	return 0;
+}
+
+/*
+ * Array reader.
+ */
+static int keys_read(void *arg, int *keys, size_t n)
+{
+	struct compact_keys_t *reader = (struct compact_keys_t *) arg;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		keys[i] = reader->keys[reader->pos++];
+
+	return 0;
+}
+
+/*
+ * Init a tree.
+ */
+static int tree_init(struct tree_t *tree)
+{
+	struct compact_tree_t *ct;
+
+	if (!tree)
+		return -1;
+
+	ct = (struct compact_tree_t *) malloc(sizeof(struct compact_tree_t));
+	if (!ct)
+		return -1;
+
+	/* index 0 is no node */
+	ct->nodes = NULL;
+	ct->capacity = 0;
+	ct_reset(ct);
+
+	tree->root.compact = ct;
+	tree->pool = NULL;
+	tree->size = 0;
+	tree->height = 0;
+	tree->balance_mode = TREE_BALANCE_ARRAY;
+
+	return 0;
+}
+
+/*
+ * Free a tree.
+ */
+static void tree_free(struct tree_t *tree)
+{
+	if (!tree)
+		return;
+
+	free(tree->root.compact->nodes);
+	free(tree->root.compact);
+	free(tree);
+}
+
+/*
+ * Compute a tree height.
+ */
+static int tree_height(struct tree_t *tree)
+{
+	struct compact_tree_t *ct;
+	struct compact_node_t *node;
+	uint32_t off;
+	int height = 0;
+
+	if (!tree)
+		return 0;
+
+	ct = tree->root.compact;
+
+	/* AVL : follow higher children */
+	if (tree->type == TREE_TYPE_COMPACT_AVL) {
+		for (off = ct->root; off; height++) {
+			node = node_at(ct, off);
+			off = node_balance(node) > 0 ? node_right(node) : node_left(node);
+		}
+
+		return height;
+	}
+
+	/* recompute height if needed */
+	if (tree->height == TREE_HEIGHT_UNKNOWN)
+		tree->height = node_height(ct, ct->root);
+
+	return tree->height;
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	struct compact_tree_t *ct;
+	uint32_t off;
+
+	if (!tree)
+		return 0;
+
+	ct = tree->root.compact;
+	if (!(off = ct->root))
+		return 0;
+
+	for (; node_left(node_at(ct, off));)
+		off = node_left(node_at(ct, off));
+
+	*val = node_at(ct, off)->val;
+	return 1;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	struct compact_tree_t *ct;
+	uint32_t off;
+
+	if (!tree)
+		return 0;
+
+	ct = tree->root.compact;
+	if (!(off = ct->root))
+		return 0;
+
+	for (; node_right(node_at(ct, off));)
+		off = node_right(node_at(ct, off));
+
+	*val = node_at(ct, off)->val;
+	return 1;
+}
+
+/*
+ * Find a node in a tree.
+ */
+static int tree_find(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return 0;
+
+	return node_find(tree->root.compact, val) != 0;
+}
+
+/*
+ * Find n values in a tree : TREE_FIND_MANY_GROUP searches advance in turn and prefetch their next node.
+ */
+static void tree_find_interleaved(struct tree_t *tree, const int *keys, size_t n, uint8_t *out)
+{
+	uint32_t offs[TREE_FIND_MANY_GROUP], off, root;
+	size_t pos[TREE_FIND_MANY_GROUP], next;
+	int nr_active, i, key, val;
+	struct compact_tree_t *ct;
+
+	if (!tree)
+		return;
+
+	ct = tree->root.compact;
+	root = ct->root;
+
+	/* start first searches */
+	for (nr_active = 0, next = 0; nr_active < TREE_FIND_MANY_GROUP && next < n; nr_active++, next++) {
+		offs[nr_active] = root;
+		pos[nr_active] = next;
+	}
+
+	while (nr_active > 0) {
+		for (i = 0; i < nr_active; i++) {
+			off = offs[i];
+			key = keys[pos[i]];
+
+			/* one step down */
+			if (off) {
+				val = node_at(ct, off)->val;
+				if (key != val) {
+					off = key < val ? node_left(node_at(ct, off)) : node_right(node_at(ct, off));
+					__builtin_prefetch(node_at(ct, off));
+					offs[i] = off;
+					continue;
+				}
+			}
+
+			/* search done : start next one, or drop this slot */
+			out[pos[i]] = off != 0;
+			if (next < n) {
+				offs[i] = root;
+				pos[i] = next++;
+			} else {
+				nr_active--;
+				offs[i] = offs[nr_active];
+				pos[i] = pos[nr_active];
+				i--;
+			}
+		}
+	}
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void tree_insert(struct tree_t *tree, int val)
+{
+	struct compact_tree_t *ct;
+	int grown;
+
+	if (!tree)
+		return;
+
+	/* grow before descending : node pointers stay valid during insertion */
+	ct = tree->root.compact;
+	if (!ct->free_list && ct_reserve(ct, 1))
+		return;
+
+	if (tree->type == TREE_TYPE_COMPACT_AVL)
+		ct->root = node_avl_insert(tree, ct->root, val, &grown);
+	else
+		node_binary_insert(tree, val);
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void tree_delete(struct tree_t *tree, int val)
+{
+	struct compact_tree_t *ct;
+	int shrunk;
+
+	if (!tree)
+		return;
+
+	ct = tree->root.compact;
+	if (tree->type == TREE_TYPE_COMPACT_AVL)
+		ct->root = node_avl_delete(tree, ct->root, val, &shrunk);
+	else
+		node_binary_delete(tree, val);
+}
+
+/*
+ * Balance a tree : values are saved in an array and the tree is rebuilt, packed.
+ */
+static void tree_balance(struct tree_t *tree)
+{
+	struct compact_keys_t reader;
+	int *keys;
+
+	/* nothing to do : AVL trees are always balanced */
+	if (!tree || tree->type == TREE_TYPE_COMPACT_AVL || tree->size <= 2)
+		return;
+
+	keys = (int *) malloc(sizeof(int) * tree->size);
+	if (!keys)
+		return;
+
+	node_keys(tree->root.compact, tree->root.compact->root, keys, tree->size);
+	reader.keys = keys;
+	reader.pos = 0;
+	ct_build(tree, tree->size, keys_read, &reader);
+
+	free(keys);
+}
+
+/*
+ * Load values in a tree : a balanced tree is rebuilt from scratch in O(n) once values are sorted.
+ */
+static int tree_bulk_load(struct tree_t *tree, const int *keys, size_t n)
+{
+	struct compact_keys_t reader;
+	int *sorted, *merged, *old_keys;
+	size_t nr_old;
+	int ret = -1;
+
+	if (!tree)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* sort and deduplicate values */
+	sorted = tree_sort_keys(keys, &n);
+	if (!sorted)
+		return -1;
+
+	/* merge with values already in the tree */
+	if (tree->size > 0) {
+		old_keys = (int *) malloc(sizeof(int) * tree->size);
+		if (!old_keys)
+			goto out;
+
+		nr_old = node_keys(tree->root.compact, tree->root.compact->root, old_keys, tree->size);
+		merged = tree_merge_keys(sorted, n, old_keys, nr_old, &n);
+		free(old_keys);
+		if (!merged)
+			goto out;
+
+		free(sorted);
+		sorted = merged;
+	}
+
+	/* too many values */
+	if (n > COMPACT_TREE_MAX_NODES - 1 || n > INT_MAX)
+		goto out;
+
+	/* nodes are reserved before old ones are dropped, so that a failed load leaves tree as is */
+	if (ct_reserve(tree->root.compact, n))
+		goto out;
+
+	reader.keys = sorted;
+	reader.pos = 0;
+	ret = ct_build(tree, n, keys_read, &reader);
+out:
+	free(sorted);
+	return ret;
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : a balanced tree is built in O(n).
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	if (!tree || tree->size > 0 || n > COMPACT_TREE_MAX_NODES - 1 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	return ct_build(tree, n, read, arg);
+}
+
+/*
+ * Store values of a tree in order (at most cap values). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	if (!tree)
+		return 0;
+
+	return node_keys(tree->root.compact, tree->root.compact->root, keys, cap);
+}
+
+/*
+ * Position an iterator on first value >= val (or last value <= val if backward is set).
+ * Path holds indexes : a deep binary tree may drop its oldest ancestors from the ring.
+ */
+static int iter_find(struct tree_iter_t *iter, int val, int backward)
+{
+	struct compact_tree_t *ct = iter->tree->root.compact;
+	int depth = 0, found_depth = 0;
+	struct compact_node_t *node;
+	uint32_t off, found = 0;
+
+	/* descend from root, remembering path and best candidate */
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	for (off = ct->root; off;) {
+		tree_iter_push(iter, (void *) (uintptr_t) off);
+		node = node_at(ct, off);
+		depth++;
+
+		if (node->val == val || (val < node->val) != backward) {
+			found = off;
+			found_depth = depth;
+		}
+
+		if (node->val == val)
+			break;
+
+		off = val < node->val ? node_left(node) : node_right(node);
+	}
+
+	/* no such value */
+	if (!found) {
+		tree_iter_reset(iter, backward ? TREE_ITER_BEGIN : TREE_ITER_END);
+		return 0;
+	}
+
+	/* climb back to candidate */
+	for (; depth > found_depth && iter->depth > 0; depth--)
+		tree_iter_pop(iter);
+
+	/* candidate dropped out of path : descend again straight to it */
+	if ((uint32_t) (uintptr_t) tree_iter_peek(iter) != found) {
+		tree_iter_reset(iter, TREE_ITER_VALUE);
+		for (off = ct->root; off != found;) {
+			tree_iter_push(iter, (void *) (uintptr_t) off);
+			node = node_at(ct, off);
+			off = node_at(ct, found)->val < node->val ? node_left(node) : node_right(node);
+		}
+
+		tree_iter_push(iter, (void *) (uintptr_t) found);
+	}
+
+	iter->val = node_at(ct, found)->val;
+	return 1;
+}
+
+/*
+ * Move an iterator to next (or previous if backward is set) value.
+ */
+static int iter_step(struct tree_iter_t *iter, int backward)
+{
+	struct compact_tree_t *ct = iter->tree->root.compact;
+	struct compact_node_t *node;
+	uint32_t off, child = 0;
+
+	/* leftmost node of right child (or rightmost node of left child) */
+	node = node_at(ct, (uint32_t) (uintptr_t) tree_iter_peek(iter));
+	off = backward ? node_left(node) : node_right(node);
+	if (off) {
+		for (; off; off = backward ? node_right(node) : node_left(node)) {
+			tree_iter_push(iter, (void *) (uintptr_t) off);
+			node = node_at(ct, off);
+		}
+
+		iter->val = node->val;
+		return 1;
+	}
+
+	/* first ancestor reached from a left child (or from a right child) */
+	for (;;) {
+		child = (uint32_t) (uintptr_t) tree_iter_pop(iter);
+		off = (uint32_t) (uintptr_t) tree_iter_peek(iter);
+		if (!off)
+			break;
+
+		node = node_at(ct, off);
+		if ((backward ? node_right(node) : node_left(node)) == child) {
+			iter->val = node->val;
+			return 1;
+		}
+	}
+
+	/* climbed past remembered ancestors : seek from root */
+	if (child != ct->root && (backward ? iter->val > INT_MIN : iter->val < INT_MAX))
+		return iter_find(iter, backward ? iter->val - 1 : iter->val + 1, backward);
+
+	tree_iter_reset(iter, backward ? TREE_ITER_BEGIN : TREE_ITER_END);
+	return 0;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	if (!iter || !tree)
+		return 0;
+
+	iter->tree = tree;
+	return iter_find(iter, val, 0);
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+	if (iter->state == TREE_ITER_BEGIN)
+		return iter_find(iter, INT_MIN, 0);
+
+	return iter_step(iter, 0);
+}
+
+/*
+ * Move an iterator to previous value.
+ */
+static int tree_prev(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+	if (iter->state == TREE_ITER_END)
+		return iter_find(iter, INT_MAX, 1);
+
+	return iter_step(iter, 1);
+}
+
+/*
+ * Compact binary tree operations.
+ */
+struct tree_operations_t compact_binary_tree_ops = {
+	.init			= tree_init,
+	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
+	.find			= tree_find,
+	.find_many		= tree_find_interleaved,
+	.insert			= tree_insert,
+	.delete			= tree_delete,
+	.balance		= tree_balance,
+	.bulk_load		= tree_bulk_load,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.free			= tree_free,
+};
+
+/*
+ * Compact AVL tree operations.
+ */
+struct tree_operations_t compact_avl_tree_ops = {
+	.init			= tree_init,
+	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
+	.find			= tree_find,
+	.find_many		= tree_find_interleaved,
+	.insert			= tree_insert,
+	.delete			= tree_delete,
+	.balance		= tree_balance,
+	.bulk_load		= tree_bulk_load,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.free			= tree_free,
+};
@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <sched.h>
+
+#include "tree.h"
+
+/*
+ * Reader record (one per thread, on its own cache line).
+ */
+struct epoch_record_t {
+	unsigned long			epoch;
+	int				nesting;
+	int				in_use;
+} __attribute__((aligned(NODE_POOL_ALIGN)));
+
+static struct epoch_record_t epoch_records[EPOCH_MAX_THREADS];
+static int epoch_nr_records;
+static unsigned long epoch_global = 1;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+static __thread struct epoch_record_t *epoch_self;
+
+/*
+ * Release record of an exiting thread.
+ */
+static void epoch_thread_exit(void *arg)
+{
+	struct epoch_record_t *rec = (struct epoch_record_t *) arg;
+
+	__atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Init epoch thread key.
+ */
+static void epoch_init(void)
+{
+	pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+/*
+ * Get a record for current thread (waits for a thread to exit if all records are used).
+ */
+static struct epoch_record_t *epoch_register(void)
+{
+	struct epoch_record_t *rec;
+	int i, free_rec;
+
+	pthread_once(&epoch_once, epoch_init);
+
+	for (;;) {
+		for (i = 0; i < EPOCH_MAX_THREADS; i++) {
+			rec = &epoch_records[i];
+			free_rec = 0;
+			if (__atomic_compare_exchange_n(&rec->in_use, &free_rec, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+				goto out;
+		}
+
+		sched_yield();
+	}
+
+out:
+	/* records beyond highest used one are not scanned */
+	for (free_rec = __atomic_load_n(&epoch_nr_records, __ATOMIC_RELAXED); free_rec < i + 1;)
+		__atomic_compare_exchange_n(&epoch_nr_records, &free_rec, i + 1, 0, __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED);
+
+	rec->nesting = 0;
+	pthread_setspecific(epoch_key, rec);
+	epoch_self = rec;
+
+	return rec;
+}
+
+/*
+ * Enter a read side critical section : nodes seen inside won't be freed until it is left.
+ */
+void epoch_enter(void)
+{
+	struct epoch_record_t *rec = epoch_self;
+
+	if (!rec)
+		rec = epoch_register();
+
+	if (rec->nesting++ > 0)
+		return;
+
+	/* publish current epoch before reading anything */
+	__atomic_store_n(&rec->epoch, __atomic_load_n(&epoch_global, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Leave a read side critical section.
+ */
+void epoch_exit(void)
+{
+	struct epoch_record_t *rec = epoch_self;
+
+	if (--rec->nesting > 0)
+		return;
+
+	__atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Try to advance global epoch : all active readers must have seen current epoch.
+ */
+unsigned long epoch_advance(void)
+{
+	unsigned long global, epoch;
+	int i, nr_records;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	global = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+	nr_records = __atomic_load_n(&epoch_nr_records, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < nr_records; i++) {
+		epoch = __atomic_load_n(&epoch_records[i].epoch, __ATOMIC_ACQUIRE);
+		if (epoch && epoch != global)
+			return global;
+	}
+
+	/* another writer may have advanced it meanwhile */
+	__atomic_compare_exchange_n(&epoch_global, &global, global + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	return __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Wait until all current readers have left (must not be called inside a read side critical section).
+ */
+void epoch_synchronize(void)
+{
+	unsigned long target = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE) + 2;
+
+	while (epoch_advance() < target)
+		sched_yield();
+}
+
+/*
+ * Release all pointers of a bag.
+ */
+static void epoch_bag_release(struct epoch_bag_t *bag, void (*release)(void *, void *), void *arg)
+{
+	size_t i;
+
+	for (i = 0; i < bag->nr; i++)
+		release(arg, bag->ptrs[i]);
+
+	bag->nr = 0;
+}
+
+/*
+ * Retire a pointer : it will be released once all readers which may see it have left.
+ */
+void epoch_retire(struct epoch_limbo_t *limbo, void *ptr, void (*release)(void *, void *), void *arg)
+{
+	unsigned long global = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+	struct epoch_bag_t *bag = &limbo->bags[global % EPOCH_NR_BAGS];
+	void **ptrs;
+
+	/* bag holds pointers retired EPOCH_NR_BAGS epochs ago : they are safe now */
+	if (bag->epoch != global) {
+		epoch_bag_release(bag, release, arg);
+		bag->epoch = global;
+	}
+
+	/* grow bag */
+	if (bag->nr == bag->max) {
+		ptrs = (void **) realloc(bag->ptrs, sizeof(void *) * (bag->max ? 2 * bag->max : 64));
+
+		/* no memory : wait for readers and release pointer now */
+		if (!ptrs) {
+			epoch_synchronize();
+			release(arg, ptr);
+			return;
+		}
+
+		bag->ptrs = ptrs;
+		bag->max = bag->max ? 2 * bag->max : 64;
+	}
+
+	bag->ptrs[bag->nr++] = ptr;
+}
+
+/*
+ * Release retired pointers which are not visible to readers anymore.
+ */
+void epoch_collect(struct epoch_limbo_t *limbo, void (*release)(void *, void *), void *arg)
+{
+	unsigned long global;
+	int i;
+
+	global = epoch_advance();
+
+	for (i = 0; i < EPOCH_NR_BAGS; i++)
+		if (limbo->bags[i].nr && limbo->bags[i].epoch + 2 <= global)
+			epoch_bag_release(&limbo->bags[i], release, arg);
+}
+
+/*
+ * Forget retired pointers (their memory is released by other means) and free limbo bags.
+ */
+void epoch_limbo_free(struct epoch_limbo_t *limbo)
+{
+	int i;
+
+	for (i = 0; i < EPOCH_NR_BAGS; i++) {
+		free(limbo->bags[i].ptrs);
+		limbo->bags[i].ptrs = NULL;
+		limbo->bags[i].nr = 0;
+		limbo->bags[i].max = 0;
+	}
+}
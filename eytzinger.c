@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+ * Lines ahead are prefetched : a 64 bytes cache line holds the 16 descendants of a node, 4 levels down.
+ */
+#define EYTZINGER_PREFETCH_STRIDE	(NODE_POOL_ALIGN / sizeof(int))
+
+/*
+ * Fill a snapshot from sorted values (in order walk of the implicit tree, no recursion).
+ */
+static void eytzinger_fill(struct eytzinger_t *snap)
+{
+	size_t n = snap->size, k = 1, i;
+
+	if (n == 0)
+		return;
+
+	/* go to leftmost node */
+	while (2 * k <= n)
+		k = 2 * k;
+
+	for (i = 0; i < n; i++) {
+		snap->keys[k] = snap->sorted[i];
+
+		/* right child exists : go to its leftmost node */
+		if (2 * k + 1 <= n) {
+			k = 2 * k + 1;
+			while (2 * k <= n)
+				k = 2 * k;
+		/* else go up until we come from a left child */
+		} else {
+			k >>= __builtin_ctzl(~k) + 1;
+		}
+	}
+}
+
+/*
+ * Rebuild a snapshot from a tree (buffers are reused if large enough).
+ */
+int eytzinger_rebuild(struct eytzinger_t *snap, struct tree_t *tree)
+{
+	size_t capacity;
+	void *keys;
+	int *sorted;
+
+	if (!snap || !tree || !tree->ops->to_array)
+		return -1;
+
+	/* grow buffers if needed */
+	if ((size_t) tree->size > snap->capacity) {
+		capacity = tree->size;
+
+		/* BFS array is 1 indexed and cache aligned */
+		capacity = (capacity + EYTZINGER_PREFETCH_STRIDE) & ~(EYTZINGER_PREFETCH_STRIDE - 1);
+		if (posix_memalign(&keys, NODE_POOL_ALIGN, sizeof(int) * (capacity + 1)))
+			return -1;
+
+		sorted = (int *) malloc(sizeof(int) * capacity);
+		if (!sorted) {
+			free(keys);
+			return -1;
+		}
+
+		free(snap->keys);
+		free(snap->sorted);
+		snap->keys = (int *) keys;
+		snap->sorted = sorted;
+		snap->capacity = capacity;
+	}
+
+	/* copy tree values in BFS order (concurrent writers may change tree size meanwhile) */
+	snap->size = tree->ops->to_array(tree, snap->sorted, snap->capacity);
+	eytzinger_fill(snap);
+
+	return 0;
+}
+
+/*
+ * Create a snapshot of a tree.
+ */
+struct eytzinger_t *eytzinger_create(struct tree_t *tree)
+{
+	struct eytzinger_t *snap;
+
+	/* allocate a snapshot */
+	snap = (struct eytzinger_t *) malloc(sizeof(struct eytzinger_t));
+	if (!snap)
+		return NULL;
+
+	/* set snapshot */
+	snap->keys = NULL;
+	snap->sorted = NULL;
+	snap->size = 0;
+	snap->capacity = 0;
+
+	/* build snapshot */
+	if (eytzinger_rebuild(snap, tree)) {
+		eytzinger_free(snap);
+		return NULL;
+	}
+
+	return snap;
+}
+
+/*
+ * Free a snapshot.
+ */
+void eytzinger_free(struct eytzinger_t *snap)
+{
+	if (!snap)
+		return;
+
+	free(snap->keys);
+	free(snap->sorted);
+	free(snap);
+}
+
+/*
+ * Get index of first value greater or equal than val (0 if none) : branchless descent, 4 levels are prefetched.
+ */
+static inline size_t eytzinger_search(const struct eytzinger_t *snap, int val)
+{
+	const int *keys = snap->keys;
+	size_t k = 1, n = snap->size;
+
+	while (k <= n) {
+		__builtin_prefetch(keys + k * EYTZINGER_PREFETCH_STRIDE);
+		k = 2 * k + (keys[k] < val);
+	}
+
+	/* cancel right turns taken after last left turn */
+	return k >> __builtin_ffsl(~k);
+}
+
+/*
+ * Find a value in a snapshot.
+ */
+int eytzinger_find(const struct eytzinger_t *snap, int val)
+{
+	size_t k;
+
+	if (!snap)
+		return 0;
+
+	k = eytzinger_search(snap, val);
+	return k != 0 && snap->keys[k] == val;
+}
+
+/*
+ * Find first value greater or equal than val.
+ */
+int eytzinger_lower_bound(const struct eytzinger_t *snap, int val, int *res)
+{
+	size_t k;
+
+	if (!snap)
+		return 0;
+
+	k = eytzinger_search(snap, val);
+	if (k == 0)
+		return 0;
+
+	*res = snap->keys[k];
+	return 1;
+}
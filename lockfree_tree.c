@@ -0,0 +1,776 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "tree.h"
+
+/* sentinel keys (greater than any value) */
+#define LOCKFREE_INF0			((long long) INT_MAX + 1)
+#define LOCKFREE_INF1			((long long) INT_MAX + 2)
+#define LOCKFREE_INF2			((long long) INT_MAX + 3)
+
+/* child link bits : flagged links point to a leaf being deleted, tagged links can't change anymore */
+#define LOCKFREE_FLAG			((uintptr_t) 1)
+#define LOCKFREE_TAG			((uintptr_t) 2)
+#define LOCKFREE_MASK			(LOCKFREE_FLAG | LOCKFREE_TAG)
+
+/* retired nodes are collected every LOCKFREE_COLLECT_PERIOD retirements */
+#define LOCKFREE_COLLECT_PERIOD		256
+
+/*
+ * Seek record : last untagged edge (ancestor -> successor) above the leaf reached and its parent.
+ */
+struct lockfree_seek_t {
+	struct lockfree_node_t *	ancestor;
+	struct lockfree_node_t *	successor;
+	struct lockfree_node_t *	parent;
+	struct lockfree_node_t *	leaf;
+};
+
+/*
+ * Retired nodes of current thread (shared by all trees : nodes go back to malloc).
+ */
+static __thread struct epoch_limbo_t lockfree_limbo;
+static __thread unsigned long lockfree_nr_retired;
+static pthread_key_t lockfree_key;
+static pthread_once_t lockfree_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Release a retired node.
+ */
+static void node_release(void *arg, void *node)
+{
+	UNUSED(arg);
+	free(node);
+}
+
+/*
+ * Release retired nodes of an exiting thread.
+ */
+static void limbo_thread_exit(void *arg)
+{
+	struct epoch_limbo_t *limbo = (struct epoch_limbo_t *) arg;
+
+	epoch_synchronize();
+	epoch_collect(limbo, node_release, NULL);
+	epoch_limbo_free(limbo);
+}
+
+/*
+ * Init limbo thread key.
+ */
+static void limbo_init(void)
+{
+	pthread_key_create(&lockfree_key, limbo_thread_exit);
+}
+
+/*
+ * Retire an unlinked node : it is freed once no reader can see it.
+ */
+static void node_retire(struct lockfree_node_t *node)
+{
+	/* first retirement of this thread */
+	if (lockfree_nr_retired == 0) {
+		pthread_once(&lockfree_once, limbo_init);
+		pthread_setspecific(lockfree_key, &lockfree_limbo);
+	}
+
+	epoch_retire(&lockfree_limbo, node, node_release, NULL);
+	if (++lockfree_nr_retired % LOCKFREE_COLLECT_PERIOD == 0)
+		epoch_collect(&lockfree_limbo, node_release, NULL);
+}
+
+/*
+ * Create a node.
+ */
+static struct lockfree_node_t *node_create(long long key, uintptr_t left, uintptr_t right)
+{
+	struct lockfree_node_t *node;
+
+	node = (struct lockfree_node_t *) malloc(sizeof(struct lockfree_node_t));
+	if (!node)
+		return NULL;
+
+	node->key = key;
+	node->left = left;
+	node->right = right;
+
+	return node;
+}
+
+/*
+ * Get node of a child link.
+ */
+static inline struct lockfree_node_t *node_addr(uintptr_t link)
+{
+	return (struct lockfree_node_t *) (link & ~LOCKFREE_MASK);
+}
+
+/*
+ * Load a child link.
+ */
+static inline uintptr_t node_load(uintptr_t *link)
+{
+	return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Get child link to follow for a key (left subtree holds keys < node key).
+ */
+static inline uintptr_t *node_link(struct lockfree_node_t *node, long long key)
+{
+	return key < node->key ? &node->left : &node->right;
+}
+
+/*
+ * Is a node a leaf ? (leaves links are never set)
+ */
+static inline int node_is_leaf(struct lockfree_node_t *node)
+{
+	return node_load(&node->left) == 0;
+}
+
+/*
+ * Walk down to the leaf of a key.
+ */
+static void node_seek(struct lockfree_node_t *root, long long key, struct lockfree_seek_t *sr)
+{
+	struct lockfree_node_t *current;
+	uintptr_t parent_link, current_link;
+
+	/* root and its left child are sentinels which are never removed */
+	sr->ancestor = root;
+	sr->successor = node_addr(root->left);
+	sr->parent = sr->successor;
+	parent_link = node_load(&sr->parent->left);
+	sr->leaf = node_addr(parent_link);
+	current_link = node_load(&sr->leaf->left);
+
+	for (current = node_addr(current_link); current != NULL; current = node_addr(current_link)) {
+		/* remember last untagged edge */
+		if (!(parent_link & LOCKFREE_TAG)) {
+			sr->ancestor = sr->parent;
+			sr->successor = sr->leaf;
+		}
+
+		sr->parent = sr->leaf;
+		sr->leaf = current;
+		parent_link = current_link;
+		current_link = node_load(node_link(current, key));
+	}
+}
+
+/*
+ * Retire nodes removed by a cleanup : path from successor to parent and the leaves hanging from it.
+ */
+static void node_retire_path(struct lockfree_node_t *node, struct lockfree_node_t *parent,
+			     struct lockfree_node_t *sibling, long long key)
+{
+	struct lockfree_node_t *left, *right;
+
+	for (;;) {
+		left = node_addr(node_load(&node->left));
+		right = node_addr(node_load(&node->right));
+		node_retire(node);
+
+		/* parent : sibling was moved up */
+		if (node == parent) {
+			node_retire(left == sibling ? right : left);
+			return;
+		}
+
+		/* other nodes : off path child is a flagged leaf */
+		if (key < node->key) {
+			node_retire(right);
+			node = left;
+		} else {
+			node_retire(left);
+			node = right;
+		}
+	}
+}
+
+/*
+ * Remove a flagged leaf and its parent : tag sibling link and swing ancestor link to sibling.
+ */
+static int node_cleanup(long long key, struct lockfree_seek_t *sr)
+{
+	uintptr_t *successor_link, *child_link, *sibling_link, sibling, expected;
+
+	successor_link = node_link(sr->ancestor, key);
+	if (key < sr->parent->key) {
+		child_link = &sr->parent->left;
+		sibling_link = &sr->parent->right;
+	} else {
+		child_link = &sr->parent->right;
+		sibling_link = &sr->parent->left;
+	}
+
+	/* leaf of key is not flagged : we are helping removal of its sibling */
+	if (!(node_load(child_link) & LOCKFREE_FLAG))
+		sibling_link = child_link;
+
+	/* freeze sibling link (a flag is kept : sibling is still to be deleted) */
+	sibling = __atomic_fetch_or(sibling_link, LOCKFREE_TAG, __ATOMIC_ACQ_REL) & ~LOCKFREE_TAG;
+
+	expected = (uintptr_t) sr->successor;
+	if (!__atomic_compare_exchange_n(successor_link, &expected, sibling, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return 0;
+
+	node_retire_path(sr->successor, sr->parent, node_addr(sibling), key);
+	return 1;
+}
+
+/*
+ * Find smallest leaf >= key (NULL if none).
+ */
+static struct lockfree_node_t *node_lower_bound(struct lockfree_node_t *root, long long key)
+{
+	struct lockfree_node_t *node, *candidate = NULL;
+
+	for (node = node_addr(root->left); !node_is_leaf(node);) {
+		if (key < node->key) {
+			candidate = node_addr(node_load(&node->right));
+			node = node_addr(node_load(&node->left));
+		} else {
+			node = node_addr(node_load(&node->right));
+		}
+	}
+
+	/* leftmost leaf of last right subtree skipped */
+	if (node->key < key) {
+		if (!candidate)
+			return NULL;
+
+		for (node = candidate; !node_is_leaf(node);)
+			node = node_addr(node_load(&node->left));
+	}
+
+	return node->key < LOCKFREE_INF0 ? node : NULL;
+}
+
+/*
+ * Find greatest leaf <= key (NULL if none).
+ */
+static struct lockfree_node_t *node_upper_bound(struct lockfree_node_t *root, long long key)
+{
+	struct lockfree_node_t *node, *candidate = NULL;
+
+	for (node = node_addr(root->left); !node_is_leaf(node);) {
+		if (key < node->key) {
+			node = node_addr(node_load(&node->left));
+		} else {
+			candidate = node_addr(node_load(&node->left));
+			node = node_addr(node_load(&node->right));
+		}
+	}
+
+	/* rightmost leaf of last left subtree skipped */
+	if (node->key > key) {
+		if (!candidate)
+			return NULL;
+
+		for (node = candidate; !node_is_leaf(node);)
+			node = node_addr(node_load(&node->right));
+	}
+
+	return node->key < LOCKFREE_INF0 ? node : NULL;
+}
+
+/*
+ * Walk leaves in order and compute height (-1 if no memory). Keys of leaves are stored in keys (may
+ * be NULL), at most *nr_keys of them : *nr_keys is set to number of keys stored.
+ */
+static int node_walk(struct lockfree_node_t *node, int *keys, size_t *nr_keys)
+{
+	struct lockfree_node_t **stack = NULL, **tmp;
+	int *depths = NULL, *tmp_depths, height = 0, depth = 1;
+	size_t top = 0, size = 0, n = 0;
+
+	for (;;) {
+		/* go down left, remembering right children */
+		while (!node_is_leaf(node)) {
+			if (top == size) {
+				size = size ? 2 * size : NODE_STACK_SIZE;
+				tmp = (struct lockfree_node_t **) realloc(stack, sizeof(*stack) * size);
+				if (!tmp)
+					goto err;
+				stack = tmp;
+
+				tmp_depths = (int *) realloc(depths, sizeof(int) * size);
+				if (!tmp_depths)
+					goto err;
+				depths = tmp_depths;
+			}
+
+			stack[top] = node_addr(node_load(&node->right));
+			depths[top++] = depth + 1;
+			node = node_addr(node_load(&node->left));
+			depth++;
+		}
+
+		/* visit leaf */
+		if (node->key < LOCKFREE_INF0) {
+			if (keys && n < *nr_keys)
+				keys[n++] = (int) node->key;
+			height = max(height, depth);
+		}
+
+		if (top == 0)
+			break;
+
+		node = stack[--top];
+		depth = depths[top];
+	}
+
+	if (nr_keys)
+		*nr_keys = n;
+
+	free(stack);
+	free(depths);
+	return height;
+err:
+	free(stack);
+	free(depths);
+	return -1;
+}
+
+/*
+ * Init a tree : two sentinel inner nodes and three sentinel leaves.
+ */
+static int tree_init(struct tree_t *tree)
+{
+	struct lockfree_node_t *leaves[3], *inner;
+	int i;
+
+	if (!tree)
+		return -1;
+
+	for (i = 0; i < 3; i++) {
+		leaves[i] = node_create(LOCKFREE_INF0 + i, 0, 0);
+		if (!leaves[i])
+			goto err;
+	}
+
+	inner = node_create(LOCKFREE_INF1, (uintptr_t) leaves[0], (uintptr_t) leaves[1]);
+	if (!inner)
+		goto err;
+
+	tree->root.lockfree = node_create(LOCKFREE_INF2, (uintptr_t) inner, (uintptr_t) leaves[2]);
+	if (!tree->root.lockfree) {
+		free(inner);
+		goto err;
+	}
+
+	tree->pool = NULL;
+	tree->size = 0;
+	return 0;
+err:
+	while (--i >= 0)
+		free(leaves[i]);
+	return -1;
+}
+
+/*
+ * Free a node and its children (rotate left children up, so that no stack is needed).
+ */
+static void node_free(struct lockfree_node_t *node)
+{
+	struct lockfree_node_t *left;
+
+	while (node) {
+		left = node_addr(node->left);
+		if (left) {
+			node->left = left->right & ~LOCKFREE_MASK;
+			left->right = (uintptr_t) node;
+			node = left;
+		} else {
+			left = node_addr(node->right);
+			free(node);
+			node = left;
+		}
+	}
+}
+
+/*
+ * Build a balanced node from n sorted values pulled from a reader (min is set to smallest value).
+ */
+static struct lockfree_node_t *node_build(size_t n, int (*read)(void *, int *, size_t), void *arg, long long *min)
+{
+	struct lockfree_node_t *left, *right, *node;
+	long long right_min;
+	int val;
+
+	/* leaf */
+	if (n == 1) {
+		if (read(arg, &val, 1))
+			return NULL;
+
+		*min = val;
+		return node_create(val, 0, 0);
+	}
+
+	/* inner node routes with smallest value of right child */
+	left = node_build(n / 2, read, arg, min);
+	if (!left)
+		return NULL;
+
+	right = node_build(n - n / 2, read, arg, &right_min);
+	if (!right)
+		goto err;
+
+	node = node_create(right_min, (uintptr_t) left, (uintptr_t) right);
+	if (!node)
+		goto err;
+
+	return node;
+err:
+	node_free(left);
+	node_free(right);
+	return NULL;
+}
+
+/*
+ * Free a tree (no thread may use it anymore).
+ */
+static void tree_free(struct tree_t *tree)
+{
+	if (!tree)
+		return;
+
+	node_free(tree->root.lockfree);
+	free(tree);
+}
+
+/*
+ * Compute a tree height (inner nodes included, sentinels excluded).
+ */
+static int tree_height(struct tree_t *tree)
+{
+	int height;
+
+	if (!tree)
+		return 0;
+
+	epoch_enter();
+	height = node_walk(node_addr(node_addr(tree->root.lockfree->left)->left), NULL, NULL);
+	epoch_exit();
+
+	return height < 0 ? TREE_HEIGHT_UNKNOWN : height;
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	struct lockfree_node_t *node;
+	int ret = 0;
+
+	if (!tree)
+		return 0;
+
+	epoch_enter();
+	node = node_lower_bound(tree->root.lockfree, INT_MIN);
+	if (node) {
+		*val = (int) node->key;
+		ret = 1;
+	}
+	epoch_exit();
+
+	return ret;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	struct lockfree_node_t *node;
+	int ret = 0;
+
+	if (!tree)
+		return 0;
+
+	epoch_enter();
+	node = node_upper_bound(tree->root.lockfree, INT_MAX);
+	if (node) {
+		*val = (int) node->key;
+		ret = 1;
+	}
+	epoch_exit();
+
+	return ret;
+}
+
+/*
+ * Find a value in a tree (wait free).
+ */
+static int tree_find(struct tree_t *tree, int val)
+{
+	struct lockfree_seek_t sr;
+	int ret;
+
+	if (!tree)
+		return 0;
+
+	epoch_enter();
+	node_seek(tree->root.lockfree, val, &sr);
+	ret = sr.leaf->key == val;
+	epoch_exit();
+
+	return ret;
+}
+
+/*
+ * Insert a value in a tree : replace leaf with an inner node holding leaf and new leaf.
+ */
+static void tree_insert(struct tree_t *tree, int val)
+{
+	struct lockfree_node_t *leaf = NULL, *inner = NULL;
+	struct lockfree_seek_t sr;
+	uintptr_t *child_link, expected;
+
+	if (!tree)
+		return;
+
+	epoch_enter();
+
+	for (;;) {
+		node_seek(tree->root.lockfree, val, &sr);
+		if (sr.leaf->key == val)
+			break;
+
+		/* nodes are kept between retries */
+		if (!leaf)
+			leaf = node_create(val, 0, 0);
+		if (!inner)
+			inner = node_create(0, 0, 0);
+		if (!leaf || !inner)
+			break;
+
+		if (val < sr.leaf->key) {
+			inner->key = sr.leaf->key;
+			inner->left = (uintptr_t) leaf;
+			inner->right = (uintptr_t) sr.leaf;
+		} else {
+			inner->key = val;
+			inner->left = (uintptr_t) sr.leaf;
+			inner->right = (uintptr_t) leaf;
+		}
+
+		child_link = node_link(sr.parent, val);
+		expected = (uintptr_t) sr.leaf;
+		if (__atomic_compare_exchange_n(child_link, &expected, (uintptr_t) inner, 0, __ATOMIC_RELEASE,
+						__ATOMIC_ACQUIRE)) {
+			__atomic_add_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+			leaf = inner = NULL;
+			break;
+		}
+
+		/* leaf is being deleted : help */
+		if (node_addr(expected) == sr.leaf && (expected & LOCKFREE_MASK))
+			node_cleanup(val, &sr);
+	}
+
+	epoch_exit();
+
+	free(leaf);
+	free(inner);
+}
+
+/*
+ * Delete a value from a tree : flag leaf link (injection) then remove leaf and its parent (cleanup).
+ */
+static void tree_delete(struct tree_t *tree, int val)
+{
+	struct lockfree_node_t *leaf = NULL;
+	struct lockfree_seek_t sr;
+	uintptr_t *child_link, expected;
+
+	if (!tree)
+		return;
+
+	epoch_enter();
+
+	for (;;) {
+		node_seek(tree->root.lockfree, val, &sr);
+
+		/* cleanup : leaf may have been removed by a helper */
+		if (leaf) {
+			if (sr.leaf != leaf || node_cleanup(val, &sr))
+				break;
+			continue;
+		}
+
+		/* injection */
+		if (sr.leaf->key != val)
+			break;
+
+		child_link = node_link(sr.parent, val);
+		expected = (uintptr_t) sr.leaf;
+		if (__atomic_compare_exchange_n(child_link, &expected, expected | LOCKFREE_FLAG, 0, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			__atomic_sub_fetch(&tree->size, 1, __ATOMIC_RELAXED);
+			leaf = sr.leaf;
+			if (node_cleanup(val, &sr))
+				break;
+		} else if (node_addr(expected) == sr.leaf && (expected & LOCKFREE_MASK)) {
+			node_cleanup(val, &sr);
+		}
+	}
+
+	epoch_exit();
+}
+
+/*
+ * Balance a tree (not supported : tree shape depends on insertion order).
+ */
+static void tree_balance(struct tree_t *tree)
+{
+	UNUSED(tree);
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : a balanced tree is built in O(n),
+ * then hung on the left of the first sentinel leaf.
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct lockfree_node_t *sentinel, *node, *inner;
+	long long min;
+
+	if (!tree || tree->size > 0 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	node = node_build(n, read, arg, &min);
+	if (!node)
+		return -1;
+
+	sentinel = node_addr(tree->root.lockfree->left);
+	inner = node_create(LOCKFREE_INF0, (uintptr_t) node, sentinel->left);
+	if (!inner) {
+		node_free(node);
+		return -1;
+	}
+
+	__atomic_store_n(&sentinel->left, (uintptr_t) inner, __ATOMIC_RELEASE);
+	tree->size = n;
+
+	return 0;
+}
+
+/*
+ * Store a tree in a sorted array, at most cap values (writers may add leaves meanwhile, and tree size
+ * may lag behind them). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	if (!tree)
+		return 0;
+
+	epoch_enter();
+	if (node_walk(node_addr(node_addr(tree->root.lockfree->left)->left), keys, &cap) < 0)
+		cap = 0;
+	epoch_exit();
+
+	return cap;
+}
+
+/*
+ * Set iterator current leaf (the path is not used : each step searches from the root).
+ */
+static int iter_set(struct tree_iter_t *iter, struct lockfree_node_t *node, int state)
+{
+	if (!node) {
+		tree_iter_reset(iter, state);
+		return 0;
+	}
+
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	iter->val = (int) node->key;
+	return 1;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	int ret;
+
+	if (!iter || !tree)
+		return 0;
+
+	iter->tree = tree;
+
+	epoch_enter();
+	ret = iter_set(iter, node_lower_bound(tree->root.lockfree, val), TREE_ITER_END);
+	epoch_exit();
+
+	return ret;
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	long long key;
+	int ret;
+
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+
+	key = iter->state == TREE_ITER_BEGIN ? INT_MIN : (long long) iter->val + 1;
+
+	epoch_enter();
+	ret = iter_set(iter, node_lower_bound(iter->tree->root.lockfree, key), TREE_ITER_END);
+	epoch_exit();
+
+	return ret;
+}
+
+/*
+ * Move an iterator to previous value.
+ */
+static int tree_prev(struct tree_iter_t *iter)
+{
+	long long key;
+	int ret;
+
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+
+	key = iter->state == TREE_ITER_END ? INT_MAX : (long long) iter->val - 1;
+
+	epoch_enter();
+	ret = iter_set(iter, node_upper_bound(iter->tree->root.lockfree, key), TREE_ITER_BEGIN);
+	epoch_exit();
+
+	return ret;
+}
+
+/*
+ * Lock free tree operations.
+ */
+struct tree_operations_t lockfree_tree_ops = {
+	.init			= tree_init,
+	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
+	.find			= tree_find,
+	.insert			= tree_insert,
+	.delete			= tree_delete,
+	.balance		= tree_balance,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.free			= tree_free,
+};
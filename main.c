@@ -2,6 +2,7 @@
 #include <math.h>
 
 #include "tree.h"
+#include "tree_draw.h"
 
 #define MAX_NODE_VALUE			99
 #define TREE_TYPE			TREE_TYPE_AVL
@@ -28,9 +29,9 @@ struct tree_window_t {
 };
 
 /*
- * Draw a tree.
+ * Draw tree window.
  */
-static void tree_draw(struct tree_window_t *tree_window)
+static void tree_window_draw(struct tree_window_t *tree_window)
 {
 	struct tree_t *tree = tree_window->tree;
 	cairo_t *cr;
@@ -51,8 +52,8 @@ static void tree_draw(struct tree_window_t *tree_window)
 	cairo_paint(cr);
 
 	/* draw tree */
-	if (tree && tree->ops && tree->ops->draw)
-		tree->ops->draw(tree, tree_window->drawing_area, cr);
+	if (tree)
+		tree_draw(tree, tree_window->drawing_area, cr);
 	
 	/* destroy cairo */
 	cairo_destroy(cr);
@@ -104,7 +105,7 @@ static gboolean configure_event_cb(GtkWidget *widget, GdkEvent *event, struct tr
 	g_assert(event != NULL);
 
 	/* draw tree */
-	tree_draw(tree_window);
+	tree_window_draw(tree_window);
 
 	return TRUE;
 }
@@ -132,7 +133,7 @@ static void add_cb(GtkWidget *widget, struct tree_window_t *tree_window)
 	tree->ops->insert(tree, val);
 
 	/* draw tree */	
-	tree_draw(tree_window);
+	tree_window_draw(tree_window);
 	gtk_widget_queue_draw(tree_window->drawing_area);
 }
 
@@ -155,7 +156,7 @@ static void delete_cb(GtkWidget *widget, struct tree_window_t *tree_window)
 	tree->ops->delete(tree, val);
 
 	/* draw tree */	
-	tree_draw(tree_window);
+	tree_window_draw(tree_window);
 	gtk_widget_queue_draw(tree_window->drawing_area);
 }
 
@@ -180,7 +181,7 @@ static void add_random_cb(GtkWidget *widget, struct tree_window_t *tree_window)
 	tree->ops->insert(tree, rand() % MAX_NODE_VALUE);
 
 	/* draw tree */	
-	tree_draw(tree_window);
+	tree_window_draw(tree_window);
 	gtk_widget_queue_draw(tree_window->drawing_area);
 }
 
@@ -201,7 +202,7 @@ static void balance_tree_cb(GtkWidget *widget, struct tree_window_t *tree_window
 	tree->ops->balance(tree);
 
 	/* draw tree */	
-	tree_draw(tree_window);
+	tree_window_draw(tree_window);
 	gtk_widget_queue_draw(tree_window->drawing_area);
 }
 
@@ -0,0 +1,760 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tree.h"
+
+/*
+ * Get a node from its offset.
+ */
+static inline struct mmap_node_t *node_at(struct mmap_tree_t *map, uint32_t off)
+{
+	return &map->nodes[off];
+}
+
+/*
+ * Get node height.
+ */
+static inline int node_height(struct mmap_tree_t *map, uint32_t off)
+{
+	return off ? node_at(map, off)->height : 0;
+}
+
+/*
+ * Update node height from its children.
+ */
+static inline void node_update(struct mmap_tree_t *map, uint32_t off)
+{
+	struct mmap_node_t *node = node_at(map, off);
+
+	node->height = 1 + max(node_height(map, node->left), node_height(map, node->right));
+}
+
+/*
+ * Compute node balance.
+ */
+static inline int node_balance(struct mmap_tree_t *map, uint32_t off)
+{
+	if (!off)
+		return 0;
+
+	return node_height(map, node_at(map, off)->left) - node_height(map, node_at(map, off)->right);
+}
+
+/*
+ * Grow mapping so that n more nodes can be carved out of it.
+ */
+static int map_reserve(struct mmap_tree_t *map, size_t n)
+{
+	size_t capacity, length;
+	void *base;
+
+	capacity = map->header->capacity;
+	if (map->header->nr_nodes + n <= capacity)
+		return 0;
+
+	/* double capacity */
+	capacity = 2 * capacity;
+	if (capacity < map->header->nr_nodes + n)
+		capacity = map->header->nr_nodes + n;
+	if (capacity > MMAP_TREE_MAX_NODES)
+		capacity = MMAP_TREE_MAX_NODES;
+	if (map->header->nr_nodes + n > capacity)
+		return -1;
+
+	/* grow file, then mapping (offsets don't change when mapping moves) */
+	length = capacity * sizeof(struct mmap_node_t);
+	if (map->fd >= 0 && ftruncate(map->fd, length))
+		return -1;
+
+	base = mremap(map->nodes, map->length, length, MREMAP_MAYMOVE);
+	if (base == MAP_FAILED)
+		return -1;
+
+	map->nodes = (struct mmap_node_t *) base;
+	map->header = (struct mmap_header_t *) base;
+	map->length = length;
+	map->header->capacity = capacity;
+
+	return 0;
+}
+
+/*
+ * Create a node (a node must have been reserved).
+ */
+static uint32_t node_create(struct mmap_tree_t *map, int val)
+{
+	struct mmap_node_t *node;
+	uint32_t off;
+
+	/* reuse a freed node or carve a new one */
+	if (map->header->free_list) {
+		off = map->header->free_list;
+		map->header->free_list = node_at(map, off)->left;
+	} else {
+		off = map->header->nr_nodes++;
+	}
+
+	/* set node */
+	node = node_at(map, off);
+	node->val = val;
+	node->height = 1;
+	node->left = 0;
+	node->right = 0;
+
+	return off;
+}
+
+/*
+ * Free a node (it is chained in free list through its left link).
+ */
+static void node_free(struct mmap_tree_t *map, uint32_t off)
+{
+	node_at(map, off)->left = map->header->free_list;
+	map->header->free_list = off;
+}
+
+/*
+ * Find a node.
+ */
+static uint32_t node_find(struct mmap_tree_t *map, uint32_t off, int val)
+{
+	struct mmap_node_t *node;
+
+	while (off) {
+		node = node_at(map, off);
+		if (val < node->val)
+			off = node->left;
+		else if (val > node->val)
+			off = node->right;
+		else
+			break;
+	}
+
+	return off;
+}
+
+/*
+ * Right rotate subtree rooted with y.
+ */
+static uint32_t right_rotate(struct mmap_tree_t *map, uint32_t y)
+{
+	uint32_t x = node_at(map, y)->left;
+
+	/* rotate */
+	node_at(map, y)->left = node_at(map, x)->right;
+	node_at(map, x)->right = y;
+
+	/* update heights */
+	node_update(map, y);
+	node_update(map, x);
+
+	return x;
+}
+
+/*
+ * Left rotate subtree rooted with x.
+ */
+static uint32_t left_rotate(struct mmap_tree_t *map, uint32_t x)
+{
+	uint32_t y = node_at(map, x)->right;
+
+	/* rotate */
+	node_at(map, x)->right = node_at(map, y)->left;
+	node_at(map, y)->left = x;
+
+	/* update heights */
+	node_update(map, x);
+	node_update(map, y);
+
+	return y;
+}
+
+/*
+ * Rebalance a node after an update in one of its children.
+ */
+static uint32_t node_rebalance(struct mmap_tree_t *map, uint32_t off)
+{
+	struct mmap_node_t *node = node_at(map, off);
+	int balance;
+
+	/* update node height */
+	node_update(map, off);
+
+	/* compute node balance */
+	balance = node_balance(map, off);
+
+	/* left heavy : left right case needs a first rotation */
+	if (balance > 1) {
+		if (node_balance(map, node->left) < 0)
+			node->left = left_rotate(map, node->left);
+		return right_rotate(map, off);
+	}
+
+	/* right heavy : right left case needs a first rotation */
+	if (balance < -1) {
+		if (node_balance(map, node->right) > 0)
+			node->right = right_rotate(map, node->right);
+		return left_rotate(map, off);
+	}
+
+	return off;
+}
+
+/*
+ * Insert a value in a node (a node must have been reserved).
+ */
+static uint32_t node_insert(struct tree_t *tree, uint32_t off, int val)
+{
+	struct mmap_tree_t *map = tree->root.mmap;
+	struct mmap_node_t *node;
+
+	/* leaf : insert node */
+	if (!off) {
+		map->header->size = ++tree->size;
+		return node_create(map, val);
+	}
+
+	/* find subtree */
+	node = node_at(map, off);
+	if (val < node->val)
+		node->left = node_insert(tree, node->left, val);
+	else if (val > node->val)
+		node->right = node_insert(tree, node->right, val);
+	else
+		return off;
+
+	return node_rebalance(map, off);
+}
+
+/*
+ * Delete a value in a node.
+ */
+static uint32_t node_delete(struct tree_t *tree, uint32_t off, int val)
+{
+	struct mmap_tree_t *map = tree->root.mmap;
+	struct mmap_node_t *node, *min;
+	uint32_t child;
+
+	if (!off)
+		return 0;
+
+	node = node_at(map, off);
+
+	/* delete in left child */
+	if (val < node->val) {
+		node->left = node_delete(tree, node->left, val);
+	/* delete in right child */
+	} else if (val > node->val) {
+		node->right = node_delete(tree, node->right, val);
+	/* only one child or no child : replace this node with it */
+	} else if (!node->left || !node->right) {
+		child = node->left ? node->left : node->right;
+		node_free(map, off);
+		map->header->size = --tree->size;
+		return child;
+	/* set this node with minimum value of right child, and delete it there */
+	} else {
+		for (min = node_at(map, node->right); min->left;)
+			min = node_at(map, min->left);
+
+		node->val = min->val;
+		node->right = node_delete(tree, node->right, node->val);
+	}
+
+	return node_rebalance(map, off);
+}
+
+/*
+ * Build a balanced node from n sorted values pulled from a reader (nodes are allocated in pre order,
+ * n nodes must have been reserved).
+ */
+static uint32_t node_build(struct mmap_tree_t *map, size_t n, int (*read)(void *, int *, size_t), void *arg,
+			   int *err)
+{
+	uint32_t off, left, right;
+	int val = 0;
+
+	if (n == 0 || *err)
+		return 0;
+
+	off = node_create(map, 0);
+	left = node_build(map, (n - 1) / 2, read, arg, err);
+	if (!*err && read(arg, &val, 1))
+		*err = 1;
+	right = node_build(map, n - 1 - (n - 1) / 2, read, arg, err);
+
+	node_at(map, off)->val = val;
+	node_at(map, off)->height = tree_balanced_height(n);
+	node_at(map, off)->left = left;
+	node_at(map, off)->right = right;
+
+	return off;
+}
+
+/*
+ * Map a tree file (or anonymous memory if fd < 0) : an empty file is initialized.
+ */
+static int map_open(struct tree_t *tree, int fd)
+{
+	struct mmap_header_t header;
+	struct mmap_tree_t *map;
+	struct stat st;
+	size_t length;
+	void *base;
+
+	map = (struct mmap_tree_t *) malloc(sizeof(struct mmap_tree_t));
+	if (!map)
+		return -1;
+
+	/* new tree */
+	length = MMAP_TREE_MIN_NODES * sizeof(struct mmap_node_t);
+	header.magic = MMAP_TREE_MAGIC;
+	header.version = MMAP_TREE_VERSION;
+	header.node_size = sizeof(struct mmap_node_t);
+	header.root = 0;
+	header.free_list = 0;
+	header.nr_nodes = MMAP_TREE_HEADER_NODES;
+	header.capacity = MMAP_TREE_MIN_NODES;
+	header.size = 0;
+
+	if (fd >= 0) {
+		if (fstat(fd, &st))
+			goto err;
+
+		/* existing file : check header */
+		if (st.st_size > 0) {
+			if (pread(fd, &header, sizeof(header), 0) != sizeof(header))
+				goto err;
+			if (header.magic != MMAP_TREE_MAGIC || header.version != MMAP_TREE_VERSION
+			    || header.node_size != sizeof(struct mmap_node_t)
+			    || header.capacity < header.nr_nodes || header.nr_nodes < MMAP_TREE_HEADER_NODES
+			    || (size_t) st.st_size < header.capacity * sizeof(struct mmap_node_t))
+				goto err;
+
+			/* torn or corrupted header : links would point out of the mapping */
+			if (header.root >= header.nr_nodes || header.free_list >= header.nr_nodes
+			    || header.size > header.nr_nodes - MMAP_TREE_HEADER_NODES)
+				goto err;
+
+			length = header.capacity * sizeof(struct mmap_node_t);
+		} else if (ftruncate(fd, length) || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+			goto err;
+		}
+
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	} else {
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED)
+			*((struct mmap_header_t *) base) = header;
+	}
+
+	if (base == MAP_FAILED)
+		goto err;
+
+	/* set tree */
+	map->fd = fd;
+	map->nodes = (struct mmap_node_t *) base;
+	map->header = (struct mmap_header_t *) base;
+	map->length = length;
+	tree->root.mmap = map;
+	tree->size = map->header->size;
+	tree->pool = NULL;
+
+	return 0;
+err:
+	free(map);
+	return -1;
+}
+
+/*
+ * Init a tree (in anonymous memory, see mmap_tree_open() for file backed trees).
+ */
+static int tree_init(struct tree_t *tree)
+{
+	if (!tree)
+		return -1;
+
+	return map_open(tree, -1);
+}
+
+/*
+ * Free a tree (changes since last mmap_tree_sync() reach the file whenever the OS writes them back).
+ */
+static void tree_free(struct tree_t *tree)
+{
+	struct mmap_tree_t *map;
+
+	if (!tree)
+		return;
+
+	map = tree->root.mmap;
+	munmap(map->nodes, map->length);
+	if (map->fd >= 0)
+		close(map->fd);
+
+	free(map);
+	free(tree);
+}
+
+/*
+ * Compute a tree height.
+ */
+static int tree_height(struct tree_t *tree)
+{
+	if (!tree)
+		return 0;
+
+	return node_height(tree->root.mmap, tree->root.mmap->header->root);
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	struct mmap_tree_t *map;
+	uint32_t off;
+
+	if (!tree)
+		return 0;
+
+	map = tree->root.mmap;
+	if (!(off = map->header->root))
+		return 0;
+
+	for (; node_at(map, off)->left;)
+		off = node_at(map, off)->left;
+
+	*val = node_at(map, off)->val;
+	return 1;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	struct mmap_tree_t *map;
+	uint32_t off;
+
+	if (!tree)
+		return 0;
+
+	map = tree->root.mmap;
+	if (!(off = map->header->root))
+		return 0;
+
+	for (; node_at(map, off)->right;)
+		off = node_at(map, off)->right;
+
+	*val = node_at(map, off)->val;
+	return 1;
+}
+
+/*
+ * Find a node in a tree.
+ */
+static int tree_find(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return 0;
+
+	return node_find(tree->root.mmap, tree->root.mmap->header->root, val) != 0;
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void tree_insert(struct tree_t *tree, int val)
+{
+	struct mmap_tree_t *map;
+
+	if (!tree)
+		return;
+
+	/* grow before descending : node pointers stay valid during insertion */
+	map = tree->root.mmap;
+	if (!map->header->free_list && map_reserve(map, 1))
+		return;
+
+	map->header->root = node_insert(tree, map->header->root, val);
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void tree_delete(struct tree_t *tree, int val)
+{
+	struct mmap_tree_t *map;
+
+	if (!tree)
+		return;
+
+	map = tree->root.mmap;
+	map->header->root = node_delete(tree, map->header->root, val);
+}
+
+/*
+ * Balance a tree.
+ */
+static void tree_balance(struct tree_t *tree)
+{
+	/* nothing to do : AVL trees are always balanced */
+	UNUSED(tree);
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : a balanced tree is built in O(n).
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct mmap_tree_t *map;
+	uint32_t root;
+	int err = 0;
+
+	if (!tree || tree->size > 0 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* nodes of a failed load stay in file until tree is rebuilt */
+	map = tree->root.mmap;
+	if (map_reserve(map, n))
+		return -1;
+
+	root = node_build(map, n, read, arg, &err);
+	if (err)
+		return -1;
+
+	/* set tree */
+	map->header->root = root;
+	map->header->size = tree->size = n;
+
+	return 0;
+}
+
+/*
+ * Store values of a tree in order (at most cap values). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	struct mmap_tree_t *map;
+	uint32_t stack[NODE_STACK_SIZE], off;
+	size_t n = 0;
+	int top = 0;
+
+	if (!tree)
+		return 0;
+
+	map = tree->root.mmap;
+	for (off = map->header->root; (off || top > 0) && n < cap;) {
+		for (; off; off = node_at(map, off)->left)
+			stack[top++] = off;
+
+		off = stack[--top];
+		keys[n++] = node_at(map, off)->val;
+		off = node_at(map, off)->right;
+	}
+
+	return n;
+}
+
+/*
+ * Position an iterator on first value >= val (or last value <= val if backward is set).
+ * Path holds offsets, AVL trees are never deeper than the iterator ring.
+ */
+static int iter_find(struct tree_iter_t *iter, int val, int backward)
+{
+	struct mmap_tree_t *map = iter->tree->root.mmap;
+	int depth = 0, found_depth = 0;
+	struct mmap_node_t *node;
+	uint32_t off;
+
+	/* descend from root, remembering path and depth of best candidate */
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	for (off = map->header->root; off;) {
+		tree_iter_push(iter, (void *) (uintptr_t) off);
+		node = node_at(map, off);
+		depth++;
+
+		if (node->val == val || (val < node->val) != backward) {
+			found_depth = depth;
+			iter->val = node->val;
+		}
+
+		if (node->val == val)
+			break;
+
+		off = val < node->val ? node->left : node->right;
+	}
+
+	/* no such value */
+	if (!found_depth) {
+		tree_iter_reset(iter, backward ? TREE_ITER_BEGIN : TREE_ITER_END);
+		return 0;
+	}
+
+	/* climb back to candidate */
+	for (; depth > found_depth; depth--)
+		tree_iter_pop(iter);
+
+	return 1;
+}
+
+/*
+ * Move an iterator to next (or previous if backward is set) value.
+ */
+static int iter_step(struct tree_iter_t *iter, int backward)
+{
+	struct mmap_tree_t *map = iter->tree->root.mmap;
+	uint32_t off, child;
+
+	/* leftmost node of right child (or rightmost node of left child) */
+	off = (uint32_t) (uintptr_t) tree_iter_peek(iter);
+	child = backward ? node_at(map, off)->left : node_at(map, off)->right;
+	if (child) {
+		for (off = child; off; off = backward ? node_at(map, off)->right : node_at(map, off)->left)
+			tree_iter_push(iter, (void *) (uintptr_t) off);
+
+		iter->val = node_at(map, (uint32_t) (uintptr_t) tree_iter_peek(iter))->val;
+		return 1;
+	}
+
+	/* first ancestor reached from a left child (or from a right child) */
+	for (;;) {
+		child = (uint32_t) (uintptr_t) tree_iter_pop(iter);
+		off = (uint32_t) (uintptr_t) tree_iter_peek(iter);
+		if (!off)
+			break;
+
+		if ((backward ? node_at(map, off)->right : node_at(map, off)->left) == child) {
+			iter->val = node_at(map, off)->val;
+			return 1;
+		}
+	}
+
+	tree_iter_reset(iter, backward ? TREE_ITER_BEGIN : TREE_ITER_END);
+	return 0;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	if (!iter || !tree)
+		return 0;
+
+	iter->tree = tree;
+	return iter_find(iter, val, 0);
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+	if (iter->state == TREE_ITER_BEGIN)
+		return iter_find(iter, INT_MIN, 0);
+
+	return iter_step(iter, 0);
+}
+
+/*
+ * Move an iterator to previous value.
+ */
+static int tree_prev(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+	if (iter->state == TREE_ITER_END)
+		return iter_find(iter, INT_MAX, 1);
+
+	return iter_step(iter, 1);
+}
+
+/*
+ * Open (or create) a file backed tree : nodes are used in place, opening costs one mmap call.
+ * Updates are done in place too, so a file is only consistent after a clean close, or after
+ * mmap_tree_sync() if the tree wasn't updated since : a system crash in the middle of updates may
+ * leave any mix of old and new pages in the file.
+ */
+struct tree_t *mmap_tree_open(const char *path)
+{
+	struct tree_t *tree;
+	int fd;
+
+	if (!path)
+		return NULL;
+
+	tree = (struct tree_t *) malloc(sizeof(struct tree_t));
+	if (!tree)
+		return NULL;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		goto err;
+
+	tree->ops = &mmap_tree_ops;
+	tree->type = TREE_TYPE_MMAP;
+	tree->flags = 0;
+	tree->rcu = NULL;
+	tree->relayout_threshold = 0;
+	tree->nr_updates = 0;
+	if (map_open(tree, fd)) {
+		close(fd);
+		goto err;
+	}
+
+	return tree;
+err:
+	free(tree);
+	return NULL;
+}
+
+/*
+ * Write changed pages of a file backed tree and wait for them (file is consistent until next update,
+ * see mmap_tree_open()).
+ */
+int mmap_tree_sync(struct tree_t *tree)
+{
+	struct mmap_tree_t *map;
+
+	if (!tree || tree->type != TREE_TYPE_MMAP)
+		return -1;
+
+	map = tree->root.mmap;
+	if (map->fd < 0)
+		return 0;
+
+	return msync(map->nodes, map->length, MS_SYNC);
+}
+
+/*
+ * Memory mapped tree operations.
+ */
+struct tree_operations_t mmap_tree_ops = {
+	.init			= tree_init,
+	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
+	.find			= tree_find,
+	.insert			= tree_insert,
+	.delete			= tree_delete,
+	.balance		= tree_balance,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.free			= tree_free,
+};
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+
+#include "tree.h"
+
+/*
+ * Create a node pool.
+ */
+struct node_pool_t *node_pool_create(size_t node_size)
+{
+	struct node_pool_t *pool;
+
+	/* allocate a node pool */
+	pool = (struct node_pool_t *) malloc(sizeof(struct node_pool_t));
+	if (!pool)
+		return NULL;
+
+	/* a free node must be able to hold the free list link */
+	if (node_size < sizeof(void *))
+		node_size = sizeof(void *);
+
+	/* set node pool */
+	pool->node_size = (node_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	pool->slab_nodes = NODE_POOL_MIN_SLAB;
+	pool->slabs = NULL;
+	pool->free_list = NULL;
+	pool->deferred = NULL;
+	pool->next = NULL;
+	pool->end = NULL;
+	pool->stats = (struct node_pool_stats_t) { 0 };
+	pool->refs = 1;
+
+	return pool;
+}
+
+/*
+ * Get a reference on a node pool (several trees may share a pool, they must not be updated concurrently).
+ */
+struct node_pool_t *node_pool_get(struct node_pool_t *pool)
+{
+	if (pool)
+		__atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+
+	return pool;
+}
+
+/*
+ * Destroy a node pool : release all slabs at once, when last reference is dropped.
+ */
+void node_pool_destroy(struct node_pool_t *pool)
+{
+	struct node_slab_t *slab, *next;
+
+	if (!pool || __atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	/* free slabs */
+	for (slab = pool->slabs; slab != NULL; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+
+	/* free pool */
+	free(pool);
+}
+
+/*
+ * Allocate a new slab and return its first node.
+ */
+void *node_pool_grow(struct node_pool_t *pool)
+{
+	struct node_slab_t *slab;
+	size_t header_size;
+	void *mem;
+	char *node;
+
+	/* slab header is padded to keep nodes aligned */
+	header_size = (sizeof(struct node_slab_t) + NODE_POOL_ALIGN - 1) & ~(size_t) (NODE_POOL_ALIGN - 1);
+
+	/* allocate a slab */
+	if (posix_memalign(&mem, NODE_POOL_ALIGN, header_size + pool->slab_nodes * pool->node_size))
+		return NULL;
+
+	/* link slab */
+	slab = (struct node_slab_t *) mem;
+	slab->nr_nodes = pool->slab_nodes;
+	slab->next = pool->slabs;
+	pool->slabs = slab;
+
+	/* update statistics */
+	pool->stats.nr_slabs++;
+	pool->stats.capacity += pool->slab_nodes;
+	pool->stats.bytes += header_size + pool->slab_nodes * pool->node_size;
+
+	/* nodes of previous slab not carved yet become free nodes (they are counted in capacity) */
+	for (; pool->next < pool->end; pool->next += pool->node_size) {
+		*((void **) pool->next) = pool->free_list;
+		pool->free_list = pool->next;
+	}
+
+	/* first node is returned, others will be carved on demand */
+	node = (char *) mem + header_size;
+	pool->next = node + pool->node_size;
+	pool->end = node + pool->slab_nodes * pool->node_size;
+
+	/* next slab will be bigger */
+	if (pool->slab_nodes < NODE_POOL_MAX_SLAB)
+		pool->slab_nodes *= 2;
+
+	return node;
+}
+
+/*
+ * Make sure n nodes can be allocated without failure.
+ */
+int node_pool_reserve(struct node_pool_t *pool, size_t n)
+{
+	void *node;
+
+	while (pool->stats.capacity - pool->stats.nr_nodes < n) {
+		node = node_pool_grow(pool);
+		if (!node)
+			return -1;
+
+		/* first node of new slab is not used yet */
+		*((void **) node) = pool->free_list;
+		pool->free_list = node;
+	}
+
+	return 0;
+}
+
+/*
+ * Move all slabs and free nodes of a pool (which must not be shared) into another pool.
+ */
+int node_pool_merge(struct node_pool_t *pool, struct node_pool_t *src)
+{
+	struct node_slab_t *slab;
+	void *node;
+
+	if (!pool || !src || pool == src)
+		return 0;
+	if (src->refs > 1 || src->node_size != pool->node_size)
+		return -1;
+
+	/* release deferred nodes first */
+	node_pool_drain(src);
+
+	/* move slabs */
+	if (src->slabs) {
+		for (slab = src->slabs; slab->next != NULL;)
+			slab = slab->next;
+
+		slab->next = pool->slabs;
+		pool->slabs = src->slabs;
+	}
+
+	/* move free nodes */
+	while (src->free_list) {
+		node = src->free_list;
+		src->free_list = *((void **) node);
+		*((void **) node) = pool->free_list;
+		pool->free_list = node;
+	}
+
+	/* nodes not carved yet become free nodes */
+	for (; src->next < src->end; src->next += src->node_size) {
+		*((void **) src->next) = pool->free_list;
+		pool->free_list = src->next;
+	}
+
+	/* update statistics */
+	pool->stats.nr_allocs += src->stats.nr_allocs;
+	pool->stats.nr_frees += src->stats.nr_frees;
+	pool->stats.nr_slabs += src->stats.nr_slabs;
+	pool->stats.nr_nodes += src->stats.nr_nodes;
+	pool->stats.capacity += src->stats.capacity;
+	pool->stats.bytes += src->stats.bytes;
+	if (pool->stats.nr_nodes > pool->stats.max_nodes)
+		pool->stats.max_nodes = pool->stats.nr_nodes;
+
+	/* source pool is now empty */
+	src->slabs = NULL;
+	src->next = NULL;
+	src->end = NULL;
+	src->stats = (struct node_pool_stats_t) { 0 };
+
+	return 0;
+}
+
+/*
+ * Release a node from any thread : it is pushed on a lock free list, and will be freed by pool owner.
+ */
+void node_pool_defer(struct node_pool_t *pool, void *node)
+{
+	void *head = __atomic_load_n(&pool->deferred, __ATOMIC_RELAXED);
+
+	do {
+		*((void **) node) = head;
+	} while (!__atomic_compare_exchange_n(&pool->deferred, &head, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Free deferred nodes (must be called by pool owner).
+ */
+void node_pool_drain(struct node_pool_t *pool)
+{
+	void *node, *next;
+
+	/* grab the whole list at once */
+	if (!__atomic_load_n(&pool->deferred, __ATOMIC_RELAXED))
+		return;
+
+	for (node = __atomic_exchange_n(&pool->deferred, NULL, __ATOMIC_ACQUIRE); node != NULL; node = next) {
+		next = *((void **) node);
+		node_pool_free(pool, node);
+	}
+}
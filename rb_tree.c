@@ -0,0 +1,880 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tree.h"
+
+/*
+ * Node layout (for relayout and batch lookups).
+ */
+static const struct tree_layout_t node_layout = {
+	.node_size		= sizeof(struct rb_node_t),
+	.val			= offsetof(struct rb_node_t, val),
+	.left			= offsetof(struct rb_node_t, left),
+	.right			= offsetof(struct rb_node_t, right),
+	.parent			= offsetof(struct rb_node_t, parent),
+};
+
+/*
+ * Create a node.
+ */
+static struct rb_node_t *node_create(struct tree_t *tree, int val)
+{
+	struct rb_node_t *node;
+
+	/* allocate a node */
+	node = (struct rb_node_t *) node_pool_alloc(tree->pool);
+	if (!node)
+		return NULL;
+
+	/* set node */
+	node->val = val;
+	node->color = RB_RED;
+	node->left = NULL;
+	node->right = NULL;
+	node->parent = NULL;
+
+	return node;
+}
+
+/*
+ * Is a node black ? (NULL leaves are black)
+ */
+static inline int node_is_black(struct rb_node_t *node)
+{
+	return !node || node->color == RB_BLACK;
+}
+
+/*
+ * Compute a node height (walk down and up with parent links, no stack is used).
+ */
+static int node_height(struct rb_node_t *node)
+{
+	struct rb_node_t *prev = NULL, *next;
+	int depth = 1, height = 0;
+
+	if (!node)
+		return 0;
+
+	/* walk only this subtree */
+	prev = node->parent;
+	while (node && depth > 0) {
+		/* coming from parent : go left, or right */
+		if (prev == node->parent) {
+			height = max(height, depth);
+			next = node->left ? node->left : node->right;
+		/* coming from left child : go right */
+		} else if (prev == node->left) {
+			next = node->right;
+		/* coming from right child : go up */
+		} else {
+			next = NULL;
+		}
+
+		prev = node;
+		if (next) {
+			node = next;
+			depth++;
+		} else {
+			node = node->parent;
+			depth--;
+		}
+	}
+
+	return height;
+}
+
+/*
+ * Find a node.
+ */
+static struct rb_node_t *node_find(struct rb_node_t *node, int val)
+{
+	while (node) {
+		if (val < node->val)
+			node = node->left;
+		else if (val > node->val)
+			node = node->right;
+		else
+			break;
+	}
+
+	return node;
+}
+
+/*
+ * Find minimum value in a node.
+ */
+static struct rb_node_t *node_min(struct rb_node_t *node)
+{
+	if (!node)
+		return NULL;
+
+	while (node->left)
+		node = node->left;
+
+	return node;
+}
+
+/*
+ * Find maximum value in a node.
+ */
+static struct rb_node_t *node_max(struct rb_node_t *node)
+{
+	if (!node)
+		return NULL;
+
+	while (node->right)
+		node = node->right;
+
+	return node;
+}
+
+/*
+ * Get in order successor of a node.
+ */
+static struct rb_node_t *node_next(struct rb_node_t *node)
+{
+	struct rb_node_t *parent;
+
+	/* leftmost node of right child */
+	if (node->right)
+		return node_min(node->right);
+
+	/* first ancestor reached from a left child */
+	for (parent = node->parent; parent && node == parent->right; parent = parent->parent)
+		node = parent;
+
+	return parent;
+}
+
+/*
+ * Get in order predecessor of a node.
+ */
+static struct rb_node_t *node_prev(struct rb_node_t *node)
+{
+	struct rb_node_t *parent;
+
+	/* rightmost node of left child */
+	if (node->left)
+		return node_max(node->left);
+
+	/* first ancestor reached from a right child */
+	for (parent = node->parent; parent && node == parent->left; parent = parent->parent)
+		node = parent;
+
+	return parent;
+}
+
+/*
+ * Store values of a node in order, at most cap values. Returns number of values stored.
+ */
+static size_t node_keys(struct rb_node_t *node, int *keys, size_t cap)
+{
+	size_t n = 0;
+
+	for (node = node_min(node); node != NULL && n < cap; node = node_next(node))
+		keys[n++] = node->val;
+
+	return n;
+}
+
+/*
+ * Replace a child link of node's parent.
+ */
+static void node_replace_child(struct tree_t *tree, struct rb_node_t *node, struct rb_node_t *new_node)
+{
+	if (!node->parent)
+		tree->root.rb = new_node;
+	else if (node == node->parent->left)
+		node->parent->left = new_node;
+	else
+		node->parent->right = new_node;
+
+	if (new_node)
+		new_node->parent = node->parent;
+}
+
+/*
+ * Left rotate subtree rooted with x.
+ */
+static void rb_left_rotate(struct tree_t *tree, struct rb_node_t *x)
+{
+	struct rb_node_t *y = x->right;
+
+	/* move y left child */
+	x->right = y->left;
+	if (y->left)
+		y->left->parent = x;
+
+	/* put y in place of x */
+	node_replace_child(tree, x, y);
+	y->left = x;
+	x->parent = y;
+}
+
+/*
+ * Right rotate subtree rooted with y.
+ */
+static void rb_right_rotate(struct tree_t *tree, struct rb_node_t *y)
+{
+	struct rb_node_t *x = y->left;
+
+	/* move x right child */
+	y->left = x->right;
+	if (x->right)
+		x->right->parent = y;
+
+	/* put x in place of y */
+	node_replace_child(tree, y, x);
+	x->right = y;
+	y->parent = x;
+}
+
+/*
+ * Fix red-black properties after an insertion.
+ */
+static void node_insert_fixup(struct tree_t *tree, struct rb_node_t *node)
+{
+	struct rb_node_t *parent, *grand_parent, *uncle;
+
+	while ((parent = node->parent) && parent->color == RB_RED) {
+		/* parent is red, so it is not the root */
+		grand_parent = parent->parent;
+
+		if (parent == grand_parent->left) {
+			uncle = grand_parent->right;
+
+			/* red uncle : recolor and move up */
+			if (!node_is_black(uncle)) {
+				parent->color = RB_BLACK;
+				uncle->color = RB_BLACK;
+				grand_parent->color = RB_RED;
+				node = grand_parent;
+				continue;
+			}
+
+			/* left right case */
+			if (node == parent->right) {
+				rb_left_rotate(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			/* left left case */
+			parent->color = RB_BLACK;
+			grand_parent->color = RB_RED;
+			rb_right_rotate(tree, grand_parent);
+		} else {
+			uncle = grand_parent->left;
+
+			/* red uncle : recolor and move up */
+			if (!node_is_black(uncle)) {
+				parent->color = RB_BLACK;
+				uncle->color = RB_BLACK;
+				grand_parent->color = RB_RED;
+				node = grand_parent;
+				continue;
+			}
+
+			/* right left case */
+			if (node == parent->left) {
+				rb_right_rotate(tree, parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			/* right right case */
+			parent->color = RB_BLACK;
+			grand_parent->color = RB_RED;
+			rb_left_rotate(tree, grand_parent);
+		}
+	}
+
+	tree->root.rb->color = RB_BLACK;
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void node_insert(struct tree_t *tree, int val)
+{
+	struct rb_node_t **link = &tree->root.rb, *parent = NULL, *node;
+
+	/* find leaf link */
+	while (*link) {
+		parent = *link;
+
+		if (val < parent->val)
+			link = &parent->left;
+		else if (val > parent->val)
+			link = &parent->right;
+		else
+			return;
+	}
+
+	/* create node */
+	node = node_create(tree, val);
+	if (!node)
+		return;
+
+	/* link node */
+	node->parent = parent;
+	*link = node;
+	tree->size++;
+
+	/* fix tree */
+	node_insert_fixup(tree, node);
+}
+
+/*
+ * Fix red-black properties after a deletion (node is the node that replaced a black node).
+ */
+static void node_delete_fixup(struct tree_t *tree, struct rb_node_t *node, struct rb_node_t *parent)
+{
+	struct rb_node_t *sibling;
+
+	while (node != tree->root.rb && node_is_black(node)) {
+		if (node == parent->left) {
+			sibling = parent->right;
+
+			/* red sibling : make it black */
+			if (sibling->color == RB_RED) {
+				sibling->color = RB_BLACK;
+				parent->color = RB_RED;
+				rb_left_rotate(tree, parent);
+				sibling = parent->right;
+			}
+
+			/* black sibling with black children : recolor and move up */
+			if (node_is_black(sibling->left) && node_is_black(sibling->right)) {
+				sibling->color = RB_RED;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			/* black sibling with red left child : make right child red */
+			if (node_is_black(sibling->right)) {
+				sibling->left->color = RB_BLACK;
+				sibling->color = RB_RED;
+				rb_right_rotate(tree, sibling);
+				sibling = parent->right;
+			}
+
+			/* black sibling with red right child */
+			sibling->color = parent->color;
+			parent->color = RB_BLACK;
+			sibling->right->color = RB_BLACK;
+			rb_left_rotate(tree, parent);
+			node = tree->root.rb;
+		} else {
+			sibling = parent->left;
+
+			/* red sibling : make it black */
+			if (sibling->color == RB_RED) {
+				sibling->color = RB_BLACK;
+				parent->color = RB_RED;
+				rb_right_rotate(tree, parent);
+				sibling = parent->left;
+			}
+
+			/* black sibling with black children : recolor and move up */
+			if (node_is_black(sibling->left) && node_is_black(sibling->right)) {
+				sibling->color = RB_RED;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			/* black sibling with red right child : make left child red */
+			if (node_is_black(sibling->left)) {
+				sibling->right->color = RB_BLACK;
+				sibling->color = RB_RED;
+				rb_left_rotate(tree, sibling);
+				sibling = parent->left;
+			}
+
+			/* black sibling with red left child */
+			sibling->color = parent->color;
+			parent->color = RB_BLACK;
+			sibling->left->color = RB_BLACK;
+			rb_right_rotate(tree, parent);
+			node = tree->root.rb;
+		}
+	}
+
+	if (node)
+		node->color = RB_BLACK;
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void node_delete(struct tree_t *tree, int val)
+{
+	struct rb_node_t *node, *child, *parent, *min;
+	unsigned char color;
+
+	/* find node */
+	node = node_find(tree->root.rb, val);
+	if (!node)
+		return;
+
+	/* only one child or no child : replace this node with this child */
+	if (!node->left || !node->right) {
+		child = node->left ? node->left : node->right;
+		parent = node->parent;
+		color = node->color;
+		node_replace_child(tree, node, child);
+	/* two children : replace this node with minimum node of right child */
+	} else {
+		min = node_min(node->right);
+		color = min->color;
+		child = min->right;
+
+		/* detach minimum node */
+		if (min->parent == node) {
+			parent = min;
+		} else {
+			parent = min->parent;
+			node_replace_child(tree, min, min->right);
+			min->right = node->right;
+			min->right->parent = min;
+		}
+
+		/* put minimum node in place of this node */
+		node_replace_child(tree, node, min);
+		min->left = node->left;
+		min->left->parent = min;
+		min->color = node->color;
+	}
+
+	/* free node */
+	node_pool_free(tree->pool, node);
+	tree->size--;
+
+	/* a black node was removed : fix tree */
+	if (color == RB_BLACK)
+		node_delete_fixup(tree, child, parent);
+}
+
+/*
+ * Build a balanced node/tree from sorted values (last level is red if the tree is not perfect, values
+ * are left unset if keys is NULL).
+ */
+static struct rb_node_t *node_build(struct tree_t *tree, const int *keys, int n)
+{
+	struct {
+		int			start;
+		int			end;
+		int			depth;
+		struct rb_node_t *	parent;
+		struct rb_node_t **	link;
+	} stack[NODE_STACK_SIZE];
+	struct rb_node_t *root = NULL, *node, *parent, **link;
+	int top = 0, start, end, depth, mid, height;
+
+	/* compute height */
+	height = tree_balanced_height(n);
+
+	/* push whole range */
+	stack[top].start = 0;
+	stack[top].end = n - 1;
+	stack[top].depth = 1;
+	stack[top].parent = NULL;
+	stack[top++].link = &root;
+
+	while (top > 0) {
+		/* pop a range */
+		top--;
+		start = stack[top].start;
+		end = stack[top].end;
+		depth = stack[top].depth;
+		parent = stack[top].parent;
+		link = stack[top].link;
+
+		/* no more values */
+		if (start > end) {
+			*link = NULL;
+			continue;
+		}
+
+		/* make middle value as root */
+		mid = (start + end) / 2;
+		node = node_create(tree, keys ? keys[mid] : 0);
+		if (!node)
+			return NULL;
+		node->color = depth == height && height > 1 ? RB_RED : RB_BLACK;
+		node->parent = parent;
+		*link = node;
+
+		/* build right child */
+		stack[top].start = mid + 1;
+		stack[top].end = end;
+		stack[top].depth = depth + 1;
+		stack[top].parent = node;
+		stack[top++].link = &node->right;
+
+		/* build left child */
+		stack[top].start = start;
+		stack[top].end = mid - 1;
+		stack[top].depth = depth + 1;
+		stack[top].parent = node;
+		stack[top++].link = &node->left;
+	}
+
+	return root;
+}
+
+/*
+ * Read values of a node in order from a reader (parent links replace the stack).
+ */
+static int node_fill(struct rb_node_t *node, int (*read)(void *, int *, size_t), void *arg)
+{
+	for (node = node_min(node); node != NULL; node = node_next(node))
+		if (read(arg, &node->val, 1))
+			return -1;
+
+	return 0;
+}
+
+/*
+ * Init a tree.
+ */
+static int tree_init(struct tree_t *tree)
+{
+	if (!tree)
+		return -1;
+
+	/* create node pool */
+	tree->pool = node_pool_create(sizeof(struct rb_node_t));
+	if (!tree->pool)
+		return -1;
+
+	tree->size = 0;
+	tree->root.rb = NULL;
+
+	return 0;
+}
+
+/*
+ * Free a tree.
+ */
+static void tree_free(struct tree_t *tree)
+{
+	if (!tree)
+		return;
+
+	/* release all nodes at once */
+	node_pool_destroy(tree->pool);
+	free(tree);
+}
+
+/*
+ * Compute a tree height.
+ */
+static int tree_height(struct tree_t *tree)
+{
+	if (!tree)
+		return 0;
+
+	return node_height(tree->root.rb);
+}
+
+/*
+ * Get minimum value of a tree.
+ */
+static int tree_min(struct tree_t *tree, int *val)
+{
+	struct rb_node_t *node = tree ? node_min(tree->root.rb) : NULL;
+
+	if (!node)
+		return 0;
+
+	*val = node->val;
+	return 1;
+}
+
+/*
+ * Get maximum value of a tree.
+ */
+static int tree_max(struct tree_t *tree, int *val)
+{
+	struct rb_node_t *node = tree ? node_max(tree->root.rb) : NULL;
+
+	if (!node)
+		return 0;
+
+	*val = node->val;
+	return 1;
+}
+
+/*
+ * Find a node in a tree.
+ */
+static int tree_find(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return 0;
+
+	return node_find(tree->root.rb, val) != NULL;
+}
+
+/*
+ * Find n values in a tree (searches are interleaved, see tree_layout_find_many()).
+ */
+static void tree_find_interleaved(struct tree_t *tree, const int *keys, size_t n, uint8_t *out)
+{
+	if (!tree)
+		return;
+
+	tree_layout_find_many(tree->root.rb, &node_layout, keys, n, out);
+}
+
+/*
+ * Insert a value in a tree.
+ */
+static void tree_insert(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return;
+
+	node_insert(tree, val);
+	tree_relayout_update(tree);
+}
+
+/*
+ * Delete a value in a tree.
+ */
+static void tree_delete(struct tree_t *tree, int val)
+{
+	if (!tree)
+		return;
+
+	node_delete(tree, val);
+	tree_relayout_update(tree);
+}
+
+/*
+ * Balance a tree.
+ */
+static void tree_balance(struct tree_t *tree)
+{
+	/* nothing to do : red-black trees are always balanced */
+	UNUSED(tree);
+}
+
+/*
+ * Load values in a tree : a balanced tree is built from scratch in O(n) once values are sorted.
+ */
+static int tree_bulk_load(struct tree_t *tree, const int *keys, size_t n)
+{
+	struct node_pool_t *pool, *old_pool;
+	int *sorted, *merged, *old_keys;
+	size_t nr_old;
+	struct rb_node_t *root;
+
+	if (!tree)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* sort and deduplicate values */
+	sorted = tree_sort_keys(keys, &n);
+	if (!sorted)
+		return -1;
+
+	/* merge with values already in the tree */
+	if (tree->size > 0) {
+		old_keys = (int *) malloc(sizeof(int) * tree->size);
+		if (!old_keys)
+			goto err;
+
+		nr_old = node_keys(tree->root.rb, old_keys, tree->size);
+		merged = tree_merge_keys(sorted, n, old_keys, nr_old, &n);
+		free(old_keys);
+		if (!merged)
+			goto err;
+
+		free(sorted);
+		sorted = merged;
+	}
+
+	/* too many values */
+	if (n > INT_MAX)
+		goto err;
+
+	/* build tree in a fresh pool, so that nodes are packed */
+	pool = node_pool_create(sizeof(struct rb_node_t));
+	if (!pool)
+		goto err;
+	old_pool = tree->pool;
+	tree->pool = pool;
+	root = node_build(tree, sorted, n);
+	if (!root) {
+		tree->pool = old_pool;
+		node_pool_destroy(pool);
+		goto err;
+	}
+
+	/* release old nodes */
+	node_pool_destroy(old_pool);
+
+	/* set tree */
+	tree->root.rb = root;
+	tree->size = n;
+
+	free(sorted);
+	return 0;
+err:
+	free(sorted);
+	return -1;
+}
+
+/*
+ * Load n sorted distinct values from a reader in an empty tree : a balanced shape is built first,
+ * then values are read in order into it.
+ */
+static int tree_stream_load(struct tree_t *tree, size_t n, int (*read)(void *, int *, size_t), void *arg)
+{
+	struct rb_node_t *root;
+
+	if (!tree || tree->size > 0 || n > INT_MAX)
+		return -1;
+
+	/* nothing to load */
+	if (n == 0)
+		return 0;
+
+	/* nodes of a failed load stay in pool until tree is freed */
+	root = node_build(tree, NULL, n);
+	if (!root || node_fill(root, read, arg))
+		return -1;
+
+	/* set tree */
+	tree->root.rb = root;
+	tree->size = n;
+
+	return 0;
+}
+
+/*
+ * Store values of a tree in order (at most cap values). Returns number of values stored.
+ */
+static size_t tree_to_array(struct tree_t *tree, int *keys, size_t cap)
+{
+	if (!tree)
+		return 0;
+
+	return node_keys(tree->root.rb, keys, cap);
+}
+
+/*
+ * Set iterator current node (parent links replace the path).
+ */
+static int iter_set(struct tree_iter_t *iter, struct rb_node_t *node, int state)
+{
+	if (!node) {
+		tree_iter_reset(iter, state);
+		return 0;
+	}
+
+	tree_iter_reset(iter, TREE_ITER_VALUE);
+	tree_iter_push(iter, node);
+	iter->val = node->val;
+	return 1;
+}
+
+/*
+ * Seek first value >= val in a tree.
+ */
+static int tree_seek(struct tree_iter_t *iter, struct tree_t *tree, int val)
+{
+	struct rb_node_t *node, *found = NULL;
+
+	if (!iter || !tree)
+		return 0;
+
+	for (node = tree->root.rb; node != NULL;) {
+		if (val < node->val) {
+			found = node;
+			node = node->left;
+		} else if (val > node->val) {
+			node = node->right;
+		} else {
+			found = node;
+			break;
+		}
+	}
+
+	iter->tree = tree;
+	return iter_set(iter, found, TREE_ITER_END);
+}
+
+/*
+ * Move an iterator to next value.
+ */
+static int tree_next(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_END)
+		return 0;
+	if (iter->state == TREE_ITER_BEGIN)
+		return iter_set(iter, node_min(iter->tree->root.rb), TREE_ITER_END);
+
+	return iter_set(iter, node_next((struct rb_node_t *) tree_iter_peek(iter)), TREE_ITER_END);
+}
+
+/*
+ * Move an iterator to previous value.
+ */
+static int tree_prev(struct tree_iter_t *iter)
+{
+	if (!iter || iter->state == TREE_ITER_BEGIN)
+		return 0;
+	if (iter->state == TREE_ITER_END)
+		return iter_set(iter, node_max(iter->tree->root.rb), TREE_ITER_BEGIN);
+
+	return iter_set(iter, node_prev((struct rb_node_t *) tree_iter_peek(iter)), TREE_ITER_BEGIN);
+}
+
+/*
+ * Copy a tree into fresh nodes, in van Emde Boas order, if it is fragmented.
+ */
+static int tree_relayout_nodes(struct tree_t *tree, int threshold)
+{
+	void *root;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	root = tree->root.rb;
+	ret = tree_layout_relayout(tree, &root, &node_layout, threshold);
+	tree->root.rb = (struct rb_node_t *) root;
+
+	return ret;
+}
+
+/*
+ * Red-black tree operations.
+ */
+struct tree_operations_t rb_tree_ops = {
+	.init			= tree_init,
+	.height			= tree_height,
+	.min			= tree_min,
+	.max			= tree_max,
+	.find			= tree_find,
+	.find_many		= tree_find_interleaved,
+	.insert			= tree_insert,
+	.delete			= tree_delete,
+	.balance		= tree_balance,
+	.bulk_load		= tree_bulk_load,
+	.stream_load		= tree_stream_load,
+	.to_array		= tree_to_array,
+	.seek			= tree_seek,
+	.next			= tree_next,
+	.prev			= tree_prev,
+	.relayout		= tree_relayout_nodes,
+	.free			= tree_free,
+};
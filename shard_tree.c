@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "tree.h"
+
+/*
+ * Get shard of a value.
+ */
+static struct shard_t *shard_of(struct shard_tree_t *st, int val)
+{
+	long long i;
+
+	if (val <= st->lo)
+		return &st->shards[0];
+	if (val >= st->hi)
+		return &st->shards[st->nr_shards - 1];
+
+	i = ((long long) val - st->lo) * st->nr_shards / ((long long) st->hi - st->lo + 1);
+	return &st->shards[i];
+}
+
+/*
+ * Is a shard queue empty ?
+ */
+static int shard_empty(struct shard_t *shard)
+{
+	struct shard_op_t *slot = &shard->slots[shard->tail % SHARD_QUEUE_SIZE];
+
+	return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != shard->tail + 1;
+}
+
+/*
+ * Queue an operation on a shard (waits while queue is full).
+ */
+static void shard_push(struct shard_t *shard, int op, int val)
+{
+	unsigned long pos, seq;
+	struct shard_op_t *slot;
+
+	/* reserve a slot */
+	for (pos = __atomic_load_n(&shard->head, __ATOMIC_RELAXED);;) {
+		slot = &shard->slots[pos % SHARD_QUEUE_SIZE];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&shard->head, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else {
+			/* queue is full : let worker run */
+			if ((long) (seq - pos) < 0)
+				sched_yield();
+
+			pos = __atomic_load_n(&shard->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	/* fill and publish slot */
+	slot->op = op;
+	slot->val = val;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* wake up worker */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shard->sleeping, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&shard->lock);
+		pthread_cond_signal(&shard->wake);
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/*
+ * Dequeue up to SHARD_BATCH_SIZE operations (worker only).
+ */
+static int shard_pop_batch(struct shard_t *shard, struct shard_op_t *batch)
+{
+	struct shard_op_t *slot;
+	int n;
+
+	for (n = 0; n < SHARD_BATCH_SIZE; n++) {
+		slot = &shard->slots[shard->tail % SHARD_QUEUE_SIZE];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != shard->tail + 1)
+			break;
+
+		/* queue position keeps operations order on a value */
+		batch[n].seq = shard->tail;
+		batch[n].op = slot->op;
+		batch[n].val = slot->val;
+
+		/* slot is free for next lap */
+		__atomic_store_n(&slot->seq, shard->tail + SHARD_QUEUE_SIZE, __ATOMIC_RELEASE);
+		shard->tail++;
+	}
+
+	return n;
+}
+
+/*
+ * Compare two queued operations (by value, then by queue position).
+ */
+static int shard_op_cmp(const void *a, const void *b)
+{
+	const struct shard_op_t *x = (const struct shard_op_t *) a, *y = (const struct shard_op_t *) b;
+
+	if (x->val != y->val)
+		return x->val < y->val ? -1 : 1;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/*
+ * Wait for operations (worker only).
+ */
+static void shard_sleep(struct shard_t *shard)
+{
+	pthread_mutex_lock(&shard->lock);
+
+	__atomic_store_n(&shard->sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/* an operation may have been queued before sleeping flag was seen */
+	if (shard_empty(shard) && !__atomic_load_n(&shard->stop, __ATOMIC_ACQUIRE))
+		pthread_cond_wait(&shard->wake, &shard->lock);
+
+	__atomic_store_n(&shard->sleeping, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/*
+ * Shard worker : apply queued operations by batches, sorted by value so that consecutive updates
+ * walk down the same paths.
+ */
+static void *shard_worker(void *arg)
+{
+	struct shard_op_t batch[SHARD_BATCH_SIZE];
+	struct shard_t *shard = (struct shard_t *) arg;
+	struct tree_t *tree = shard->tree;
+	int n, i;
+
+	for (;;) {
+		n = shard_pop_batch(shard, batch);
+
+		/* queue is drained : stop or wait */
+		if (n == 0) {
+			if (__atomic_load_n(&shard->stop, __ATOMIC_ACQUIRE))
+				break;
+
+			shard_sleep(shard);
+			continue;
+		}
+
+		qsort(batch, n, sizeof(struct shard_op_t), shard_op_cmp);
+
+		for (i = 0; i < n; i++) {
+			if (batch[i].op == SHARD_OP_INSERT)
+				tree->ops->insert(tree, batch[i].val);
+			else
+				tree->ops->delete(tree, batch[i].val);
+		}
+
+		__atomic_add_fetch(&shard->applied, n, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/*
+ * Stop a shard worker and free the shard.
+ */
+static void shard_exit(struct shard_t *shard)
+{
+	pthread_mutex_lock(&shard->lock);
+	__atomic_store_n(&shard->stop, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&shard->wake);
+	pthread_mutex_unlock(&shard->lock);
+
+	pthread_join(shard->thread, NULL);
+	pthread_mutex_destroy(&shard->lock);
+	pthread_cond_destroy(&shard->wake);
+	shard->tree->ops->free(shard->tree);
+	free(shard->slots);
+}
+
+/*
+ * Init a shard and start its worker.
+ */
+static int shard_init(struct shard_t *shard)
+{
+	unsigned long i;
+
+	shard->head = 0;
+	shard->tail = 0;
+	shard->applied = 0;
+	shard->sleeping = 0;
+	shard->stop = 0;
+
+	/* create queue */
+	shard->slots = (struct shard_op_t *) malloc(sizeof(struct shard_op_t) * SHARD_QUEUE_SIZE);
+	if (!shard->slots)
+		return -1;
+
+	for (i = 0; i < SHARD_QUEUE_SIZE; i++)
+		shard->slots[i].seq = i;
+
+	/* create tree */
+	shard->tree = tree_create(TREE_TYPE_AVL);
+	if (!shard->tree)
+		goto err_slots;
+	if (avl_tree_set_concurrent(shard->tree))
+		goto err_tree;
+
+	/* start worker */
+	pthread_mutex_init(&shard->lock, NULL);
+	pthread_cond_init(&shard->wake, NULL);
+	if (pthread_create(&shard->thread, NULL, shard_worker, shard))
+		goto err_lock;
+
+	return 0;
+err_lock:
+	pthread_mutex_destroy(&shard->lock);
+	pthread_cond_destroy(&shard->wake);
+err_tree:
+	shard->tree->ops->free(shard->tree);
+err_slots:
+	free(shard->slots);
+	return -1;
+}
+
+/*
+ * Create a sharded tree over key range [lo, hi] (one shard per online CPU if nr_shards <= 0).
+ * Updates are applied asynchronously by shard workers, lookups and scans don't wait for them.
+ */
+struct shard_tree_t *shard_tree_create(int nr_shards, int lo, int hi)
+{
+	struct shard_tree_t *st;
+
+	if (lo > hi)
+		return NULL;
+
+	if (nr_shards <= 0)
+		nr_shards = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_shards <= 0)
+		nr_shards = 1;
+
+	/* allocate a sharded tree */
+	st = (struct shard_tree_t *) malloc(sizeof(struct shard_tree_t));
+	if (!st)
+		return NULL;
+
+	if (posix_memalign((void **) &st->shards, NODE_POOL_ALIGN, sizeof(struct shard_t) * nr_shards)) {
+		free(st);
+		return NULL;
+	}
+
+	st->lo = lo;
+	st->hi = hi;
+
+	/* start shards */
+	for (st->nr_shards = 0; st->nr_shards < nr_shards; st->nr_shards++) {
+		if (shard_init(&st->shards[st->nr_shards])) {
+			shard_tree_free(st);
+			return NULL;
+		}
+	}
+
+	return st;
+}
+
+/*
+ * Free a sharded tree (queued operations are applied first, no other thread may use it anymore).
+ */
+void shard_tree_free(struct shard_tree_t *st)
+{
+	int i;
+
+	if (!st)
+		return;
+
+	for (i = 0; i < st->nr_shards; i++)
+		shard_exit(&st->shards[i]);
+
+	free(st->shards);
+	free(st);
+}
+
+/*
+ * Queue insertion of a value.
+ */
+void shard_tree_insert(struct shard_tree_t *st, int val)
+{
+	if (!st)
+		return;
+
+	shard_push(shard_of(st, val), SHARD_OP_INSERT, val);
+}
+
+/*
+ * Queue deletion of a value.
+ */
+void shard_tree_delete(struct shard_tree_t *st, int val)
+{
+	if (!st)
+		return;
+
+	shard_push(shard_of(st, val), SHARD_OP_DELETE, val);
+}
+
+/*
+ * Wait until all operations queued so far are applied.
+ */
+void shard_tree_flush(struct shard_tree_t *st)
+{
+	struct shard_t *shard;
+	unsigned long head;
+	int i;
+
+	if (!st)
+		return;
+
+	for (i = 0; i < st->nr_shards; i++) {
+		shard = &st->shards[i];
+		head = __atomic_load_n(&shard->head, __ATOMIC_ACQUIRE);
+
+		while (__atomic_load_n(&shard->applied, __ATOMIC_ACQUIRE) < head)
+			sched_yield();
+	}
+}
+
+/*
+ * Find a value (lock free, operations still queued are not seen).
+ */
+int shard_tree_find(struct shard_tree_t *st, int val)
+{
+	struct tree_t *tree;
+
+	if (!st)
+		return 0;
+
+	tree = shard_of(st, val)->tree;
+	return tree->ops->find(tree, val);
+}
+
+/*
+ * Scan state (remembers whether callback stopped the scan).
+ */
+struct shard_scan_t {
+	int				(*callback)(int, void *);
+	void *				arg;
+	int				stopped;
+};
+
+/*
+ * Scan callback wrapper.
+ */
+static int shard_scan_callback(int val, void *arg)
+{
+	struct shard_scan_t *scan = (struct shard_scan_t *) arg;
+
+	scan->stopped = scan->callback(val, scan->arg);
+	return scan->stopped;
+}
+
+/*
+ * Call a function on each value in [lo, hi] in order : shards cover consecutive key ranges, so
+ * scanning them one after another merges their values. Each shard is scanned in one epoch and
+ * returns a consistent view of itself. Returns number of values seen.
+ */
+int shard_tree_scan_range(struct shard_tree_t *st, int lo, int hi, int (*callback)(int, void *), void *arg)
+{
+	struct shard_scan_t scan = { callback, arg, 0 };
+	struct shard_t *shard, *last;
+	int ret, n = 0;
+
+	if (!st || !callback)
+		return -1;
+	if (lo > hi)
+		return 0;
+
+	for (shard = shard_of(st, lo), last = shard_of(st, hi); shard <= last && !scan.stopped; shard++) {
+		epoch_enter();
+		ret = tree_scan_range(shard->tree, lo, hi, shard_scan_callback, &scan);
+		epoch_exit();
+
+		if (ret < 0)
+			return -1;
+		n += ret;
+	}
+
+	return n;
+}
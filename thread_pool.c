@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tree.h"
+
+/*
+ * Pop a pending task (thread pool must be locked).
+ */
+static struct thread_task_t *thread_pool_pop(struct thread_pool_t *tp)
+{
+	struct thread_task_t *task = tp->tasks;
+
+	if (task) {
+		tp->tasks = task->next;
+		task->state = THREAD_TASK_RUNNING;
+	}
+
+	return task;
+}
+
+/*
+ * Run a task (thread pool must be locked, it is unlocked while task runs).
+ */
+static void thread_pool_run(struct thread_pool_t *tp, struct thread_task_t *task)
+{
+	pthread_mutex_unlock(&tp->lock);
+	task->func(task->arg);
+	pthread_mutex_lock(&tp->lock);
+
+	task->state = THREAD_TASK_DONE;
+	pthread_cond_broadcast(&tp->done);
+}
+
+/*
+ * Worker thread.
+ */
+static void *thread_pool_worker(void *arg)
+{
+	struct thread_pool_t *tp = (struct thread_pool_t *) arg;
+	struct thread_task_t *task;
+
+	pthread_mutex_lock(&tp->lock);
+
+	while (!tp->stop) {
+		task = thread_pool_pop(tp);
+		if (task)
+			thread_pool_run(tp, task);
+		else
+			pthread_cond_wait(&tp->work, &tp->lock);
+	}
+
+	pthread_mutex_unlock(&tp->lock);
+	return NULL;
+}
+
+/*
+ * Create a thread pool (one thread per online CPU if nr_threads <= 0).
+ */
+struct thread_pool_t *thread_pool_create(int nr_threads)
+{
+	struct thread_pool_t *tp;
+
+	if (nr_threads <= 0)
+		nr_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads <= 0)
+		nr_threads = 1;
+
+	/* allocate a thread pool */
+	tp = (struct thread_pool_t *) malloc(sizeof(struct thread_pool_t));
+	if (!tp)
+		return NULL;
+
+	tp->threads = (pthread_t *) malloc(sizeof(pthread_t) * nr_threads);
+	if (!tp->threads) {
+		free(tp);
+		return NULL;
+	}
+
+	/* set thread pool */
+	pthread_mutex_init(&tp->lock, NULL);
+	pthread_cond_init(&tp->work, NULL);
+	pthread_cond_init(&tp->done, NULL);
+	tp->tasks = NULL;
+	tp->stop = 0;
+
+	/* start workers */
+	for (tp->nr_threads = 0; tp->nr_threads < nr_threads; tp->nr_threads++) {
+		if (pthread_create(&tp->threads[tp->nr_threads], NULL, thread_pool_worker, tp)) {
+			thread_pool_destroy(tp);
+			return NULL;
+		}
+	}
+
+	return tp;
+}
+
+/*
+ * Destroy a thread pool (pending tasks must have been waited for).
+ */
+void thread_pool_destroy(struct thread_pool_t *tp)
+{
+	int i;
+
+	if (!tp)
+		return;
+
+	/* stop workers */
+	pthread_mutex_lock(&tp->lock);
+	tp->stop = 1;
+	pthread_cond_broadcast(&tp->work);
+	pthread_mutex_unlock(&tp->lock);
+
+	for (i = 0; i < tp->nr_threads; i++)
+		pthread_join(tp->threads[i], NULL);
+
+	/* free thread pool */
+	pthread_cond_destroy(&tp->done);
+	pthread_cond_destroy(&tp->work);
+	pthread_mutex_destroy(&tp->lock);
+	free(tp->threads);
+	free(tp);
+}
+
+/*
+ * Submit a task (task memory must stay valid until it is waited for).
+ */
+void thread_pool_submit(struct thread_pool_t *tp, struct thread_task_t *task)
+{
+	pthread_mutex_lock(&tp->lock);
+
+	/* push task : most recent tasks are run first */
+	task->state = THREAD_TASK_PENDING;
+	task->next = tp->tasks;
+	tp->tasks = task;
+
+	pthread_cond_signal(&tp->work);
+	pthread_mutex_unlock(&tp->lock);
+}
+
+/*
+ * Wait for a task : run it here if no worker took it yet, or help with other tasks meanwhile.
+ */
+void thread_pool_wait(struct thread_pool_t *tp, struct thread_task_t *task)
+{
+	struct thread_task_t **link, *other;
+
+	pthread_mutex_lock(&tp->lock);
+
+	/* task not started : take it back */
+	if (task->state == THREAD_TASK_PENDING) {
+		for (link = &tp->tasks; *link != task;)
+			link = &(*link)->next;
+
+		*link = task->next;
+		task->state = THREAD_TASK_RUNNING;
+		thread_pool_run(tp, task);
+	}
+
+	/* task running elsewhere : run other tasks until it is done */
+	while (task->state != THREAD_TASK_DONE) {
+		other = thread_pool_pop(tp);
+		if (other)
+			thread_pool_run(tp, other);
+		else
+			pthread_cond_wait(&tp->done, &tp->lock);
+	}
+
+	pthread_mutex_unlock(&tp->lock);
+}
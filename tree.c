@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "tree.h"
 
@@ -23,6 +24,24 @@ struct tree_t *tree_create(int type)
 		case TREE_TYPE_AVL:
 			tree->ops = &avl_tree_ops;
 			break;
+		case TREE_TYPE_RB:
+			tree->ops = &rb_tree_ops;
+			break;
+		case TREE_TYPE_BPLUS:
+			tree->ops = &bplus_tree_ops;
+			break;
+		case TREE_TYPE_LOCKFREE:
+			tree->ops = &lockfree_tree_ops;
+			break;
+		case TREE_TYPE_MMAP:
+			tree->ops = &mmap_tree_ops;
+			break;
+		case TREE_TYPE_COMPACT_BINARY:
+			tree->ops = &compact_binary_tree_ops;
+			break;
+		case TREE_TYPE_COMPACT_AVL:
+			tree->ops = &compact_avl_tree_ops;
+			break;
 		default:
 			fprintf(stderr, "unknown tree type %d\n", type);
 			free(tree);
@@ -30,8 +49,260 @@ struct tree_t *tree_create(int type)
 	}
 
 	/* init tree */
-	tree->ops->init(tree);
+	tree->type = type;
+	tree->flags = 0;
+	tree->rcu = NULL;
+	tree->relayout_threshold = 0;
+	tree->nr_updates = 0;
+	if (tree->ops->init(tree)) {
+		free(tree);
+		return NULL;
+	}
 
 	return tree;
 }
 
+/*
+ * Find n values in a tree (out[i] is set if keys[i] is found) : searches are interleaved when the
+ * backend supports it, so that their cache misses overlap.
+ */
+void tree_find_many(struct tree_t *tree, const int *keys, size_t n, uint8_t *out)
+{
+	size_t i;
+
+	if (!tree || !keys || !out)
+		return;
+
+	if (tree->ops->find_many) {
+		tree->ops->find_many(tree, keys, n, out);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		out[i] = tree->ops->find(tree, keys[i]);
+}
+
+/*
+ * Insert n values in a tree : the batch is applied at once when the backend supports it (in parallel
+ * if a thread pool is given), else values are inserted one by one. Returns 0 or -1.
+ */
+int tree_insert_batch(struct tree_t *tree, const int *keys, size_t n, struct thread_pool_t *tp)
+{
+	size_t i;
+
+	if (!tree || (n > 0 && !keys))
+		return -1;
+
+	if (tree->ops->insert_batch)
+		return tree->ops->insert_batch(tree, keys, n, tp);
+
+	for (i = 0; i < n; i++)
+		tree->ops->insert(tree, keys[i]);
+
+	return 0;
+}
+
+/*
+ * Delete n values from a tree (see tree_insert_batch()).
+ */
+int tree_delete_batch(struct tree_t *tree, const int *keys, size_t n, struct thread_pool_t *tp)
+{
+	size_t i;
+
+	if (!tree || (n > 0 && !keys))
+		return -1;
+
+	if (tree->ops->delete_batch)
+		return tree->ops->delete_batch(tree, keys, n, tp);
+
+	for (i = 0; i < n; i++)
+		tree->ops->delete(tree, keys[i]);
+
+	return 0;
+}
+
+/*
+ * Copy a pointer tree into a fresh node pool, in cache friendly order, if its fragmentation (percentage
+ * of far links) is at least threshold (0 forces it). Returns 1 if done, 0 if not needed, -1 on error.
+ */
+int tree_relayout(struct tree_t *tree, int threshold)
+{
+	if (!tree || !tree->ops->relayout)
+		return -1;
+
+	return tree->ops->relayout(tree, threshold);
+}
+
+/*
+ * Relayout a tree automatically once its fragmentation reaches threshold (0 disables it).
+ */
+void tree_set_auto_relayout(struct tree_t *tree, int threshold)
+{
+	if (!tree || !tree->ops->relayout)
+		return;
+
+	tree->relayout_threshold = threshold > 0 ? threshold : 0;
+	tree->nr_updates = 0;
+}
+
+/*
+ * Print tree allocation statistics.
+ */
+void tree_print_stats(struct tree_t *tree, FILE *fp)
+{
+	struct node_pool_stats_t *stats;
+
+	if (!tree || !tree->pool)
+		return;
+
+	stats = &tree->pool->stats;
+	fprintf(fp, "nodes        : %zu (peak %zu)\n", stats->nr_nodes, stats->max_nodes);
+	fprintf(fp, "allocations  : %zu\n", stats->nr_allocs);
+	fprintf(fp, "frees        : %zu\n", stats->nr_frees);
+	fprintf(fp, "slabs        : %zu\n", stats->nr_slabs);
+	fprintf(fp, "bytes        : %zu (%zu per node)\n", stats->bytes, tree->pool->node_size);
+}
+
+/*
+ * Call a function on each value in [lo, hi] in order (stops early if callback returns non zero).
+ * Callback runs in an epoch : it must not update the tree.
+ */
+int tree_scan_range(struct tree_t *tree, int lo, int hi, int (*callback)(int, void *), void *arg)
+{
+	struct tree_iter_t iter;
+	int ret, n = 0;
+
+	if (!tree || !tree->ops->seek || !callback)
+		return -1;
+
+	/* iterators of concurrent trees must run in an epoch */
+	epoch_enter();
+	for (ret = tree->ops->seek(&iter, tree, lo); ret && iter.val <= hi; ret = tree->ops->next(&iter)) {
+		n++;
+		if (callback(iter.val, arg))
+			break;
+	}
+	epoch_exit();
+
+	return n;
+}
+
+/*
+ * Radix sort unsigned keys (LSD, 8 bits per pass).
+ */
+static void radix_sort(unsigned int *keys, unsigned int *tmp, size_t n)
+{
+	unsigned int *src = keys, *dst = tmp, *swap;
+	size_t count[256], i, sum, c;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		/* count digits */
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++)
+			count[(src[i] >> shift) & 0xFF]++;
+
+		/* all keys share this digit : skip pass */
+		if (count[(src[0] >> shift) & 0xFF] == n)
+			continue;
+
+		/* compute digits positions */
+		for (i = 0, sum = 0; i < 256; i++) {
+			c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+
+		/* scatter keys */
+		for (i = 0; i < n; i++)
+			dst[count[(src[i] >> shift) & 0xFF]++] = src[i];
+
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	/* sorted keys ended in temporary buffer */
+	if (src != keys)
+		memcpy(keys, src, sizeof(unsigned int) * n);
+}
+
+/*
+ * Sort and deduplicate keys : returns an allocated array and updates n.
+ */
+int *tree_sort_keys(const int *keys, size_t *n)
+{
+	unsigned int *tmp;
+	size_t i, j;
+	int *sorted;
+
+	/* copy keys */
+	sorted = (int *) malloc(sizeof(int) * (*n ? *n : 1));
+	if (!sorted)
+		return NULL;
+	memcpy(sorted, keys, sizeof(int) * *n);
+
+	/* check if keys are already sorted */
+	for (i = 1; i < *n; i++)
+		if (sorted[i] < sorted[i - 1])
+			break;
+
+	/* sort keys (sign bit is flipped so that unsigned order matches signed order) */
+	if (i < *n) {
+		tmp = (unsigned int *) malloc(sizeof(unsigned int) * *n);
+		if (!tmp) {
+			free(sorted);
+			return NULL;
+		}
+
+		for (i = 0; i < *n; i++)
+			sorted[i] ^= INT_MIN;
+		radix_sort((unsigned int *) sorted, tmp, *n);
+		for (i = 0; i < *n; i++)
+			sorted[i] ^= INT_MIN;
+
+		free(tmp);
+	}
+
+	/* remove duplicates */
+	for (i = 1, j = 1; i < *n; i++)
+		if (sorted[i] != sorted[j - 1])
+			sorted[j++] = sorted[i];
+	if (*n > 0)
+		*n = j;
+
+	return sorted;
+}
+
+/*
+ * Merge two sorted and deduplicated arrays : returns an allocated array and sets n.
+ */
+int *tree_merge_keys(const int *a, size_t na, const int *b, size_t nb, size_t *n)
+{
+	size_t i = 0, j = 0, k = 0;
+	int *keys;
+
+	/* allocate merged keys */
+	keys = (int *) malloc(sizeof(int) * (na + nb ? na + nb : 1));
+	if (!keys)
+		return NULL;
+
+	/* merge keys */
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			keys[k++] = a[i++];
+		else if (a[i] > b[j])
+			keys[k++] = b[j++];
+		else
+			keys[k++] = a[i++], j++;
+	}
+
+	/* copy remaining keys */
+	while (i < na)
+		keys[k++] = a[i++];
+	while (j < nb)
+		keys[k++] = b[j++];
+
+	*n = k;
+	return keys;
+}
@@ -1,14 +1,90 @@
 #ifndef _TREE_H_
 #define _TREE_H_
 
-#include <gtk/gtk.h>
-
-#define NODE_SIZE_X			20
-#define NODE_SIZE_Y			20
-#define NODE_FONT			"Arial"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
 
 #define TREE_TYPE_BINARY		1
 #define TREE_TYPE_AVL			2
+#define TREE_TYPE_RB			3
+#define TREE_TYPE_BPLUS			4
+#define TREE_TYPE_LOCKFREE		5
+#define TREE_TYPE_MMAP			6
+#define TREE_TYPE_COMPACT_BINARY	7
+#define TREE_TYPE_COMPACT_AVL		8
+
+#define RB_RED				0
+#define RB_BLACK			1
+
+#define NODE_POOL_MIN_SLAB		64
+#define NODE_POOL_MAX_SLAB		65536
+#define NODE_POOL_ALIGN			64
+
+#define NODE_STACK_SIZE			64
+
+#define BPLUS_INNER_KEYS		16
+#define BPLUS_LEAF_KEYS			56
+#define BPLUS_MAX_DEPTH			32
+
+#define TREE_HEIGHT_UNKNOWN		-1
+
+#define TREE_BALANCE_ARRAY		0
+#define TREE_BALANCE_DSW		1
+
+#define MMAP_TREE_MAGIC			0x50414D54
+#define MMAP_TREE_VERSION		1
+#define MMAP_TREE_HEADER_NODES		2
+#define MMAP_TREE_MIN_NODES		1024
+#define MMAP_TREE_MAX_NODES		0xFFFFFFFFUL
+
+#define COMPACT_TREE_HEAVY		0x80000000U
+#define COMPACT_TREE_INDEX_MASK		0x7FFFFFFFU
+#define COMPACT_TREE_MIN_NODES		1024
+#define COMPACT_TREE_MAX_NODES		0x7FFFFFFFUL
+
+#define TREE_LAYOUT_NEAR		4096
+#define TREE_LAYOUT_VEB_MAX_HEIGHT	64
+#define TREE_LAYOUT_NO_PARENT		((size_t) -1)
+#define TREE_RELAYOUT_MIN_SIZE		4096
+#define TREE_RELAYOUT_THRESHOLD		50
+
+#define TREE_FIND_MANY_GROUP		16
+
+#define TREE_FILE_MAGIC			0x45455254
+#define TREE_FILE_VERSION		1
+#define TREE_FILE_BUFFER_SIZE		65536
+
+#define TREE_WAL_MAGIC			0x4C415754
+#define TREE_WAL_HEADER_SIZE		12
+#define TREE_WAL_RECORD_SIZE		5
+#define TREE_WAL_MAX_BATCH		(1 << 20)
+#define TREE_WAL_OP_INSERT		0
+#define TREE_WAL_OP_DELETE		1
+
+#define TREE_FLAG_PERSISTENT		0x1
+#define TREE_FLAG_CONCURRENT		0x2
+#define TREE_FLAG_RECURSIVE		0x4
+
+#define TREE_RCU_MAX_FRESH		192
+
+#define EPOCH_MAX_THREADS		1024
+#define EPOCH_NR_BAGS			3
+
+#define SHARD_QUEUE_SIZE		4096
+#define SHARD_BATCH_SIZE		256
+#define SHARD_OP_INSERT			0
+#define SHARD_OP_DELETE			1
+
+#define TREE_ITER_BEGIN			-1
+#define TREE_ITER_VALUE			0
+#define TREE_ITER_END			1
+
+#define THREAD_TASK_PENDING		0
+#define THREAD_TASK_RUNNING		1
+#define THREAD_TASK_DONE		2
 
 #define UNUSED(x)			((void) x)
 
@@ -17,20 +93,186 @@
  */
 struct binary_node_t {
 	int				val;
+	int				size;
 	struct binary_node_t *		left;
 	struct binary_node_t *		right;
 };
 
 /*
- * AVL node structure.
+ * AVL node structure (32 bytes : size shares its 8 bytes slot with refs, without it the node would
+ * still be padded to 32 bytes for its links, see compact trees for 12 bytes nodes).
  */
 struct avl_node_t {
 	int				val;
 	int				height;
+	int				size;
+	int				refs;
 	struct avl_node_t *		left;
 	struct avl_node_t *		right;
 };
 
+/*
+ * Red-black node structure.
+ */
+struct rb_node_t {
+	int				val;
+	unsigned char			color;
+	struct rb_node_t *		left;
+	struct rb_node_t *		right;
+	struct rb_node_t *		parent;
+};
+
+/*
+ * B+ node structure (4 cache lines) : inner nodes route with separators, leaves hold values and are linked.
+ * Unused key slots hold INT_MAX so that a node can be searched without looking at its number of keys.
+ */
+struct bplus_node_t {
+	int				nr_keys;
+	int				leaf;
+	union {
+		struct {
+			int			keys[BPLUS_INNER_KEYS];
+			struct bplus_node_t *	children[BPLUS_INNER_KEYS + 1];
+		} inner_node;
+		struct {
+			struct bplus_node_t *	prev;
+			struct bplus_node_t *	next;
+			int			keys[BPLUS_LEAF_KEYS];
+		} leaf_node;
+	};
+} __attribute__((aligned(NODE_POOL_ALIGN)));
+
+/*
+ * Lock free node structure (external tree : values are in leaves, inner nodes only route searches).
+ * Child links carry flag and tag bits, leaves have no links.
+ */
+struct lockfree_node_t {
+	long long			key;
+	uintptr_t			left;
+	uintptr_t			right;
+};
+
+/*
+ * Memory mapped node structure : children are node offsets in the mapping (0 is no child).
+ */
+struct mmap_node_t {
+	int				val;
+	int				height;
+	uint32_t			left;
+	uint32_t			right;
+};
+
+/*
+ * Compact node structure (12 bytes) : children are 31 bits indexes in the tree node array (0 is no child).
+ * AVL balance is packed in top bits of links : left bit is set if left child is higher, right bit if
+ * right child is.
+ */
+struct compact_node_t {
+	int				val;
+	uint32_t			left;
+	uint32_t			right;
+};
+
+/*
+ * Compact tree : nodes live in one contiguous array (first node is unused).
+ */
+struct compact_tree_t {
+	struct compact_node_t *		nodes;
+	uint32_t			root;
+	uint32_t			free_list;
+	uint32_t			nr_nodes;
+	uint32_t			capacity;
+};
+
+/*
+ * Memory mapped tree header (first MMAP_TREE_HEADER_NODES nodes of the mapping).
+ */
+struct mmap_header_t {
+	uint32_t			magic;
+	uint32_t			version;
+	uint32_t			node_size;
+	uint32_t			root;
+	uint32_t			free_list;
+	uint32_t			nr_nodes;
+	uint32_t			capacity;
+	uint32_t			size;
+};
+
+/*
+ * Memory mapped tree : nodes live in a file mapping (or anonymous memory).
+ */
+struct mmap_tree_t {
+	int				fd;
+	struct mmap_header_t *		header;
+	struct mmap_node_t *		nodes;
+	size_t				length;
+};
+
+/*
+ * Node pool slab (nodes follow the header).
+ */
+struct node_slab_t {
+	struct node_slab_t *		next;
+	size_t				nr_nodes;
+};
+
+/*
+ * Node pool statistics.
+ */
+struct node_pool_stats_t {
+	size_t				nr_slabs;
+	size_t				nr_allocs;
+	size_t				nr_frees;
+	size_t				nr_nodes;
+	size_t				max_nodes;
+	size_t				capacity;
+	size_t				bytes;
+};
+
+/*
+ * Node pool : nodes are carved out of slabs and recycled through a free list.
+ */
+struct node_pool_t {
+	size_t				node_size;
+	size_t				slab_nodes;
+	struct node_slab_t *		slabs;
+	void *				free_list;
+	void *				deferred;
+	char *				next;
+	char *				end;
+	struct node_pool_stats_t	stats;
+	int				refs;
+};
+
+/*
+ * Epoch bag : pointers retired during an epoch.
+ */
+struct epoch_bag_t {
+	void **				ptrs;
+	size_t				nr;
+	size_t				max;
+	unsigned long			epoch;
+};
+
+/*
+ * Epoch limbo : pointers waiting for readers to leave (owned by one writer).
+ */
+struct epoch_limbo_t {
+	struct epoch_bag_t		bags[EPOCH_NR_BAGS];
+};
+
+/*
+ * Concurrent tree writer state : nodes created and replaced by current update (readers only see
+ * them once new root is published) and retired nodes.
+ */
+struct tree_rcu_t {
+	void *				fresh[TREE_RCU_MAX_FRESH];
+	int				nr_fresh;
+	void *				stale[TREE_RCU_MAX_FRESH];
+	int				nr_stale;
+	struct epoch_limbo_t		limbo;
+};
+
 /*
  * Tree structure.
  */
@@ -38,32 +280,433 @@ struct tree_t {
 	union {
 		struct binary_node_t *	binary;
 		struct avl_node_t *	avl;
+		struct rb_node_t *	rb;
+		struct bplus_node_t *	bplus;
+		struct lockfree_node_t *lockfree;
+		struct mmap_tree_t *	mmap;
+		struct compact_tree_t *	compact;
 	} root;
+	int				type;
 	int				size;
+	int				height;
+	int				min;
+	int				max;
+	int				balance_mode;
+	int				flags;
+	struct tree_rcu_t *		rcu;
+	int				relayout_threshold;
+	size_t				nr_updates;
+	struct node_pool_t *		pool;
 	struct tree_operations_t *	ops;
 };
 
+/*
+ * Pointer tree layout : node size and offsets of links (to copy trees of any node type).
+ */
+struct tree_layout_t {
+	size_t				node_size;
+	size_t				val;
+	size_t				left;
+	size_t				right;
+	size_t				parent;
+};
+
+/*
+ * Tree iterator : path from root to current node, kept in a ring so that only the nearest
+ * ancestors are remembered on very deep trees (the iterator re-seeks from the root when
+ * it climbs past them). Any tree update invalidates iterators.
+ */
+struct tree_iter_t {
+	struct tree_t *			tree;
+	void *				path[NODE_STACK_SIZE];
+	int				top;
+	int				depth;
+	int				pos;
+	int				state;
+	int				val;
+};
+
+/*
+ * Eytzinger snapshot : an immutable copy of a tree, stored in BFS order.
+ */
+struct eytzinger_t {
+	int *				keys;
+	int *				sorted;
+	size_t				size;
+	size_t				capacity;
+};
+
+/*
+ * Thread pool task.
+ */
+struct thread_task_t {
+	void				(*func)(void *);
+	void *				arg;
+	int				state;
+	struct thread_task_t *		next;
+};
+
+/*
+ * Thread pool : tasks are run by worker threads, or by the thread waiting for them.
+ */
+struct thread_pool_t {
+	pthread_mutex_t			lock;
+	pthread_cond_t			work;
+	pthread_cond_t			done;
+	struct thread_task_t *		tasks;
+	pthread_t *			threads;
+	int				nr_threads;
+	int				stop;
+};
+
+/*
+ * Shard queue slot : seq tells whether slot is free for producer position seq or holds operation seq - 1.
+ */
+struct shard_op_t {
+	unsigned long			seq;
+	int				op;
+	int				val;
+};
+
+/*
+ * Shard : a concurrent AVL tree updated by its own worker thread, fed by a bounded MPSC queue.
+ */
+struct shard_t {
+	unsigned long			head __attribute__((aligned(NODE_POOL_ALIGN)));
+	unsigned long			tail __attribute__((aligned(NODE_POOL_ALIGN)));
+	unsigned long			applied;
+	struct shard_op_t *		slots;
+	struct tree_t *			tree;
+	pthread_t			thread;
+	pthread_mutex_t			lock;
+	pthread_cond_t			wake;
+	int				sleeping;
+	int				stop;
+} __attribute__((aligned(NODE_POOL_ALIGN)));
+
+/*
+ * Sharded tree : key range [lo, hi] is split evenly across shards (keys out of range go to first/last shard).
+ */
+struct shard_tree_t {
+	struct shard_t *		shards;
+	int				nr_shards;
+	int				lo;
+	int				hi;
+};
+
+/*
+ * Logged tree : mutations are applied to the tree and appended to a write-ahead log, pending
+ * records are written and synced together (group commit).
+ */
+struct tree_wal_t {
+	struct tree_t *			tree;
+	int				fd;
+	char *				snapshot_path;
+	unsigned char *			buf;
+	size_t				nr_pending;
+	size_t				batch_size;
+	size_t				nr_logged;
+	size_t				checkpoint_interval;
+	int				failed;
+};
+
 /*
  * Tree operations.
  */
 struct tree_operations_t {
-	void				(*init)(struct tree_t *);
+	int				(*init)(struct tree_t *);
 	int				(*height)(struct tree_t *);
+	int				(*min)(struct tree_t *, int *);
+	int				(*max)(struct tree_t *, int *);
 	int				(*find)(struct tree_t *, int);
+	void				(*find_many)(struct tree_t *, const int *, size_t, uint8_t *);
 	void	 			(*insert)(struct tree_t *, int);
 	void 				(*delete)(struct tree_t *, int);
 	void 				(*balance)(struct tree_t *);
+	int				(*bulk_load)(struct tree_t *, const int *, size_t);
+	int				(*stream_load)(struct tree_t *, size_t, int (*)(void *, int *, size_t), void *);
+	size_t				(*to_array)(struct tree_t *, int *, size_t);
+	int				(*rank)(struct tree_t *, int);
+	int				(*select)(struct tree_t *, int, int *);
+	int				(*count_range)(struct tree_t *, int, int);
+	int				(*seek)(struct tree_iter_t *, struct tree_t *, int);
+	int				(*next)(struct tree_iter_t *);
+	int				(*prev)(struct tree_iter_t *);
+	int				(*relayout)(struct tree_t *, int);
+	int				(*insert_batch)(struct tree_t *, const int *, size_t, struct thread_pool_t *);
+	int				(*delete_batch)(struct tree_t *, const int *, size_t, struct thread_pool_t *);
 	void				(*free)(struct tree_t *);
-	void				(*draw)(struct tree_t *, GtkWidget *, cairo_t *);
-
 };
 
 /* tree operations */
 extern struct tree_operations_t binary_tree_ops;
 extern struct tree_operations_t avl_tree_ops;
+extern struct tree_operations_t rb_tree_ops;
+extern struct tree_operations_t bplus_tree_ops;
+extern struct tree_operations_t lockfree_tree_ops;
+extern struct tree_operations_t mmap_tree_ops;
+extern struct tree_operations_t compact_binary_tree_ops;
+extern struct tree_operations_t compact_avl_tree_ops;
 
 /* tree prototypes */
 struct tree_t *tree_create(int type);
+void tree_print_stats(struct tree_t *tree, FILE *fp);
+int *tree_sort_keys(const int *keys, size_t *n);
+int *tree_merge_keys(const int *a, size_t na, const int *b, size_t nb, size_t *n);
+int tree_scan_range(struct tree_t *tree, int lo, int hi, int (*callback)(int, void *), void *arg);
+int tree_save(struct tree_t *tree, const char *path);
+struct tree_t *tree_load(const char *path);
+uint32_t tree_crc32(uint32_t crc, const void *data, size_t len);
+void tree_find_many(struct tree_t *tree, const int *keys, size_t n, uint8_t *out);
+int tree_insert_batch(struct tree_t *tree, const int *keys, size_t n, struct thread_pool_t *tp);
+int tree_delete_batch(struct tree_t *tree, const int *keys, size_t n, struct thread_pool_t *tp);
+int tree_relayout(struct tree_t *tree, int threshold);
+void tree_set_auto_relayout(struct tree_t *tree, int threshold);
+
+/* tree layout prototypes */
+int tree_layout_fragmentation(void *root, size_t size, const struct tree_layout_t *layout);
+int tree_layout_relayout(struct tree_t *tree, void **root, const struct tree_layout_t *layout, int threshold);
+
+/* write-ahead log prototypes */
+struct tree_wal_t *tree_wal_open(const char *log_path, const char *snapshot_path, int type, size_t batch_size,
+				 size_t checkpoint_interval);
+int tree_wal_insert(struct tree_wal_t *wal, int val);
+int tree_wal_delete(struct tree_wal_t *wal, int val);
+int tree_wal_commit(struct tree_wal_t *wal);
+int tree_wal_checkpoint(struct tree_wal_t *wal);
+int tree_wal_close(struct tree_wal_t *wal);
+
+/* eytzinger prototypes */
+struct eytzinger_t *eytzinger_create(struct tree_t *tree);
+int eytzinger_rebuild(struct eytzinger_t *snap, struct tree_t *tree);
+void eytzinger_free(struct eytzinger_t *snap);
+int eytzinger_find(const struct eytzinger_t *snap, int val);
+int eytzinger_lower_bound(const struct eytzinger_t *snap, int val, int *res);
+
+/* avl tree prototypes */
+struct tree_t *avl_tree_snapshot(struct tree_t *tree);
+int avl_tree_set_concurrent(struct tree_t *tree);
+/* split trees share their node pool : both must be updated by the same thread */
+struct tree_t *avl_tree_split(struct tree_t *tree, int key);
+int avl_tree_join(struct tree_t *left, int key, struct tree_t *right);
+int avl_tree_union(struct tree_t *tree, const struct tree_t *other, struct thread_pool_t *tp);
+int avl_tree_intersection(struct tree_t *tree, const struct tree_t *other, struct thread_pool_t *tp);
+int avl_tree_difference(struct tree_t *tree, const struct tree_t *other, struct thread_pool_t *tp);
+
+/* memory mapped tree prototypes */
+struct tree_t *mmap_tree_open(const char *path);
+int mmap_tree_sync(struct tree_t *tree);
+
+/* sharded tree prototypes */
+struct shard_tree_t *shard_tree_create(int nr_shards, int lo, int hi);
+void shard_tree_free(struct shard_tree_t *st);
+void shard_tree_insert(struct shard_tree_t *st, int val);
+void shard_tree_delete(struct shard_tree_t *st, int val);
+void shard_tree_flush(struct shard_tree_t *st);
+int shard_tree_find(struct shard_tree_t *st, int val);
+int shard_tree_scan_range(struct shard_tree_t *st, int lo, int hi, int (*callback)(int, void *), void *arg);
+
+/* node pool prototypes */
+struct node_pool_t *node_pool_create(size_t node_size);
+struct node_pool_t *node_pool_get(struct node_pool_t *pool);
+void node_pool_destroy(struct node_pool_t *pool);
+void *node_pool_grow(struct node_pool_t *pool);
+int node_pool_reserve(struct node_pool_t *pool, size_t n);
+int node_pool_merge(struct node_pool_t *pool, struct node_pool_t *src);
+void node_pool_defer(struct node_pool_t *pool, void *node);
+void node_pool_drain(struct node_pool_t *pool);
+
+/* epoch prototypes */
+void epoch_enter(void);
+void epoch_exit(void);
+unsigned long epoch_advance(void);
+void epoch_synchronize(void);
+void epoch_retire(struct epoch_limbo_t *limbo, void *ptr, void (*release)(void *, void *), void *arg);
+void epoch_collect(struct epoch_limbo_t *limbo, void (*release)(void *, void *), void *arg);
+void epoch_limbo_free(struct epoch_limbo_t *limbo);
+
+/* thread pool prototypes */
+struct thread_pool_t *thread_pool_create(int nr_threads);
+void thread_pool_destroy(struct thread_pool_t *tp);
+void thread_pool_submit(struct thread_pool_t *tp, struct thread_task_t *task);
+void thread_pool_wait(struct thread_pool_t *tp, struct thread_task_t *task);
+
+/*
+ * Allocate a node from a pool.
+ */
+static inline void *node_pool_alloc(struct node_pool_t *pool)
+{
+	void *node;
+
+	/* reuse a freed node */
+	if (pool->free_list) {
+		node = pool->free_list;
+		pool->free_list = *((void **) node);
+	/* carve a node from current slab */
+	} else if (pool->next < pool->end) {
+		node = pool->next;
+		pool->next += pool->node_size;
+	/* allocate a new slab */
+	} else {
+		node = node_pool_grow(pool);
+		if (!node)
+			return NULL;
+	}
+
+	/* update statistics */
+	pool->stats.nr_allocs++;
+	if (++pool->stats.nr_nodes > pool->stats.max_nodes)
+		pool->stats.max_nodes = pool->stats.nr_nodes;
+
+	return node;
+}
+
+/*
+ * Release a node to its pool.
+ */
+static inline void node_pool_free(struct node_pool_t *pool, void *node)
+{
+	/* push node on free list */
+	*((void **) node) = pool->free_list;
+	pool->free_list = node;
+
+	/* update statistics */
+	pool->stats.nr_frees++;
+	pool->stats.nr_nodes--;
+}
+
+/*
+ * Reset an iterator path.
+ */
+static inline void tree_iter_reset(struct tree_iter_t *iter, int state)
+{
+	iter->top = 0;
+	iter->depth = 0;
+	iter->state = state;
+}
+
+/*
+ * Push a node on an iterator path (oldest node is dropped if path is full).
+ */
+static inline void tree_iter_push(struct tree_iter_t *iter, void *node)
+{
+	iter->top = (iter->top + 1) % NODE_STACK_SIZE;
+	iter->path[iter->top] = node;
+	if (iter->depth < NODE_STACK_SIZE)
+		iter->depth++;
+}
+
+/*
+ * Get current node of an iterator path.
+ */
+static inline void *tree_iter_peek(struct tree_iter_t *iter)
+{
+	return iter->depth > 0 ? iter->path[iter->top] : NULL;
+}
+
+/*
+ * Pop a node from an iterator path.
+ */
+static inline void *tree_iter_pop(struct tree_iter_t *iter)
+{
+	void *node;
+
+	if (iter->depth == 0)
+		return NULL;
+
+	node = iter->path[iter->top];
+	iter->top = (iter->top + NODE_STACK_SIZE - 1) % NODE_STACK_SIZE;
+	iter->depth--;
+
+	return node;
+}
+
+/*
+ * Count n updates of a tree : with automatic relayout, fragmentation is checked every size updates
+ * (so that checks cost O(1) per update, amortized).
+ */
+static inline void tree_relayout_update_many(struct tree_t *tree, size_t n)
+{
+	if (!tree->relayout_threshold)
+		return;
+
+	tree->nr_updates += n;
+	if (tree->nr_updates < (size_t) tree->size || tree->size < TREE_RELAYOUT_MIN_SIZE)
+		return;
+
+	tree->nr_updates = 0;
+	tree->ops->relayout(tree, tree->relayout_threshold);
+}
+
+/*
+ * Count an update of a tree.
+ */
+static inline void tree_relayout_update(struct tree_t *tree)
+{
+	tree_relayout_update_many(tree, 1);
+}
+
+/*
+ * Find n values in a pointer tree (out[i] is set if keys[i] is found). TREE_FIND_MANY_GROUP searches
+ * advance in turn and prefetch their next node, so that their cache misses overlap. A finished search
+ * is replaced by the next key at once.
+ */
+static inline void tree_layout_find_many(void *root, const struct tree_layout_t *layout, const int *keys, size_t n,
+					 uint8_t *out)
+{
+	void *nodes[TREE_FIND_MANY_GROUP], *node;
+	size_t pos[TREE_FIND_MANY_GROUP], next;
+	int nr_active, i, key, val;
+
+	/* start first searches */
+	for (nr_active = 0, next = 0; nr_active < TREE_FIND_MANY_GROUP && next < n; nr_active++, next++) {
+		nodes[nr_active] = root;
+		pos[nr_active] = next;
+	}
+
+	while (nr_active > 0) {
+		for (i = 0; i < nr_active; i++) {
+			node = nodes[i];
+			key = keys[pos[i]];
+
+			/* one step down */
+			if (node) {
+				val = *((int *) ((char *) node + layout->val));
+				if (key != val) {
+					node = *((void **) ((char *) node + (key < val ? layout->left : layout->right)));
+					__builtin_prefetch(node);
+					nodes[i] = node;
+					continue;
+				}
+			}
+
+			/* search done : start next one, or drop this slot */
+			out[pos[i]] = node != NULL;
+			if (next < n) {
+				nodes[i] = root;
+				pos[i] = next++;
+			} else {
+				nr_active--;
+				nodes[i] = nodes[nr_active];
+				pos[i] = pos[nr_active];
+				i--;
+			}
+		}
+	}
+}
+
+/*
+ * Compute height of a perfectly balanced tree.
+ */
+static inline int tree_balanced_height(int size)
+{
+	int height = 0;
+
+	for (; size > 0; size >>= 1)
+		height++;
+
+	return height;
+}
 
 /*
  * Utility function to compute maximum int.
@@ -73,4 +716,12 @@ static inline int max(int a, int b)
 	return a > b ? a : b;
 }
 
+/*
+ * Utility function to compute minimum int.
+ */
+static inline int min(int a, int b)
+{
+	return a < b ? a : b;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "tree_draw.h"
+
+/*
+ * Node accessors (drawing only needs a value and two children).
+ */
+struct node_accessor_t {
+	int				(*val)(const void *);
+	const void *			(*left)(const void *);
+	const void *			(*right)(const void *);
+};
+
+/*
+ * Binary node accessors.
+ */
+static int binary_node_val(const void *node)
+{
+	return ((const struct binary_node_t *) node)->val;
+}
+
+static const void *binary_node_left(const void *node)
+{
+	return ((const struct binary_node_t *) node)->left;
+}
+
+static const void *binary_node_right(const void *node)
+{
+	return ((const struct binary_node_t *) node)->right;
+}
+
+static struct node_accessor_t binary_node_accessor = {
+	.val			= binary_node_val,
+	.left			= binary_node_left,
+	.right			= binary_node_right,
+};
+
+/*
+ * AVL node accessors.
+ */
+static int avl_node_val(const void *node)
+{
+	return ((const struct avl_node_t *) node)->val;
+}
+
+static const void *avl_node_left(const void *node)
+{
+	return ((const struct avl_node_t *) node)->left;
+}
+
+static const void *avl_node_right(const void *node)
+{
+	return ((const struct avl_node_t *) node)->right;
+}
+
+static struct node_accessor_t avl_node_accessor = {
+	.val			= avl_node_val,
+	.left			= avl_node_left,
+	.right			= avl_node_right,
+};
+
+/*
+ * Red-black node accessors.
+ */
+static int rb_node_val(const void *node)
+{
+	return ((const struct rb_node_t *) node)->val;
+}
+
+static const void *rb_node_left(const void *node)
+{
+	return ((const struct rb_node_t *) node)->left;
+}
+
+static const void *rb_node_right(const void *node)
+{
+	return ((const struct rb_node_t *) node)->right;
+}
+
+static struct node_accessor_t rb_node_accessor = {
+	.val			= rb_node_val,
+	.left			= rb_node_left,
+	.right			= rb_node_right,
+};
+
+/*
+ * Draw a node value.
+ */
+static void node_draw_value(int val, cairo_t *cr, int x, gint y)
+{
+	char val_string[64];
+	int len;
+
+	/* draw rectangle node */
+	cairo_set_line_width(cr, 2.0);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_rectangle(cr, x, y, NODE_SIZE_X, NODE_SIZE_Y);
+	cairo_stroke(cr);
+
+	/* draw value */
+	len = sprintf(val_string, "%d", val);
+	cairo_select_font_face(cr, NODE_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+	cairo_set_font_size(cr, 12);
+	cairo_move_to(cr, len == 1 ? x + 6 : x + 3, y + 15);
+	cairo_show_text(cr, val_string);
+}
+
+/*
+ * Draw a node.
+ */
+static void node_draw(const void *node, struct node_accessor_t *acc, cairo_t *cr, int x, int y, int space_sibling)
+{
+	const void *left, *right;
+	int x_child, y_child;
+
+	if (!node)
+		return;
+
+	/* draw value */
+	node_draw_value(acc->val(node), cr, x, y);
+
+	/* draw left child */
+	left = acc->left(node);
+	if (left) {
+		/* compute x/y child */
+		x_child = x - NODE_SIZE_X * space_sibling;
+		y_child = y + NODE_SIZE_Y * 2;
+
+		/* draw left arrow */
+		cairo_move_to(cr, x + NODE_SIZE_X / 2, y + NODE_SIZE_Y);
+		cairo_line_to(cr, x_child + NODE_SIZE_X / 2, y_child);
+		cairo_stroke(cr);
+
+		/* draw left node */
+		node_draw(left, acc, cr, x_child, y_child, space_sibling / 2);
+	}
+
+	/* draw right child */
+	right = acc->right(node);
+	if (right) {
+		/* compute x/y child */
+		x_child = x + NODE_SIZE_X * space_sibling;
+		y_child = y + NODE_SIZE_Y * 2;
+
+		/* draw right arrow */
+		cairo_move_to(cr, x + NODE_SIZE_X / 2, y + NODE_SIZE_Y);
+		cairo_line_to(cr, x_child + NODE_SIZE_X / 2, y_child);
+		cairo_stroke(cr);
+
+		/* draw right node */
+		node_draw(right, acc, cr, x_child, y_child, space_sibling / 2);
+	}
+}
+
+/*
+ * Draw a tree.
+ */
+void tree_draw(struct tree_t *tree, GtkWidget *drawing_area, cairo_t *cr)
+{
+	struct node_accessor_t *acc;
+	GtkAllocation *alloc;
+	const void *root;
+	int space_sibling;
+	int x, y;
+
+	if (!tree)
+		return;
+
+	/* get root node */
+	switch (tree->type) {
+		case TREE_TYPE_BINARY:
+			root = tree->root.binary;
+			acc = &binary_node_accessor;
+			break;
+		case TREE_TYPE_AVL:
+			root = tree->root.avl;
+			acc = &avl_node_accessor;
+			break;
+		case TREE_TYPE_RB:
+			root = tree->root.rb;
+			acc = &rb_node_accessor;
+			break;
+		default:
+			return;
+	}
+
+	/* compute space between sibling */
+	space_sibling = pow(2, tree->ops->height(tree) - 1) / 2;
+
+	/* get drawing area size */
+	alloc = g_new(GtkAllocation, 1);
+	gtk_widget_get_allocation(drawing_area, alloc);
+
+	/* start at middle x */
+	x = alloc->width / 2;
+	y = 100;
+
+	/* free drawing area size */
+	g_free(alloc);
+
+	/* draw root node */
+	node_draw(root, acc, cr, x, y, space_sibling);
+}
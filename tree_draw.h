@@ -0,0 +1,15 @@
+#ifndef _TREE_DRAW_H_
+#define _TREE_DRAW_H_
+
+#include <gtk/gtk.h>
+
+#include "tree.h"
+
+#define NODE_SIZE_X			20
+#define NODE_SIZE_Y			20
+#define NODE_FONT			"Arial"
+
+/* draw prototypes */
+void tree_draw(struct tree_t *tree, GtkWidget *drawing_area, cairo_t *cr);
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tree.h"
+
+/*
+ * Tree file layout (little endian) :
+ *   header  : magic (4 bytes), version (4 bytes), tree type (4 bytes), number of values (8 bytes)
+ *   values  : varints, first value is stored as an offset from INT_MIN, next ones as gap - 1 with
+ *             previous value
+ *   trailer : CRC32 of header and values (4 bytes)
+ */
+
+/*
+ * Tree file stream.
+ */
+struct tree_file_t {
+	FILE *				fp;
+	unsigned char			buf[TREE_FILE_BUFFER_SIZE];
+	size_t				pos;
+	size_t				len;
+	size_t				crc_pos;
+	uint32_t			crc;
+	long long			prev;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Init CRC32 table (reflected polynomial 0xEDB88320).
+ */
+static void crc_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		for (c = i, j = 0; j < 8; j++)
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+
+		crc_table[i] = c;
+	}
+}
+
+/*
+ * Update a CRC32 with a buffer.
+ */
+uint32_t tree_crc32(uint32_t crc, const void *data, size_t len)
+{
+	const unsigned char *buf = (const unsigned char *) data;
+	size_t i;
+
+	pthread_once(&crc_once, crc_init);
+
+	crc = ~crc;
+	for (i = 0; i < len; i++)
+		crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+/*
+ * Write buffered bytes.
+ */
+static int file_flush(struct tree_file_t *file)
+{
+	file->crc = tree_crc32(file->crc, file->buf, file->pos);
+
+	if (fwrite(file->buf, 1, file->pos, file->fp) != file->pos)
+		return -1;
+
+	file->pos = 0;
+	return 0;
+}
+
+/*
+ * Write bytes.
+ */
+static int file_write(struct tree_file_t *file, const unsigned char *buf, size_t len)
+{
+	if (file->pos + len > TREE_FILE_BUFFER_SIZE && file_flush(file))
+		return -1;
+
+	memcpy(file->buf + file->pos, buf, len);
+	file->pos += len;
+	return 0;
+}
+
+/*
+ * Write a little endian integer of len bytes.
+ */
+static int file_write_int(struct tree_file_t *file, unsigned long long val, size_t len)
+{
+	unsigned char buf[8];
+	size_t i;
+
+	for (i = 0; i < len; i++, val >>= 8)
+		buf[i] = val & 0xFF;
+
+	return file_write(file, buf, len);
+}
+
+/*
+ * Write a varint (7 bits per byte, high bit set on all bytes but last one).
+ */
+static int file_write_varint(struct tree_file_t *file, uint32_t val)
+{
+	unsigned char buf[5];
+	size_t len = 0;
+
+	for (; val >= 0x80; val >>= 7)
+		buf[len++] = (val & 0x7F) | 0x80;
+	buf[len++] = val;
+
+	return file_write(file, buf, len);
+}
+
+/*
+ * Read a byte (-1 at end of file).
+ */
+static int file_getc(struct tree_file_t *file)
+{
+	if (file->pos == file->len) {
+		/* checksum consumed bytes before refilling */
+		file->crc = tree_crc32(file->crc, file->buf + file->crc_pos, file->pos - file->crc_pos);
+		file->len = fread(file->buf, 1, TREE_FILE_BUFFER_SIZE, file->fp);
+		file->pos = 0;
+		file->crc_pos = 0;
+
+		if (file->len == 0)
+			return -1;
+	}
+
+	return file->buf[file->pos++];
+}
+
+/*
+ * Read a little endian integer of len bytes.
+ */
+static int file_read_int(struct tree_file_t *file, unsigned long long *val, size_t len)
+{
+	size_t i;
+	int c;
+
+	for (i = 0, *val = 0; i < len; i++) {
+		c = file_getc(file);
+		if (c < 0)
+			return -1;
+
+		*val |= (unsigned long long) c << (8 * i);
+	}
+
+	return 0;
+}
+
+/*
+ * Read a varint (32 bits at most).
+ */
+static int file_read_varint(struct tree_file_t *file, uint32_t *val)
+{
+	int shift, c;
+
+	for (shift = 0, *val = 0; shift < 35; shift += 7) {
+		c = file_getc(file);
+		if (c < 0 || (shift == 28 && c > 0x0F))
+			return -1;
+
+		*val |= (uint32_t) (c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Tree reader : decode n values (they must be sorted and distinct).
+ */
+static int file_read_keys(void *arg, int *keys, size_t n)
+{
+	struct tree_file_t *file = (struct tree_file_t *) arg;
+	long long val;
+	uint32_t gap;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (file_read_varint(file, &gap))
+			return -1;
+
+		val = file->prev + gap + 1;
+		if (val > INT_MAX)
+			return -1;
+
+		keys[i] = (int) val;
+		file->prev = val;
+	}
+
+	return 0;
+}
+
+/*
+ * Sync directory holding path, so that a file renamed into it survives a crash.
+ */
+static int sync_dir(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir;
+	int fd, ret;
+
+	/* file in current directory, or in root directory */
+	if (!slash) {
+		dir = strdup(".");
+	} else if (slash == path) {
+		dir = strdup("/");
+	} else {
+		dir = strndup(path, slash - path);
+	}
+	if (!dir)
+		return -1;
+
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	free(dir);
+	if (fd < 0)
+		return -1;
+
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Save a tree : values are streamed in order, so any tree with iterators can be saved.
+ * The file is written and synced next to path then renamed, so that path always holds a complete file.
+ * The directory is synced last : once saved, the new file survives a crash.
+ */
+int tree_save(struct tree_t *tree, const char *path)
+{
+	struct tree_file_t *file;
+	struct tree_iter_t iter;
+	char *tmp_path = NULL;
+	size_t count = 0;
+	int ret;
+
+	if (!tree || !path || !tree->ops->seek)
+		return -1;
+
+	/* create file */
+	file = (struct tree_file_t *) malloc(sizeof(struct tree_file_t));
+	tmp_path = (char *) malloc(strlen(path) + 5);
+	if (!file || !tmp_path)
+		goto err;
+
+	sprintf(tmp_path, "%s.tmp", path);
+	file->fp = fopen(tmp_path, "wb");
+	if (!file->fp)
+		goto err;
+
+	file->pos = 0;
+	file->crc = 0;
+	file->prev = (long long) INT_MIN - 1;
+
+	/* write header */
+	if (file_write_int(file, TREE_FILE_MAGIC, 4) || file_write_int(file, TREE_FILE_VERSION, 4)
+	    || file_write_int(file, tree->type, 4) || file_write_int(file, tree->size, 8))
+		goto err_close;
+
+	/* write values (iterators of concurrent trees must run in an epoch) */
+	epoch_enter();
+	for (ret = tree->ops->seek(&iter, tree, INT_MIN); ret; ret = tree->ops->next(&iter), count++) {
+		if (file_write_varint(file, (uint32_t) (iter.val - file->prev - 1)))
+			break;
+
+		file->prev = iter.val;
+	}
+	epoch_exit();
+
+	/* write error, or tree changed while saved */
+	if (ret || count != (size_t) tree->size)
+		goto err_close;
+
+	/* write checksum, and make file durable before it replaces path */
+	if (file_flush(file) || file_write_int(file, file->crc, 4) || file_flush(file))
+		goto err_close;
+	if (fflush(file->fp) || fsync(fileno(file->fp)))
+		goto err_close;
+
+	if (fclose(file->fp) || rename(tmp_path, path))
+		goto err_remove;
+
+	/* make rename durable too */
+	if (sync_dir(path))
+		goto err;
+
+	free(tmp_path);
+	free(file);
+	return 0;
+err_close:
+	fclose(file->fp);
+err_remove:
+	remove(tmp_path);
+err:
+	free(tmp_path);
+	free(file);
+	return -1;
+}
+
+/*
+ * Load a tree saved by tree_save() : values are decoded as the file is read and go straight into
+ * a balanced tree, built in O(n).
+ */
+struct tree_t *tree_load(const char *path)
+{
+	unsigned long long magic, version, type, count, crc;
+	struct tree_file_t *file;
+	struct tree_t *tree = NULL;
+	uint32_t file_crc;
+
+	if (!path)
+		return NULL;
+
+	/* open file */
+	file = (struct tree_file_t *) malloc(sizeof(struct tree_file_t));
+	if (!file)
+		return NULL;
+
+	file->fp = fopen(path, "rb");
+	if (!file->fp) {
+		free(file);
+		return NULL;
+	}
+
+	file->pos = 0;
+	file->len = 0;
+	file->crc_pos = 0;
+	file->crc = 0;
+	file->prev = (long long) INT_MIN - 1;
+
+	/* read header */
+	if (file_read_int(file, &magic, 4) || file_read_int(file, &version, 4)
+	    || file_read_int(file, &type, 4) || file_read_int(file, &count, 8))
+		goto err;
+	if (magic != TREE_FILE_MAGIC || version != TREE_FILE_VERSION || count > INT_MAX)
+		goto err;
+
+	/* create tree */
+	tree = tree_create((int) type);
+	if (!tree || !tree->ops->stream_load)
+		goto err;
+
+	/* build tree */
+	if (tree->ops->stream_load(tree, count, file_read_keys, file))
+		goto err;
+
+	/* check checksum and end of file */
+	file_crc = tree_crc32(file->crc, file->buf + file->crc_pos, file->pos - file->crc_pos);
+	file->crc_pos = file->pos;
+	if (file_read_int(file, &crc, 4) || crc != file_crc || file_getc(file) >= 0)
+		goto err;
+
+	fclose(file->fp);
+	free(file);
+	return tree;
+err:
+	if (tree)
+		tree->ops->free(tree);
+	fclose(file->fp);
+	free(file);
+	return NULL;
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+
+/*
+ * Get a link of a node.
+ */
+#define NODE_LINK(node, off)		(*((void **) ((char *) (node) + (off))))
+
+/*
+ * Store nodes of a subtree, down to height levels, in van Emde Boas order : top half levels first,
+ * then each subtree hanging below them.
+ */
+static void node_order_veb(void *node, int height, const struct tree_layout_t *layout, void **order, size_t *n);
+
+/*
+ * Store van Emde Boas order of subtrees found depth levels below node.
+ */
+static void node_order_veb_bottom(void *node, int depth, int height, const struct tree_layout_t *layout,
+				  void **order, size_t *n)
+{
+	if (!node)
+		return;
+
+	if (depth == 0) {
+		node_order_veb(node, height, layout, order, n);
+		return;
+	}
+
+	node_order_veb_bottom(NODE_LINK(node, layout->left), depth - 1, height, layout, order, n);
+	node_order_veb_bottom(NODE_LINK(node, layout->right), depth - 1, height, layout, order, n);
+}
+
+static void node_order_veb(void *node, int height, const struct tree_layout_t *layout, void **order, size_t *n)
+{
+	int top;
+
+	if (!node || height <= 0)
+		return;
+
+	if (height == 1) {
+		order[(*n)++] = node;
+		return;
+	}
+
+	top = height / 2;
+	node_order_veb(node, top, layout, order, n);
+	node_order_veb_bottom(node, top, height - top, layout, order, n);
+}
+
+/*
+ * Store nodes of a tree in DFS pre order (explicit stack, for deep trees).
+ */
+static int node_order_dfs(void *root, size_t size, const struct tree_layout_t *layout, void **order, size_t *n)
+{
+	void **stack, *node;
+	size_t top = 0;
+
+	stack = (void **) malloc(sizeof(void *) * (size + 1));
+	if (!stack)
+		return -1;
+
+	for (stack[top++] = root; top > 0;) {
+		node = stack[--top];
+		order[(*n)++] = node;
+
+		/* left child is visited first */
+		if (NODE_LINK(node, layout->right))
+			stack[top++] = NODE_LINK(node, layout->right);
+		if (NODE_LINK(node, layout->left))
+			stack[top++] = NODE_LINK(node, layout->left);
+	}
+
+	free(stack);
+	return 0;
+}
+
+/*
+ * Forward a copied link (old nodes hold their copy in their left link).
+ */
+static inline void node_forward(void *node, size_t off, const struct tree_layout_t *layout)
+{
+	if (NODE_LINK(node, off))
+		NODE_LINK(node, off) = NODE_LINK(NODE_LINK(node, off), layout->left);
+}
+
+/*
+ * Compute fragmentation of a tree : percentage of parent to child links spanning TREE_LAYOUT_NEAR
+ * bytes or more (such a step of a search is likely a cache and TLB miss).
+ */
+int tree_layout_fragmentation(void *root, size_t size, const struct tree_layout_t *layout)
+{
+	size_t nr_links = 0, nr_far = 0, top = 0, i;
+	void **stack, *node, *child;
+	ptrdiff_t dist;
+	size_t links[2];
+
+	if (!root || !layout)
+		return 0;
+
+	stack = (void **) malloc(sizeof(void *) * (size + 1));
+	if (!stack)
+		return -1;
+
+	links[0] = layout->left;
+	links[1] = layout->right;
+	for (stack[top++] = root; top > 0;) {
+		node = stack[--top];
+
+		for (i = 0; i < 2; i++) {
+			child = NODE_LINK(node, links[i]);
+			if (!child)
+				continue;
+
+			dist = (char *) child - (char *) node;
+			if (dist >= TREE_LAYOUT_NEAR || dist <= -TREE_LAYOUT_NEAR)
+				nr_far++;
+
+			nr_links++;
+			stack[top++] = child;
+		}
+	}
+
+	free(stack);
+	return nr_links ? (int) (nr_far * 100 / nr_links) : 0;
+}
+
+/*
+ * Copy a tree into a fresh node pool, in van Emde Boas order (or DFS order if tree is too deep), and
+ * release old nodes. Nothing is done if fragmentation is below threshold (0 forces a relayout).
+ * Returns 1 if tree was laid out again (root is updated), 0 if not needed, -1 on error (tree is unchanged).
+ */
+int tree_layout_relayout(struct tree_t *tree, void **root, const struct tree_layout_t *layout, int threshold)
+{
+	void **order = NULL, **copies = NULL;
+	struct node_pool_t *pool = NULL;
+	size_t size, n = 0, i;
+	int height, ret;
+
+	if (!tree || !root || !layout)
+		return -1;
+
+	size = tree->size;
+	if (!*root || size == 0)
+		return 0;
+
+	/* tree is not fragmented enough */
+	if (threshold > 0) {
+		ret = tree_layout_fragmentation(*root, size, layout);
+		if (ret < threshold)
+			return ret < 0 ? -1 : 0;
+	}
+
+	/* new pool : nodes are carved in order from big slabs */
+	pool = node_pool_create(layout->node_size);
+	order = (void **) malloc(sizeof(void *) * size);
+	copies = (void **) malloc(sizeof(void *) * size);
+	if (!pool || !order || !copies)
+		goto err;
+
+	pool->slab_nodes = size < NODE_POOL_MAX_SLAB ? size : NODE_POOL_MAX_SLAB;
+	if (pool->slab_nodes < NODE_POOL_MIN_SLAB)
+		pool->slab_nodes = NODE_POOL_MIN_SLAB;
+
+	/* order nodes */
+	height = tree->ops->height(tree);
+	if (height <= TREE_LAYOUT_VEB_MAX_HEIGHT)
+		node_order_veb(*root, height, layout, order, &n);
+	else if (node_order_dfs(*root, size, layout, order, &n))
+		goto err;
+
+	if (n != size)
+		goto err;
+
+	/* allocate all copies first, so that a failure leaves tree unchanged */
+	for (i = 0; i < size; i++) {
+		copies[i] = node_pool_alloc(pool);
+		if (!copies[i])
+			goto err;
+	}
+
+	/* copy nodes, old nodes now forward to their copy */
+	for (i = 0; i < size; i++) {
+		memcpy(copies[i], order[i], layout->node_size);
+		NODE_LINK(order[i], layout->left) = copies[i];
+	}
+
+	/* fix links of copies */
+	for (i = 0; i < size; i++) {
+		node_forward(copies[i], layout->left, layout);
+		node_forward(copies[i], layout->right, layout);
+		if (layout->parent != TREE_LAYOUT_NO_PARENT)
+			node_forward(copies[i], layout->parent, layout);
+	}
+
+	/* release old nodes : one by one if pool is shared with other trees */
+	if (__atomic_load_n(&tree->pool->refs, __ATOMIC_ACQUIRE) > 1) {
+		for (i = 0; i < size; i++)
+			node_pool_free(tree->pool, order[i]);
+	}
+
+	node_pool_destroy(tree->pool);
+	tree->pool = pool;
+	*root = copies[0];
+
+	free(order);
+	free(copies);
+	return 1;
+err:
+	node_pool_destroy(pool);
+	free(order);
+	free(copies);
+	return -1;
+}
@@ -0,0 +1,7 @@
+#include <stdlib.h>
+
+#include "tree_map.h"
+
+AVL_MAP_GENERATE(int_map, int, void *, TREE_MAP_CMP, )
+AVL_MAP_GENERATE(u64_map, uint64_t, void *, TREE_MAP_CMP, )
+AVL_MAP_GENERATE(str_map, const char *, void *, TREE_MAP_STRCMP, )
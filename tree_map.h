@@ -0,0 +1,363 @@
+#ifndef _TREE_MAP_H_
+#define _TREE_MAP_H_
+
+#include <string.h>
+
+#include "tree.h"
+
+/*
+ * Generic AVL maps, specialized at compile time (in the style of BSD sys/tree.h).
+ *
+ * AVL_MAP_PROTOTYPE(name, key_type, val_type, attr) declares struct name_t, struct name_node_t and
+ * the map functions, AVL_MAP_GENERATE(name, key_type, val_type, cmp, attr) defines them. cmp(a, b)
+ * is a macro or an inline function returning < 0, 0 or > 0 : it is expanded in each function, so
+ * comparisons are inlined. The _STATIC variants make all functions static to a translation unit.
+ *
+ * Generated functions :
+ *   int name_init(struct name_t *map)                                   0 or -1 (no memory)
+ *   void name_destroy(struct name_t *map)
+ *   val_type *name_find(struct name_t *map, key_type key)               NULL if key is missing
+ *   int name_insert(struct name_t *map, key_type key, val_type val)    1 inserted, 0 replaced, -1 no memory
+ *   int name_delete(struct name_t *map, key_type key, val_type *val)   1 deleted (val is set if not NULL), 0 missing
+ *   struct name_node_t *name_min(map), name_max(map)
+ *   struct name_node_t *name_lower_bound(map, key)                      first node >= key
+ *   struct name_node_t *name_next(map, node), name_prev(map, node)      NULL at end
+ *
+ * Keys are copied in nodes as is : string keys must stay valid while they are in the map.
+ */
+
+#define TREE_MAP_CMP(a, b)		(((a) > (b)) - ((a) < (b)))
+#define TREE_MAP_STRCMP(a, b)		strcmp((a), (b))
+
+#define AVL_MAP_PROTOTYPE(name, key_type, val_type, attr)						\
+struct name##_node_t {											\
+	key_type			key;								\
+	val_type			val;								\
+	int				height;								\
+	struct name##_node_t *		left;								\
+	struct name##_node_t *		right;								\
+};													\
+													\
+struct name##_t {											\
+	struct name##_node_t *		root;								\
+	struct node_pool_t *		pool;								\
+	size_t				size;								\
+};													\
+													\
+attr int name##_init(struct name##_t *map);								\
+attr void name##_destroy(struct name##_t *map);								\
+attr val_type *name##_find(struct name##_t *map, key_type key);						\
+attr int name##_insert(struct name##_t *map, key_type key, val_type val);				\
+attr int name##_delete(struct name##_t *map, key_type key, val_type *val);				\
+attr struct name##_node_t *name##_min(struct name##_t *map);						\
+attr struct name##_node_t *name##_max(struct name##_t *map);						\
+attr struct name##_node_t *name##_lower_bound(struct name##_t *map, key_type key);			\
+attr struct name##_node_t *name##_next(struct name##_t *map, struct name##_node_t *node);		\
+attr struct name##_node_t *name##_prev(struct name##_t *map, struct name##_node_t *node);
+
+#define AVL_MAP_PROTOTYPE_STATIC(name, key_type, val_type)						\
+	AVL_MAP_PROTOTYPE(name, key_type, val_type, __attribute__((unused)) static)
+
+#define AVL_MAP_GENERATE(name, key_type, val_type, cmp, attr)						\
+													\
+/* get node height */											\
+static inline int name##_node_height(struct name##_node_t *node)					\
+{													\
+	return node ? node->height : 0;									\
+}													\
+													\
+/* update node height from its children */								\
+static inline void name##_node_update(struct name##_node_t *node)					\
+{													\
+	node->height = 1 + max(name##_node_height(node->left), name##_node_height(node->right));	\
+}													\
+													\
+/* compute node balance */										\
+static inline int name##_node_balance(struct name##_node_t *node)					\
+{													\
+	return name##_node_height(node->left) - name##_node_height(node->right);			\
+}													\
+													\
+/* right rotate subtree rooted with y */								\
+static inline struct name##_node_t *name##_right_rotate(struct name##_node_t *y)			\
+{													\
+	struct name##_node_t *x = y->left;								\
+													\
+	y->left = x->right;										\
+	x->right = y;											\
+	name##_node_update(y);										\
+	name##_node_update(x);										\
+													\
+	return x;											\
+}													\
+													\
+/* left rotate subtree rooted with x */									\
+static inline struct name##_node_t *name##_left_rotate(struct name##_node_t *x)			\
+{													\
+	struct name##_node_t *y = x->right;								\
+													\
+	x->right = y->left;										\
+	y->left = x;											\
+	name##_node_update(x);										\
+	name##_node_update(y);										\
+													\
+	return y;											\
+}													\
+													\
+/* update node height and restore its balance (children are balanced) */				\
+static inline struct name##_node_t *name##_node_rebalance(struct name##_node_t *node)			\
+{													\
+	int balance;											\
+													\
+	name##_node_update(node);									\
+	balance = name##_node_balance(node);								\
+													\
+	/* left left and left right cases */								\
+	if (balance > 1) {										\
+		if (name##_node_balance(node->left) < 0)						\
+			node->left = name##_left_rotate(node->left);					\
+		return name##_right_rotate(node);							\
+	}												\
+													\
+	/* right right and right left cases */								\
+	if (balance < -1) {										\
+		if (name##_node_balance(node->right) > 0)						\
+			node->right = name##_right_rotate(node->right);					\
+		return name##_left_rotate(node);							\
+	}												\
+													\
+	return node;											\
+}													\
+													\
+/* insert a key in a node (*ret is set to 1 if inserted, 0 if replaced, -1 on error) */		\
+static struct name##_node_t *name##_node_insert(struct name##_t *map, struct name##_node_t *node,	\
+						key_type key, val_type val, int *ret)			\
+{													\
+	int c;												\
+													\
+	/* leaf : insert node */									\
+	if (!node) {											\
+		node = (struct name##_node_t *) node_pool_alloc(map->pool);				\
+		if (!node) {										\
+			*ret = -1;									\
+			return NULL;									\
+		}											\
+													\
+		node->key = key;									\
+		node->val = val;									\
+		node->height = 1;									\
+		node->left = NULL;									\
+		node->right = NULL;									\
+		map->size++;										\
+		*ret = 1;										\
+		return node;										\
+	}												\
+													\
+	/* find subtree */										\
+	c = cmp(key, node->key);									\
+	if (c < 0) {											\
+		node->left = name##_node_insert(map, node->left, key, val, ret);			\
+	} else if (c > 0) {										\
+		node->right = name##_node_insert(map, node->right, key, val, ret);			\
+	} else {											\
+		node->val = val;									\
+		*ret = 0;										\
+		return node;										\
+	}												\
+													\
+	/* no node added : heights didn't change */							\
+	if (*ret != 1)											\
+		return node;										\
+													\
+	return name##_node_rebalance(node);								\
+}													\
+													\
+/* delete a key in a node (*ret is set to 1 if deleted) */						\
+static struct name##_node_t *name##_node_delete(struct name##_t *map, struct name##_node_t *node,	\
+						key_type key, val_type *val, int *ret)			\
+{													\
+	struct name##_node_t *tmp;									\
+	int c;												\
+													\
+	if (!node)											\
+		return NULL;										\
+													\
+	c = cmp(key, node->key);									\
+	if (c < 0) {											\
+		node->left = name##_node_delete(map, node->left, key, val, ret);			\
+	} else if (c > 0) {										\
+		node->right = name##_node_delete(map, node->right, key, val, ret);			\
+	} else {											\
+		if (val)										\
+			*val = node->val;								\
+		*ret = 1;										\
+													\
+		/* only one child or no child : replace this node with its child */			\
+		if (!node->left || !node->right) {							\
+			tmp = node->left ? node->left : node->right;					\
+			map->size--;									\
+			node_pool_free(map->pool, node);						\
+			return tmp;									\
+		}											\
+													\
+		/* move minimum of right child in this node, then delete it in right child */		\
+		for (tmp = node->right; tmp->left; tmp = tmp->left)					\
+			;										\
+		node->key = tmp->key;									\
+		node->val = tmp->val;									\
+		node->right = name##_node_delete(map, node->right, tmp->key, NULL, ret);		\
+	}												\
+													\
+	if (!*ret)											\
+		return node;										\
+													\
+	return name##_node_rebalance(node);								\
+}													\
+													\
+attr int name##_init(struct name##_t *map)								\
+{													\
+	map->root = NULL;										\
+	map->size = 0;											\
+	map->pool = node_pool_create(sizeof(struct name##_node_t));					\
+													\
+	return map->pool ? 0 : -1;									\
+}													\
+													\
+attr void name##_destroy(struct name##_t *map)								\
+{													\
+	node_pool_destroy(map->pool);									\
+	map->root = NULL;										\
+	map->pool = NULL;										\
+	map->size = 0;											\
+}													\
+													\
+attr val_type *name##_find(struct name##_t *map, key_type key)						\
+{													\
+	struct name##_node_t *node = map->root;								\
+	int c;												\
+													\
+	while (node) {											\
+		c = cmp(key, node->key);								\
+		if (c == 0)										\
+			return &node->val;								\
+		node = c < 0 ? node->left : node->right;						\
+	}												\
+													\
+	return NULL;											\
+}													\
+													\
+attr int name##_insert(struct name##_t *map, key_type key, val_type val)				\
+{													\
+	struct name##_node_t *root;									\
+	int ret = 0;											\
+													\
+	root = name##_node_insert(map, map->root, key, val, &ret);					\
+	if (ret >= 0)											\
+		map->root = root;									\
+													\
+	return ret;											\
+}													\
+													\
+attr int name##_delete(struct name##_t *map, key_type key, val_type *val)				\
+{													\
+	int ret = 0;											\
+													\
+	map->root = name##_node_delete(map, map->root, key, val, &ret);					\
+	return ret;											\
+}													\
+													\
+attr struct name##_node_t *name##_min(struct name##_t *map)						\
+{													\
+	struct name##_node_t *node = map->root;								\
+													\
+	while (node && node->left)									\
+		node = node->left;									\
+													\
+	return node;											\
+}													\
+													\
+attr struct name##_node_t *name##_max(struct name##_t *map)						\
+{													\
+	struct name##_node_t *node = map->root;								\
+													\
+	while (node && node->right)									\
+		node = node->right;									\
+													\
+	return node;											\
+}													\
+													\
+attr struct name##_node_t *name##_lower_bound(struct name##_t *map, key_type key)			\
+{													\
+	struct name##_node_t *node = map->root, *res = NULL;						\
+	int c;												\
+													\
+	while (node) {											\
+		c = cmp(key, node->key);								\
+		if (c == 0)										\
+			return node;									\
+		if (c < 0) {										\
+			res = node;									\
+			node = node->left;								\
+		} else {										\
+			node = node->right;								\
+		}											\
+	}												\
+													\
+	return res;											\
+}													\
+													\
+attr struct name##_node_t *name##_next(struct name##_t *map, struct name##_node_t *node)		\
+{													\
+	struct name##_node_t *cur = map->root, *res = NULL;						\
+													\
+	/* successor is leftmost node of right child, or last node left of the path */			\
+	if (node->right) {										\
+		for (node = node->right; node->left; node = node->left)					\
+			;										\
+		return node;										\
+	}												\
+													\
+	while (cur != node) {										\
+		if (cmp(node->key, cur->key) < 0) {							\
+			res = cur;									\
+			cur = cur->left;								\
+		} else {										\
+			cur = cur->right;								\
+		}											\
+	}												\
+													\
+	return res;											\
+}													\
+													\
+attr struct name##_node_t *name##_prev(struct name##_t *map, struct name##_node_t *node)		\
+{													\
+	struct name##_node_t *cur = map->root, *res = NULL;						\
+													\
+	/* predecessor is rightmost node of left child, or last node right of the path */		\
+	if (node->left) {										\
+		for (node = node->left; node->right; node = node->right)				\
+			;										\
+		return node;										\
+	}												\
+													\
+	while (cur != node) {										\
+		if (cmp(node->key, cur->key) > 0) {							\
+			res = cur;									\
+			cur = cur->right;								\
+		} else {										\
+			cur = cur->left;								\
+		}											\
+	}												\
+													\
+	return res;											\
+}
+
+#define AVL_MAP_GENERATE_STATIC(name, key_type, val_type, cmp)						\
+	AVL_MAP_GENERATE(name, key_type, val_type, cmp, __attribute__((unused)) static)
+
+/* int -> pointer, u64 -> pointer and string -> pointer maps */
+AVL_MAP_PROTOTYPE(int_map, int, void *, )
+AVL_MAP_PROTOTYPE(u64_map, uint64_t, void *, )
+AVL_MAP_PROTOTYPE(str_map, const char *, void *, )
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tree.h"
+
+/*
+ * Log layout : a sequence of batches, each one synced with a single fsync.
+ *   batch header : magic (4 bytes), number of records (4 bytes), CRC32 of records (4 bytes)
+ *   records      : operation (1 byte), value (4 bytes, little endian)
+ * A torn or corrupted batch ends the log : it was never acknowledged.
+ */
+
+/*
+ * Logged operation (seq keeps log order).
+ */
+struct tree_wal_record_t {
+	size_t				seq;
+	int				op;
+	int				val;
+};
+
+/*
+ * Store a little endian 32 bits integer.
+ */
+static inline void put_u32(unsigned char *buf, uint32_t val)
+{
+	buf[0] = val & 0xFF;
+	buf[1] = (val >> 8) & 0xFF;
+	buf[2] = (val >> 16) & 0xFF;
+	buf[3] = (val >> 24) & 0xFF;
+}
+
+/*
+ * Load a little endian 32 bits integer.
+ */
+static inline uint32_t get_u32(const unsigned char *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+/*
+ * Compare two records (by value, then by log order).
+ */
+static int record_cmp(const void *a, const void *b)
+{
+	const struct tree_wal_record_t *x = (const struct tree_wal_record_t *) a;
+	const struct tree_wal_record_t *y = (const struct tree_wal_record_t *) b;
+
+	if (x->val != y->val)
+		return x->val < y->val ? -1 : 1;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/*
+ * Apply logged records in bulk : only last operation on each value matters, so records are sorted
+ * by value, inserted values are bulk loaded and deleted values are removed.
+ */
+static int wal_apply(struct tree_t *tree, struct tree_wal_record_t *records, size_t n)
+{
+	size_t i, nr_inserts = 0;
+	int *inserts;
+
+	if (n == 0)
+		return 0;
+
+	qsort(records, n, sizeof(struct tree_wal_record_t), record_cmp);
+
+	inserts = (int *) malloc(sizeof(int) * n);
+	if (!inserts)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		/* not last operation on this value */
+		if (i + 1 < n && records[i + 1].val == records[i].val)
+			continue;
+
+		if (records[i].op == TREE_WAL_OP_INSERT)
+			inserts[nr_inserts++] = records[i].val;
+		else
+			tree->ops->delete(tree, records[i].val);
+	}
+
+	/* values are sorted : bulk load is a linear merge */
+	if (tree->ops->bulk_load) {
+		if (nr_inserts && tree->ops->bulk_load(tree, inserts, nr_inserts)) {
+			free(inserts);
+			return -1;
+		}
+	} else {
+		for (i = 0; i < nr_inserts; i++)
+			tree->ops->insert(tree, inserts[i]);
+	}
+
+	free(inserts);
+	return 0;
+}
+
+/*
+ * Replay log : valid batches are applied, log is truncated after last one.
+ */
+static int wal_replay(struct tree_wal_t *wal)
+{
+	struct tree_wal_record_t *records = NULL, *tmp;
+	size_t nr_records = 0, max_records = 0, i;
+	unsigned char header[TREE_WAL_HEADER_SIZE], *buf = NULL, *tmp_buf;
+	off_t offset = 0;
+	uint32_t count;
+	size_t len;
+	int ret = -1;
+
+	for (;;) {
+		/* read batch header */
+		if (pread(wal->fd, header, TREE_WAL_HEADER_SIZE, offset) != TREE_WAL_HEADER_SIZE)
+			break;
+
+		count = get_u32(header + 4);
+		if (get_u32(header) != TREE_WAL_MAGIC || count == 0 || count > TREE_WAL_MAX_BATCH)
+			break;
+
+		/* read records */
+		len = (size_t) count * TREE_WAL_RECORD_SIZE;
+		tmp_buf = (unsigned char *) realloc(buf, len);
+		if (!tmp_buf)
+			goto out;
+		buf = tmp_buf;
+
+		if (pread(wal->fd, buf, len, offset + TREE_WAL_HEADER_SIZE) != (ssize_t) len)
+			break;
+		if (tree_crc32(0, buf, len) != get_u32(header + 8))
+			break;
+
+		/* decode records */
+		if (nr_records + count > max_records) {
+			max_records = 2 * (nr_records + count);
+			tmp = (struct tree_wal_record_t *) realloc(records, sizeof(struct tree_wal_record_t) * max_records);
+			if (!tmp)
+				goto out;
+			records = tmp;
+		}
+
+		for (i = 0; i < count; i++, nr_records++) {
+			records[nr_records].seq = nr_records;
+			records[nr_records].op = buf[i * TREE_WAL_RECORD_SIZE];
+			records[nr_records].val = (int) get_u32(buf + i * TREE_WAL_RECORD_SIZE + 1);
+		}
+
+		offset += TREE_WAL_HEADER_SIZE + len;
+	}
+
+	/* drop torn tail, so that new batches follow last valid one */
+	if (ftruncate(wal->fd, offset))
+		goto out;
+
+	ret = wal_apply(wal->tree, records, nr_records);
+	wal->nr_logged = nr_records;
+out:
+	free(records);
+	free(buf);
+	return ret;
+}
+
+/*
+ * Write pending records as one batch and wait for them to reach the disk. A failed write is cut
+ * from the log (pending records are kept, commit may be retried). A failed sync, or a torn batch
+ * which can't be cut, leaves the log in an unknown state : log is marked failed, and refuses
+ * further operations.
+ */
+static int wal_flush(struct tree_wal_t *wal)
+{
+	size_t len, done;
+	ssize_t ret;
+	off_t end;
+
+	if (wal->failed)
+		return -1;
+	if (wal->nr_pending == 0)
+		return 0;
+
+	/* end of valid batches */
+	end = lseek(wal->fd, 0, SEEK_END);
+	if (end < 0)
+		return -1;
+
+	/* batch header */
+	len = wal->nr_pending * TREE_WAL_RECORD_SIZE;
+	put_u32(wal->buf, TREE_WAL_MAGIC);
+	put_u32(wal->buf + 4, wal->nr_pending);
+	put_u32(wal->buf + 8, tree_crc32(0, wal->buf + TREE_WAL_HEADER_SIZE, len));
+	len += TREE_WAL_HEADER_SIZE;
+
+	for (done = 0; done < len; done += ret) {
+		ret = write(wal->fd, wal->buf + done, len - done);
+		if (ret <= 0) {
+			/* drop torn batch, so that next batches don't follow it */
+			if (done > 0 && ftruncate(wal->fd, end))
+				wal->failed = 1;
+			return -1;
+		}
+	}
+
+	if (fdatasync(wal->fd)) {
+		wal->failed = 1;
+		return -1;
+	}
+
+	wal->nr_logged += wal->nr_pending;
+	wal->nr_pending = 0;
+	return 0;
+}
+
+/*
+ * Log an operation and apply it (it is durable once its batch is committed).
+ */
+static int wal_log(struct tree_wal_t *wal, int op, int val)
+{
+	unsigned char *record;
+
+	if (!wal || wal->failed)
+		return -1;
+
+	/* a previous commit failed : batch is still full */
+	if (wal->nr_pending == wal->batch_size && tree_wal_commit(wal))
+		return -1;
+
+	if (op == TREE_WAL_OP_INSERT)
+		wal->tree->ops->insert(wal->tree, val);
+	else
+		wal->tree->ops->delete(wal->tree, val);
+
+	record = wal->buf + TREE_WAL_HEADER_SIZE + wal->nr_pending * TREE_WAL_RECORD_SIZE;
+	record[0] = op;
+	put_u32(record + 1, (uint32_t) val);
+
+	/* group commit */
+	if (++wal->nr_pending == wal->batch_size)
+		return tree_wal_commit(wal);
+
+	return 0;
+}
+
+/*
+ * Open a logged tree : snapshot is loaded (or an empty tree of given type is created), then log is
+ * replayed on top of it. Operations are committed by batches of batch_size, and a checkpoint is done
+ * every checkpoint_interval logged operations (never if 0).
+ */
+struct tree_wal_t *tree_wal_open(const char *log_path, const char *snapshot_path, int type, size_t batch_size,
+				 size_t checkpoint_interval)
+{
+	struct tree_wal_t *wal;
+
+	if (!log_path || !snapshot_path || batch_size == 0 || batch_size > TREE_WAL_MAX_BATCH)
+		return NULL;
+
+	wal = (struct tree_wal_t *) calloc(1, sizeof(struct tree_wal_t));
+	if (!wal)
+		return NULL;
+
+	wal->fd = -1;
+	wal->batch_size = batch_size;
+	wal->checkpoint_interval = checkpoint_interval;
+
+	wal->snapshot_path = strdup(snapshot_path);
+	wal->buf = (unsigned char *) malloc(TREE_WAL_HEADER_SIZE + batch_size * TREE_WAL_RECORD_SIZE);
+	if (!wal->snapshot_path || !wal->buf)
+		goto err;
+
+	/* load snapshot (a corrupted snapshot is an error, not an empty tree) */
+	if (access(snapshot_path, F_OK) == 0)
+		wal->tree = tree_load(snapshot_path);
+	else
+		wal->tree = tree_create(type);
+	if (!wal->tree)
+		goto err;
+
+	/* replay log */
+	wal->fd = open(log_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (wal->fd < 0 || wal_replay(wal))
+		goto err;
+
+	return wal;
+err:
+	tree_wal_close(wal);
+	return NULL;
+}
+
+/*
+ * Commit pending operations (one write and one fsync for all of them).
+ */
+int tree_wal_commit(struct tree_wal_t *wal)
+{
+	if (!wal || wal_flush(wal))
+		return -1;
+
+	/* periodic checkpoint */
+	if (wal->checkpoint_interval && wal->nr_logged >= wal->checkpoint_interval)
+		return tree_wal_checkpoint(wal);
+
+	return 0;
+}
+
+/*
+ * Checkpoint : save a snapshot of the tree and truncate the log. A crash in between is harmless,
+ * replaying the log on the new snapshot gives the same tree. Log is only truncated once the new
+ * snapshot is durable (tree_save() syncs its directory after rename).
+ */
+int tree_wal_checkpoint(struct tree_wal_t *wal)
+{
+	if (!wal || wal_flush(wal))
+		return -1;
+
+	if (tree_save(wal->tree, wal->snapshot_path))
+		return -1;
+
+	if (ftruncate(wal->fd, 0) || fsync(wal->fd))
+		return -1;
+
+	wal->nr_logged = 0;
+	return 0;
+}
+
+/*
+ * Log and apply an insertion.
+ */
+int tree_wal_insert(struct tree_wal_t *wal, int val)
+{
+	return wal_log(wal, TREE_WAL_OP_INSERT, val);
+}
+
+/*
+ * Log and apply a deletion.
+ */
+int tree_wal_delete(struct tree_wal_t *wal, int val)
+{
+	return wal_log(wal, TREE_WAL_OP_DELETE, val);
+}
+
+/*
+ * Commit pending operations and close a logged tree (the tree is freed).
+ */
+int tree_wal_close(struct tree_wal_t *wal)
+{
+	int ret = 0;
+
+	if (!wal)
+		return -1;
+
+	if (wal->fd >= 0) {
+		ret = wal_flush(wal);
+		close(wal->fd);
+	}
+
+	if (wal->tree)
+		wal->tree->ops->free(wal->tree);
+
+	free(wal->snapshot_path);
+	free(wal->buf);
+	free(wal);
+	return ret;
+}